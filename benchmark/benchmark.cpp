@@ -0,0 +1,345 @@
+// ========================================================================
+// Benchmarks Of The Ising Model
+// No Copyright. Vladislav Aleinik 2019
+// ========================================================================
+
+// Measures the hot paths of the model for the state graph, dimension, engine and
+// layout of the config, over the lattice sizes of benchmark_sizes:
+//   metropolis_step    - metropolisStep(), ns per attempted flip;
+//   metropolis_step_at - metropolisStepAt() at pregenerated sites, ns per attempted flip;
+//   calculate_energy,
+//   calculate_magnetization - full scans, ns per scan;
+//   sample             - whole samples of the configured engine for every thread count
+//                        of benchmark_threads, ns per sample.
+// Every benchmark is repeated benchmark_repeats times, each repeat taking at least
+// benchmark_min_time seconds. Results go to a JSON file, one record per benchmark.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "../model/Config.hpp"
+#include "../model/Simulation.hpp"
+
+#ifndef BENCHMARK_REVISION
+#define BENCHMARK_REVISION "unknown"
+#endif
+
+// ========================================================================
+// Timing
+// ========================================================================
+
+struct BenchmarkRecord
+{
+	const char* name;
+	const char* unit;      // What one operation is
+	int size;              // Lattice edge
+	size_t sites;
+	size_t threads;
+	double updatesPerOp;   // Attempted site updates or visited sites per operation
+	uint64_t ops;          // Operations per repeat
+	double nsPerOp;        // Median over the repeats
+	double nsPerOpMin;
+};
+
+// Keeps the compiler from dropping the scans:
+volatile double benchmark_sink;
+
+double monotonic_seconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fills in ops, nsPerOp and nsPerOpMin from repeats of body(count), which performs count operations.
+// The count doubles until one call takes benchmark_min_time, so warm-up is part of the calibration:
+template <typename Body>
+void time_operations(BenchmarkRecord& record, Body body)
+{
+	uint64_t count = 1;
+	while (true)
+	{
+		double start = monotonic_seconds();
+		body(count);
+		if (monotonic_seconds() - start >= benchmark_min_time) break;
+
+		count *= 2;
+	}
+
+	std::vector<double> nsPerOp;
+	for (size_t repeat = 0; repeat < benchmark_repeats; ++repeat)
+	{
+		double start = monotonic_seconds();
+		body(count);
+		nsPerOp.push_back(1e9 * (monotonic_seconds() - start) / count);
+	}
+
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+
+	record.ops        = count;
+	record.nsPerOp    = nsPerOp[nsPerOp.size() / 2];
+	record.nsPerOpMin = nsPerOp[0];
+}
+
+// Records the time of every sample and stops the run once there is enough of them:
+struct SampleTimer : SampleSink
+{
+	std::vector<double> stamps;
+
+	void write(const Observation& observation) override;
+	bool done() override;
+	void serialize(CheckpointArchive& archive) override {}
+};
+
+void SampleTimer::write(const Observation& observation)
+{
+	stamps.push_back(monotonic_seconds());
+}
+
+bool SampleTimer::done()
+{
+	return stamps.size() > benchmark_repeats &&
+	       stamps.back() - stamps.front() >= benchmark_repeats * benchmark_min_time;
+}
+
+// Intervals between samples are split into benchmark_repeats consecutive repeats:
+void time_samples(BenchmarkRecord& record, const SampleTimer& timer)
+{
+	size_t perRepeat = (timer.stamps.size() - 1) / benchmark_repeats;
+
+	std::vector<double> nsPerOp;
+	for (size_t repeat = 0; repeat < benchmark_repeats; ++repeat)
+	{
+		double elapsed = timer.stamps[(repeat + 1) * perRepeat] - timer.stamps[repeat * perRepeat];
+		nsPerOp.push_back(1e9 * elapsed / perRepeat);
+	}
+
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+
+	record.ops        = perRepeat;
+	record.nsPerOp    = nsPerOp[nsPerOp.size() / 2];
+	record.nsPerOpMin = nsPerOp[0];
+}
+
+// Comma-separated list of positive numbers:
+std::vector<size_t> parse_list(const char* list, const char* entry)
+{
+	std::vector<size_t> values;
+
+	for (const char* cur = list; *cur != '\0';)
+	{
+		char* end;
+		size_t value = strtoul(cur, &end, 10);
+		if (end == cur || value == 0 || (*end != ',' && *end != '\0'))
+		{
+			fprintf(stderr, "[ISING-MODEL] Unable to parse %s \"%s\"\n", entry, list);
+			exit(EXIT_FAILURE);
+		}
+
+		values.push_back(value);
+
+		cur = end;
+		if (*cur == ',') ++cur;
+	}
+
+	return values;
+}
+
+// ========================================================================
+// Benchmarks
+// ========================================================================
+
+template <typename Kind>
+void benchmark_kind(std::vector<BenchmarkRecord>& records)
+{
+	std::vector<size_t> sizes       = parse_list(benchmark_sizes,   "benchmark_sizes");
+	std::vector<size_t> threadCount = parse_list(benchmark_threads, "benchmark_threads");
+
+	ModelParameters parameters = {temperature, externalField, interactivity};
+
+	// Only sweep engines use more than one thread:
+	bool threaded = strcmp(update_engine, "metropolis") != 0 && strcmp(update_engine, "wolff") != 0 &&
+	                strcmp(update_engine, "n_fold_way") != 0;
+
+	for (size_t size : sizes)
+	{
+		int sizeZ = (Kind::DIMENSION == 3)? int(size) : 1;
+
+		Lattice<Kind> isingModel(size, size, sizeZ, getStateX<Kind>, getStateY<Kind>, seed, parameters,
+		                         layout_from_name(lattice_layout));
+		isingModel.refreshParameters();
+
+		size_t sites = isingModel.sites;
+
+		//=============================
+		// Single-site Metropolis moves
+		//=============================
+
+		printf("L=%zu: metropolis_step\n", size);
+
+		BenchmarkRecord step = {"metropolis_step", "flip", int(size), sites, 1, 1.0};
+		time_operations(step, [&](uint64_t count)
+		{
+			for (uint64_t i = 0; i < count; ++i)
+				isingModel.metropolisStep();
+		});
+		records.push_back(step);
+
+		// Same moves without the random site choice:
+		const size_t MOVES = 4096;
+		std::vector<int> moves(4 * MOVES);
+
+		RandomStream siteStream(seed, 1);
+		for (size_t move = 0; move < MOVES; ++move)
+		{
+			moves[4 * move + 0] = siteStream.below(size);
+			moves[4 * move + 1] = siteStream.below(size);
+			moves[4 * move + 2] = siteStream.below(sizeZ);
+			moves[4 * move + 3] = siteStream.next() & 3;
+		}
+
+		printf("L=%zu: metropolis_step_at\n", size);
+
+		BenchmarkRecord stepAt = {"metropolis_step_at", "flip", int(size), sites, 1, 1.0};
+		time_operations(stepAt, [&](uint64_t count)
+		{
+			for (uint64_t i = 0; i < count; ++i)
+			{
+				const int* move = &moves[4 * (i % MOVES)];
+				isingModel.metropolisStepAt(move[0], move[1], move[2], move[3], isingModel.rng, isingModel.totals);
+			}
+		});
+		records.push_back(stepAt);
+
+		//=====================
+		// Full lattice scans
+		//=====================
+
+		printf("L=%zu: calculate_energy\n", size);
+
+		BenchmarkRecord energy = {"calculate_energy", "scan", int(size), sites, 1, double(sites)};
+		time_operations(energy, [&](uint64_t count)
+		{
+			for (uint64_t i = 0; i < count; ++i)
+				benchmark_sink = isingModel.calculateEnergy();
+		});
+		records.push_back(energy);
+
+		printf("L=%zu: calculate_magnetization\n", size);
+
+		BenchmarkRecord magnetization = {"calculate_magnetization", "scan", int(size), sites, 1, double(sites)};
+		time_operations(magnetization, [&](uint64_t count)
+		{
+			for (uint64_t i = 0; i < count; ++i)
+				benchmark_sink = isingModel.calculateMagnetization();
+		});
+		records.push_back(magnetization);
+
+		//================================
+		// Whole samples of the engine
+		//================================
+
+		lattice_size_x = size;
+		lattice_size_y = size;
+		lattice_size_z = size;
+
+		// One warm-up sample, then as many as the timer wants:
+		burn_in_samples    = 1;
+		saved_data_samples = size_t(1) << 40;
+
+		bool attemptCounted = strcmp(update_engine, "metropolis") == 0 || strcmp(update_engine, "n_fold_way") == 0;
+		double updatesPerSample = (attemptCounted)?
+		                          double(mc_iters_per_sample) : double(sweeps_per_sample) * sites;
+
+		for (size_t poolThreads : threadCount)
+		{
+			if (!threaded && poolThreads != 1) continue;
+
+			printf("L=%zu: sample, %zu threads\n", size, poolThreads);
+
+			SampleTimer timer;
+			simulate_kind<Kind>(parameters, seed, poolThreads, timer, false);
+
+			BenchmarkRecord sample = {"sample", "sample", int(size), sites, poolThreads, updatesPerSample};
+			time_samples(sample, timer);
+			records.push_back(sample);
+		}
+	}
+}
+
+// ========================================================================
+// JSON Output
+// ========================================================================
+
+void write_json(const char* filename, const std::vector<BenchmarkRecord>& records)
+{
+	FILE* file = fopen(filename, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to open output file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"revision\": \"%s\",\n", BENCHMARK_REVISION);
+	fprintf(file, "  \"compiler\": \"%s\",\n", __VERSION__);
+	fprintf(file, "  \"timestamp\": %" PRId64 ",\n", int64_t(time(NULL)));
+	fprintf(file, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+	fprintf(file, "  \"observable_kernels\": \"%s\",\n", observableKernels().isa);
+	fprintf(file, "  \"state_graph\": [%d, %d],\n", state_graph_size_x, state_graph_size_y);
+	fprintf(file, "  \"lattice_dimension\": %d,\n", lattice_dimension);
+	fprintf(file, "  \"lattice_layout\": \"%s\",\n", lattice_layout);
+	fprintf(file, "  \"update_engine\": \"%s\",\n", update_engine);
+	fprintf(file, "  \"min_time\": %g,\n", benchmark_min_time);
+	fprintf(file, "  \"repeats\": %zu,\n", benchmark_repeats);
+	fprintf(file, "  \"results\": [\n");
+
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		const BenchmarkRecord& record = records[i];
+
+		fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"size\": %d, \"sites\": %zu, \"threads\": %zu, "
+		              "\"updates_per_op\": %.17g, \"ops\": %" PRIu64 ", \"ns_per_op\": %.6g, \"ns_per_op_min\": %.6g}%s\n",
+		        record.name, record.unit, record.size, record.sites, record.threads,
+		        record.updatesPerOp, record.ops, record.nsPerOp, record.nsPerOpMin,
+		        (i + 1 == records.size())? "" : ",");
+	}
+
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+
+	fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "[ISING-MODEL] Expected input: benchmark <config file> <output file>\n");
+		exit(EXIT_FAILURE);
+	}
+
+	read_config(argv[1]);
+
+	if (benchmark_repeats == 0) benchmark_repeats = 1;
+
+	printf("Benchmarking %dx%d states on a %dD lattice, %s engine (%s observable kernels)\n",
+	       state_graph_size_x, state_graph_size_y, lattice_dimension, update_engine, observableKernels().isa);
+
+	std::vector<BenchmarkRecord> records;
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		benchmark_kind<decltype(kind)>(records);
+	});
+
+	write_json(argv[2], records);
+
+	printf("Benchmark results written to %s\n", argv[2]);
+
+	return EXIT_SUCCESS;
+}
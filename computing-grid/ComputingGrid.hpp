@@ -2,14 +2,105 @@
 #ifndef COMPUTING_GRID_HPP_INCLUDED
 #define COMPUTING_GRID_HPP_INCLUDED
 
+// Protocol of the computing grid.
+// The server splits the (temperature, field, repetition) grid of batch mode into
+// tasks of one point each. Clients pull tasks one at a time, run them in-process
+// and stream the samples back. Every message is a MessageHeader followed by
+// header.length bytes of payload; all integers and doubles are sent in the
+// native byte order, so every machine of the grid has to share it.
+//
+//   client                         server
+//     <------ HERE_IS_YOUR_CONFIG -----   config file text, right after connect
+//     ------- I_WANT_TASKS ----------->   one per idle worker thread
+//     <------ HERE_IS_YOUR_TASK -------   GridTask
+//     ------- TASK_DONE -------------->   GridTask.id + 2 * saved_data_samples doubles
+//     ------- HEARTBEAT -------------->   every grid_heartbeat_interval seconds
+//     <------ ALL_TASKS_DONE ----------   when the whole grid is computed
+//
+// A client that closes the connection or stays silent for grid_heartbeat_timeout
+// seconds is dropped and its tasks are issued to other clients.
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
 enum RequestType
 {
 	I_WANT_TASKS,
 	HERE_IS_YOUR_TASK,
-	TASK_DONE
+	TASK_DONE,
+	HERE_IS_YOUR_CONFIG,
+	HEARTBEAT,
+	ALL_TASKS_DONE
+};
+
+struct MessageHeader
+{
+	uint32_t type;
+	uint32_t length;
 };
 
+struct GridTask
+{
+	uint64_t id;          // Index of the point in the batch grid
+	double   temperature; // Kelvins
+	double   field;       // Config units
+	uint64_t repetition;
+	uint64_t seed;        // Seed of the point, the same one batch mode uses
+};
+
+// Messages are small, so both helpers simply loop until everything is transferred:
+bool send_all(int sock, const void* buffer, size_t size)
+{
+	const char* bytes = (const char*) buffer;
+	while (size != 0)
+	{
+		ssize_t sent = send(sock, bytes, size, MSG_NOSIGNAL);
+		if (sent <= 0) return false;
 
+		bytes += sent;
+		size  -= sent;
+	}
 
-#endif  // COMPUTING_GRID_HPP_INCLUDED
+	return true;
+}
+
+bool receive_all(int sock, void* buffer, size_t size)
+{
+	char* bytes = (char*) buffer;
+	while (size != 0)
+	{
+		ssize_t received = recv(sock, bytes, size, 0);
+		if (received <= 0) return false;
+
+		bytes += received;
+		size  -= received;
+	}
+
+	return true;
+}
+
+bool send_message(int sock, RequestType type, const void* payload = nullptr, size_t length = 0)
+{
+	MessageHeader header = {uint32_t(type), uint32_t(length)};
+
+	return send_all(sock, &header, sizeof(header)) && send_all(sock, payload, length);
+}
 
+// Payloads are limited, so a broken peer can not make us allocate arbitrary amounts:
+const uint32_t MAX_MESSAGE_LENGTH = 1 << 28;
+
+bool receive_message(int sock, MessageHeader* header, std::vector<char>* payload)
+{
+	if (!receive_all(sock, header, sizeof(*header))) return false;
+	if (header->length > MAX_MESSAGE_LENGTH)         return false;
+
+	payload->resize(header->length);
+
+	return receive_all(sock, payload->data(), header->length);
+}
+
+#endif  // COMPUTING_GRID_HPP_INCLUDED
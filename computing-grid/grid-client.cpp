@@ -1,17 +1,245 @@
 // No Copyright. Vladislav Aleinik 2019
 
-int main()
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include "ComputingGrid.hpp"
+#include "../model/Config.hpp"
+#include "../model/Simulation.hpp"
+
+// ========================================================================
+// Shared State
+// ========================================================================
+
+// Worker threads ask for tasks and send results, the main thread receives tasks,
+// the heartbeat thread keeps the server from re-issuing tasks that are still running:
+struct GridClient
+{
+	int sock;
+
+	std::mutex sendMutex;
+
+	std::mutex queueMutex;
+	std::condition_variable queueChanged;
+	std::deque<GridTask> tasks;
+	bool finished;
+
+	bool send(RequestType type, const void* payload = nullptr, size_t length = 0);
+	bool nextTask(GridTask* task);
+	void finish();
+};
+
+bool GridClient::send(RequestType type, const void* payload, size_t length)
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	return send_message(sock, type, payload, length);
+}
+
+// Blocks until a task arrives or the grid is done:
+bool GridClient::nextTask(GridTask* task)
 {
+	std::unique_lock<std::mutex> lock(queueMutex);
+	queueChanged.wait(lock, [&]() { return finished || !tasks.empty(); });
+
+	if (tasks.empty()) return false;
+
+	*task = tasks.front();
+	tasks.pop_front();
+	return true;
+}
+
+void GridClient::finish()
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	finished = true;
+	queueChanged.notify_all();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3 && argc != 4)
+	{
+		fprintf(stderr, "Usage: grid-client <server host> <server port> [worker threads]\n");
+		exit(EXIT_FAILURE);
+	}
+
 	// ========================================================================
-	// Aquire Connection Socket                                                
+	// Aquire Connection Socket
 	// ========================================================================
-	
-	int conn_sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	struct addrinfo hints;
+	struct addrinfo* addr;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(argv[1], argv[2], &hints, &addr) != 0)
+	{
+		fprintf(stderr, "[COMPUTING-GRID] Unable to resolve the server address\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int conn_sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
 	if (conn_sock == -1)
 	{
 		fprintf(stderr, "[COMPUTING-GRID] Unable to get socket\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (connect(conn_sock, addr->ai_addr, addr->ai_addrlen) == -1)
+	{
+		fprintf(stderr, "[COMPUTING-GRID] Unable to connect to %s:%s\n", argv[1], argv[2]);
+		exit(EXIT_FAILURE);
+	}
+
+	freeaddrinfo(addr);
+
+	// ========================================================================
+	// Receive Config
+	// ========================================================================
+
+	MessageHeader header;
+	std::vector<char> payload;
+
+	if (!receive_message(conn_sock, &header, &payload) || header.type != HERE_IS_YOUR_CONFIG)
+	{
+		fprintf(stderr, "[COMPUTING-GRID] Unable to receive config from the server\n");
+		exit(EXIT_FAILURE);
+	}
+
+	FILE* conf_file = fmemopen(payload.data(), payload.size(), "r");
+	if (conf_file == NULL)
+	{
+		fprintf(stderr, "[COMPUTING-GRID] Unable to read the received config\n");
+		exit(EXIT_FAILURE);
+	}
+
+	read_config_stream(conf_file);
+	fclose(conf_file);
+
+	// Every worker runs whole points on its own, like batch mode does:
+	size_t workerThreads = (argc == 4)? strtoul(argv[3], NULL, 10) : threads;
+	if (workerThreads == 0) workerThreads = 1;
+
+	printf("Connected to %s:%s, running %zu worker threads\n", argv[1], argv[2], workerThreads);
+
+	// Clients of one host share the config, so the pid goes before the extension of the metrics file:
+	char metricsFile[320];
+	std::unique_ptr<MetricsExporter> exporter;
+	if (strcmp(metrics_file, "none") != 0)
+	{
+		const char* slash = strrchr(metrics_file, '/');
+		const char* dot   = strrchr(metrics_file, '.');
+		if (dot == NULL || (slash != NULL && dot < slash)) dot = metrics_file + strlen(metrics_file);
+
+		snprintf(metricsFile, sizeof(metricsFile), "%.*s.%d%s", int(dot - metrics_file), metrics_file, int(getpid()), dot);
+		exporter.reset(new MetricsExporter(metricsFile, metrics_interval));
+	}
+
+	GridClient client;
+	client.sock     = conn_sock;
+	client.finished = false;
+
+	// ========================================================================
+	// Worker And Heartbeat Threads
+	// ========================================================================
+
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < workerThreads; ++i)
+	{
+		workers.emplace_back([&client]()
+		{
+			std::vector<char> result(sizeof(uint64_t) + 2 * saved_data_samples * sizeof(double));
+			GridTask task;
+
+			while (client.send(I_WANT_TASKS) && client.nextTask(&task))
+			{
+				memcpy(result.data(), &task.id, sizeof(uint64_t));
+
+				// Points that reach their target errors early leave NaN in the rest, like batch mode:
+				double* samples = (double*) (result.data() + sizeof(uint64_t));
+				std::fill(samples, samples + 2 * saved_data_samples, NAN);
+
+				SampleBuffer buffer(samples, saved_data_samples);
+				StatisticsSink statistics(buffer);
+				simulate_point(make_parameters(task.temperature, task.field), task.seed, 1, statistics, false);
+
+				// The server re-issues an unreported task, so a dead socket only stops the worker:
+				if (!client.send(TASK_DONE, result.data(), result.size())) break;
+			}
+		});
+	}
+
+	std::thread heartbeat([&client]()
+	{
+		auto interval = std::chrono::duration<double>(grid_heartbeat_interval);
+
+		std::unique_lock<std::mutex> lock(client.queueMutex);
+		while (!client.queueChanged.wait_for(lock, interval, [&]() { return client.finished; }))
+		{
+			lock.unlock();
+			client.send(HEARTBEAT);
+			lock.lock();
+		}
+	});
+
+	// ========================================================================
+	// Receive Loop
+	// ========================================================================
+
+	size_t received = 0;
+	while (true)
+	{
+		if (!receive_message(conn_sock, &header, &payload))
+		{
+			// The server re-issues our tasks, so there is nothing to save:
+			fprintf(stderr, "[COMPUTING-GRID] Lost connection to the server\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (header.type == ALL_TASKS_DONE) break;
+
+		if (header.type != HERE_IS_YOUR_TASK || payload.size() != sizeof(GridTask))
+		{
+			fprintf(stderr, "[COMPUTING-GRID] Unexpected message from the server\n");
+			exit(EXIT_FAILURE);
+		}
+
+		GridTask task;
+		memcpy(&task, payload.data(), sizeof(task));
+
+		std::lock_guard<std::mutex> lock(client.queueMutex);
+		client.tasks.push_back(task);
+		client.queueChanged.notify_all();
+
+		received += 1;
+	}
+
+	client.finish();
+
+	for (std::thread& worker : workers) worker.join();
+	heartbeat.join();
+
+	close(conn_sock);
+
+	printf("Grid computed, %zu tasks done here\n", received);
+
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -1,38 +1,321 @@
 // No Copyright. Vladislav Aleinik 2019
 
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <vector>
+
 #include <sys/socket.h>
 #include <netinet/ip.h>
 #include <sys/types.h>
 #include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "ComputingGrid.hpp"
+#include "../model/Config.hpp"
+#include "../model/Batch.hpp"
+
+// ========================================================================
+// Workers And Tasks
+// ========================================================================
 
-int main()
+struct GridWorker
 {
-	// ========================================================================
-	// Aquire And Bind Connection Socket                                                
-	// ========================================================================
-	
-	int server_sock = socket(AF_INET, SOCK_STREAM, 0);
-	if (server_sock == -1)
+	int sock;
+	double lastSeen;              // Seconds on the monotonic clock
+	size_t pendingRequests;       // I_WANT_TASKS not answered yet
+	std::vector<uint64_t> tasks;  // Issued and not done yet
+};
+
+const int NO_WORKER = -1;
+
+double monotonic_seconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::vector<char> read_file(const char* filename)
+{
+	FILE* file = std::fopen(filename, "r");
+	if (file == NULL)
 	{
-		fprintf(stderr, "[COMPUTING-GRID] Unable to get socket\n");
+		fprintf(stderr, "[COMPUTING-GRID] Unable to open config file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<char> text;
+	char buffer[4096];
+	size_t read = 0;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) != 0)
+	{
+		text.insert(text.end(), buffer, buffer + read);
+	}
+
+	fclose(file);
+	return text;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: grid-server <config file> <output file>\n");
 		exit(EXIT_FAILURE);
 	}
 
+	// Clients parse exactly the text the server parsed:
+	read_config(argv[1]);
+	std::vector<char> configText = read_file(argv[1]);
+
+	std::vector<BatchPoint> points = batch_points();
+
+	std::vector<double>   index(3 * points.size());
+	std::vector<double>   data (2 * saved_data_samples * points.size());
+	std::vector<int>      owner(points.size(), NO_WORKER); // Socket of the worker running the task
+	std::deque<uint64_t>  waiting;
+	size_t completed = 0;
+
+	for (uint64_t task = 0; task < points.size(); ++task)
+	{
+		index[3 * task + 0] = points[task].temperature;
+		index[3 * task + 1] = points[task].field;
+		index[3 * task + 2] = points[task].repetition;
+
+		waiting.push_back(task);
+	}
+
+	printf("Computing %zu points (%zu temperatures, %zu fields, %zu repetitions) on port %d\n",
+	       points.size(), temperature_steps, field_steps, repetitions, grid_port);
+
+	// ========================================================================
+	// Aquire And Bind Connection Socket
+	// ========================================================================
+
 	struct addrinfo hints;
 	struct addrinfo* addr;
 
-	hints.ai_family = AF_UNSPEC;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = AI_PASSIVE;
 
+	char port[16];
+	snprintf(port, sizeof(port), "%d", grid_port);
+
+	if (getaddrinfo(NULL, port, &hints, &addr) != 0)
+	{
+		fprintf(stderr, "[COMPUTING-GRID] Unable to resolve the server address\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int server_sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+	if (server_sock == -1)
+	{
+		fprintf(stderr, "[COMPUTING-GRID] Unable to get socket\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int reuse = 1;
+	setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if (bind(server_sock, addr->ai_addr, addr->ai_addrlen) == -1 || listen(server_sock, 64) == -1)
+	{
+		fprintf(stderr, "[COMPUTING-GRID] Unable to listen on port %d\n", grid_port);
+		exit(EXIT_FAILURE);
+	}
+
+	freeaddrinfo(addr);
+
 	// ========================================================================
-	// Server Accept Loop                                                
+	// Server Accept Loop
 	// ========================================================================
 
-	while (true)
+	std::vector<GridWorker> workers;
+
+	// Tasks of a lost worker go to the front of the queue:
+	auto drop_worker = [&](size_t w, const char* reason)
+	{
+		GridWorker& worker = workers[w];
+
+		printf("\n[COMPUTING-GRID] Worker %d %s, re-issuing %zu tasks\n", worker.sock, reason, worker.tasks.size());
+
+		for (uint64_t task : worker.tasks)
+		{
+			owner[task] = NO_WORKER;
+			waiting.push_front(task);
+		}
+
+		close(worker.sock);
+		workers.erase(workers.begin() + w);
+	};
+
+	// Silent peers must not block the loop on a half received message:
+	struct timeval timeout;
+	timeout.tv_sec  = time_t(grid_heartbeat_timeout);
+	timeout.tv_usec = suseconds_t(1e6 * (grid_heartbeat_timeout - timeout.tv_sec));
+
+	std::vector<pollfd> polled;
+	MessageHeader header;
+	std::vector<char> payload;
+
+	while (completed != points.size())
+	{
+		polled.assign(1, {server_sock, POLLIN, 0});
+		for (const GridWorker& worker : workers)
+		{
+			polled.push_back({worker.sock, POLLIN, 0});
+		}
+
+		if (poll(polled.data(), polled.size(), int(1000 * grid_heartbeat_interval)) == -1)
+		{
+			fprintf(stderr, "[COMPUTING-GRID] Unable to poll sockets\n");
+			exit(EXIT_FAILURE);
+		}
+
+		double now = monotonic_seconds();
+
+		// Messages of the workers. Polled entry i + 1 belongs to workers[i] as of the poll,
+		// so the workers are walked backwards and dropping one does not shift the rest:
+		for (size_t w = workers.size(); w-- != 0;)
+		{
+			if (polled[w + 1].revents == 0) continue;
+
+			GridWorker& worker = workers[w];
+			if (!receive_message(worker.sock, &header, &payload))
+			{
+				drop_worker(w, "disconnected");
+				continue;
+			}
+
+			worker.lastSeen = now;
+
+			if (header.type == I_WANT_TASKS)
+			{
+				worker.pendingRequests += 1;
+			}
+			else if (header.type == TASK_DONE)
+			{
+				uint64_t task;
+				if (payload.size() != sizeof(task) + 2 * saved_data_samples * sizeof(double))
+				{
+					drop_worker(w, "sent a malformed result");
+					continue;
+				}
+
+				memcpy(&task, payload.data(), sizeof(task));
+				if (task >= points.size() || owner[task] != worker.sock)
+				{
+					drop_worker(w, "sent a result of a task it does not own");
+					continue;
+				}
+
+				memcpy(&data[2 * saved_data_samples * task], payload.data() + sizeof(task),
+				       2 * saved_data_samples * sizeof(double));
+
+				owner[task] = NO_WORKER;
+				completed  += 1;
+
+				for (size_t i = 0; i < worker.tasks.size(); ++i)
+				{
+					if (worker.tasks[i] == task)
+					{
+						worker.tasks.erase(worker.tasks.begin() + i);
+						break;
+					}
+				}
+
+				printf("\rComputation in progress: %02.0f%%", 100.0 * completed / points.size());
+				fflush(stdout);
+			}
+			else if (header.type != HEARTBEAT)
+			{
+				drop_worker(w, "sent an unexpected message");
+			}
+		}
+
+		// Heartbeats:
+		for (size_t w = workers.size(); w-- != 0;)
+		{
+			if (now - workers[w].lastSeen > grid_heartbeat_timeout)
+			{
+				drop_worker(w, "timed out");
+			}
+		}
+
+		// New workers get the config first:
+		if (polled[0].revents & POLLIN)
+		{
+			int sock = accept(server_sock, NULL, NULL);
+			if (sock != -1)
+			{
+				setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+				if (send_message(sock, HERE_IS_YOUR_CONFIG, configText.data(), configText.size()))
+				{
+					workers.push_back({sock, now, 0, {}});
+					printf("\n[COMPUTING-GRID] Worker %d connected\n", sock);
+				}
+				else
+				{
+					close(sock);
+				}
+			}
+		}
+
+		// Pull-based scheduling, one task per request:
+		for (size_t w = workers.size(); w-- != 0;)
+		{
+			GridWorker& worker = workers[w];
+			while (worker.pendingRequests != 0 && !waiting.empty())
+			{
+				uint64_t task = waiting.front();
+				waiting.pop_front();
+
+				const BatchPoint& point = points[task];
+				GridTask message = {task, point.temperature, point.field, point.repetition, counterHash(seed, task)};
+
+				owner[task] = worker.sock;
+				worker.tasks.push_back(task);
+				worker.pendingRequests -= 1;
+
+				if (!send_message(worker.sock, HERE_IS_YOUR_TASK, &message, sizeof(message)))
+				{
+					drop_worker(w, "disconnected");
+					break;
+				}
+			}
+		}
+	}
+
+	printf("\rComputation in progress: %02.0f%%", 100.0);
+	printf("\nComputation completed!\n");
+
+	for (const GridWorker& worker : workers)
 	{
+		send_message(worker.sock, ALL_TASKS_DONE);
+		close(worker.sock);
+	}
+
+	close(server_sock);
+
+	// Statistics depend on the samples only, so they match the ones of the clients:
+	size_t sites = size_t(lattice_size_x) * lattice_size_y * ((lattice_dimension == 3)? lattice_size_z : 1);
 
+	std::vector<double> summaries(STATISTICS_COLUMNS * points.size());
+	for (size_t task = 0; task < points.size(); ++task)
+	{
+		summary_to_row(summarize_samples(&data[2 * saved_data_samples * task], saved_data_samples, sites),
+		               &summaries[STATISTICS_COLUMNS * task]);
 	}
 
+	// Same layout as batch mode:
+	cnpy::npz_save(argv[2], "index", index.data(), {points.size(), 3},                     "w");
+	cnpy::npz_save(argv[2], "data",  data.data(),  {points.size(), saved_data_samples, 2}, "a");
+	cnpy::npz_save(argv[2], "statistics", summaries.data(), {points.size(), STATISTICS_COLUMNS}, "a");
+
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
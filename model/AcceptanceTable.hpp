@@ -0,0 +1,157 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_ACCEPTANCE_TABLE_HPP_INCLUDED
+#define POTTS_MODEL_ACCEPTANCE_TABLE_HPP_INCLUDED
+
+#include "ModelKind.hpp"
+#include "Parameters.hpp"
+
+#include <cmath>
+#include <vector>
+
+// Cache of Metropolis acceptance probabilities.
+// The energy change of a move depends only on the current state, the move and
+// the multiset of the six neighbour states. The multiset is encoded as the sum
+// of per-state codes (N + 1)^(state - 1) (state 0 has code 0) for N neighbours:
+// every count is at most N, so the sum is a base-(N + 1) number with one digit
+// per nonzero state.
+// Next to each probability the table keeps the energy change of the move,
+// which lets the lattice track its total energy.
+// The table is rebuilt whenever temperature, field or interactivity change.
+template <typename Kind>
+struct AcceptanceTable
+{
+	static constexpr int NEIGHBOURS = Kind::NEIGHBOURS;
+	static constexpr int MOVES      = 4;
+	static constexpr int STATES     = Kind::STATES;
+	static constexpr size_t MAX_ENTRIES = 1 << 14;
+
+	using StateGraph = typename Kind::StateGraph;
+
+	const StateGraph& stateGraph;
+
+	bool enabled;
+	int neighbourCodes;
+	int codeOf  [STATES];
+	int newState[STATES][MOVES];
+	std::vector<double> probability;
+	std::vector<double> deltaEnergy;
+	double deltaMagnetization[STATES][MOVES];
+
+	ModelParameters built;
+
+	AcceptanceTable(const StateGraph& graph);
+
+	inline bool stale(const ModelParameters& parameters) const;
+	void rebuild(const ModelParameters& parameters);
+
+	inline size_t entry(int code, int curState, int move) const;
+};
+
+template <typename Kind>
+AcceptanceTable<Kind>::AcceptanceTable(const StateGraph& graph) :
+	stateGraph         (graph),
+	enabled            (false),
+	neighbourCodes     (1),
+	codeOf             (),
+	newState           (),
+	probability        (),
+	deltaEnergy        (),
+	deltaMagnetization (),
+	built              ({NAN, Vector(NAN, NAN, NAN), NAN})
+{
+	// Large graphs are left to the exact evaluation before the codes overflow:
+	size_t codes = 1;
+	for (int state = 1; state < STATES && codes * STATES * MOVES <= MAX_ENTRIES; ++state)
+	{
+		codes *= NEIGHBOURS + 1;
+	}
+
+	enabled = codes * STATES * MOVES <= MAX_ENTRIES;
+	for (int state = 0; enabled && state < STATES; ++state)
+	{
+		codeOf[state] = (state == 0)? 0 : neighbourCodes;
+		if (state != 0) neighbourCodes *= NEIGHBOURS + 1;
+	}
+
+	// Same moves as in Lattice::metropolisStepAt:
+	for (int stateX = 0; stateX < Kind::STATES_X; ++stateX) {
+	for (int stateY = 0; stateY < Kind::STATES_Y; ++stateY) {
+		int state = stateX * Kind::STATES_Y + stateY;
+		int prevX = (stateX == 0)? Kind::STATES_X - 1 : stateX - 1;
+		int prevY = (stateY == 0)? Kind::STATES_Y - 1 : stateY - 1;
+
+		newState[state][0] = ((stateX + 1) % Kind::STATES_X) * Kind::STATES_Y + stateY;
+		newState[state][1] = prevX                            * Kind::STATES_Y + stateY;
+		newState[state][2] = stateX * Kind::STATES_Y + (stateY + 1) % Kind::STATES_Y;
+		newState[state][3] = stateX * Kind::STATES_Y + prevY;
+
+		for (int move = 0; move < MOVES; ++move)
+		{
+			deltaMagnetization[state][move] = stateGraph.spins[newState[state][move]].z - stateGraph.spins[state].z;
+		}
+	}}
+
+	if (enabled)
+	{
+		probability.resize(neighbourCodes * STATES * MOVES);
+		deltaEnergy.resize(neighbourCodes * STATES * MOVES);
+	}
+}
+
+template <typename Kind>
+inline bool AcceptanceTable<Kind>::stale(const ModelParameters& parameters) const
+{
+	return built != parameters;
+}
+
+template <typename Kind>
+void AcceptanceTable<Kind>::rebuild(const ModelParameters& parameters)
+{
+	built = parameters;
+
+	if (!enabled) return;
+
+	for (int code = 0; code < neighbourCodes; ++code)
+	{
+		// Decode neighbour counts; codes with too many neighbours are never looked up:
+		int counts[STATES] = {};
+		int rest = code, nonzero = 0;
+		for (int state = 1; state < STATES; ++state)
+		{
+			counts[state] = rest % (NEIGHBOURS + 1);
+			rest         /= NEIGHBOURS + 1;
+			nonzero      += counts[state];
+		}
+		if (nonzero > NEIGHBOURS) continue;
+		counts[0] = NEIGHBOURS - nonzero;
+
+		Vector neighbourSum(0.0, 0.0, 0.0);
+		for (int state = 0; state < STATES; ++state)
+		{
+			neighbourSum += stateGraph.spins[state] * counts[state];
+		}
+		Vector interactionVector = neighbourSum * parameters.interactivity + parameters.externalField;
+
+		for (int cur = 0; cur < STATES; ++cur)
+		{
+			for (int move = 0; move < MOVES; ++move)
+			{
+				double curEnergy = -stateGraph.spins[cur                ].scalar(interactionVector);
+				double nxtEnergy = -stateGraph.spins[newState[cur][move]].scalar(interactionVector);
+
+				// Downhill moves are accepted without a toss:
+				probability[entry(code, cur, move)] =
+					(curEnergy > nxtEnergy)? 2.0 : exp((curEnergy - nxtEnergy) / parameters.temperature);
+				deltaEnergy[entry(code, cur, move)] = nxtEnergy - curEnergy;
+			}
+		}
+	}
+}
+
+template <typename Kind>
+inline size_t AcceptanceTable<Kind>::entry(int code, int curState, int move) const
+{
+	return (code * STATES + curState) * MOVES + move;
+}
+
+#endif  // POTTS_MODEL_ACCEPTANCE_TABLE_HPP_INCLUDED
@@ -0,0 +1,269 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_BATCH_HPP_INCLUDED
+#define POTTS_MODEL_BATCH_HPP_INCLUDED
+
+// Batch mode: every (temperature, field, repetition) point of a grid is simulated
+// by one process on an internal thread pool, results go to a single .npz file:
+//   index - (points, 3) array of (temperature, field, repetition) in config units;
+//   data       - (points, saved_data_samples, 2) array of (magnetization, energy) samples,
+//                NaN past the last sample of a point that reached its target errors early;
+//   statistics - (points, STATISTICS_COLUMNS) summaries of the points, see Statistics.hpp:
+//                samples, discarded, m, m error, m tau_int, |m|, |m| error,
+//                e, e error, e tau_int, var m, var m error, var e, var e error.
+// With replica_batch set, up to that many repetitions of a (temperature, field) point
+// run as the replicas of one ReplicaLattice, see Replicas.hpp. Every repetition keeps
+// its seed, data row and statistics.
+// With histogram_resolution set, samples are also binned into joint histograms, see Reweighting.hpp:
+//   histograms - (bins, 4) rows of (point, e_int, m, samples) over the bins of every point;
+// and with reweight_temperature_steps set, the histograms are combined by Ferrenberg-Swendsen
+// reweighting onto a reweight_temperature_steps x reweight_field_steps grid over the same ranges:
+//   reweighted - (grid points, REWEIGHTED_COLUMNS) rows of
+//                (temperature, field, m, |m|, e, var m, var e, susceptibility, specific heat).
+
+#include "Simulation.hpp"
+#include "Replicas.hpp"
+#include "Reweighting.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "vendor/cnpy/cnpy.h"
+
+struct BatchPoint
+{
+	double temperature; // Kelvins
+	double field;       // Config units
+	size_t repetition;
+};
+
+// Output arrays, one entry or row per point:
+struct BatchResults
+{
+	std::vector<double> index;
+	std::vector<double> data;
+	std::vector<double> summaries;
+	std::vector<JointHistogram> histograms;
+	std::vector<double> inefficiencies; // 2 tau_int(e), for the reweighting
+
+	BatchResults(size_t points);
+
+	// Fills in the index, summary and histogram entries of a finished point:
+	void finishPoint(size_t task, const BatchPoint& point, const StatisticsSink& statistics,
+	                 const HistogramSink& histogram);
+};
+
+BatchResults::BatchResults(size_t points) :
+	index          (3 * points),
+	data           (2 * saved_data_samples * points, NAN),
+	summaries      (STATISTICS_COLUMNS * points),
+	histograms     (points),
+	inefficiencies (points)
+{}
+
+void BatchResults::finishPoint(size_t task, const BatchPoint& point, const StatisticsSink& statistics,
+                               const HistogramSink& histogram)
+{
+	index[3 * task + 0] = point.temperature;
+	index[3 * task + 1] = point.field;
+	index[3 * task + 2] = point.repetition;
+
+	StatisticsSummary summary = statistics.statistics.summary();
+	summary_to_row(summary, &summaries[STATISTICS_COLUMNS * task]);
+
+	// The statistical inefficiency is measured on the equilibrated samples only:
+	histograms    [task] = histogram.histogram(summary.discarded);
+	inefficiencies[task] = 2.0 * summary.energyTau;
+}
+
+// Evenly spaced values from start to end inclusive, like numpy.linspace:
+inline double linspace_at(double start, double end, size_t count, size_t i)
+{
+	return (count <= 1)? start : start + (end - start) * i / (count - 1);
+}
+
+std::vector<BatchPoint> batch_points()
+{
+	std::vector<BatchPoint> points;
+
+	for (size_t t = 0; t < temperature_steps; ++t) {
+	for (size_t h = 0; h <       field_steps; ++h) {
+	for (size_t r = 0; r <       repetitions; ++r) {
+		points.push_back({linspace_at(temperature_start, temperature_end, temperature_steps, t),
+		                  linspace_at(      field_start,       field_end,       field_steps, h), r});
+	}}}
+
+	return points;
+}
+
+void run_batch_points(const std::vector<BatchPoint>& points, BatchResults& results)
+{
+	// Points are independent, so every thread runs whole points on its own:
+	ThreadPool pool(threads);
+	std::atomic<size_t> completed(0);
+
+	pool.run(points.size(), [&](size_t task, size_t worker)
+	{
+		const BatchPoint& point = points[task];
+		ModelParameters parameters = make_parameters(point.temperature, point.field);
+
+		SampleBuffer samples(&results.data[2 * saved_data_samples * task], saved_data_samples);
+		StatisticsSink statistics(samples);
+		HistogramSink histogram(statistics, parameters);
+
+		SampleSink& sink = (histogram_resolution > 0.0)? static_cast<SampleSink&>(histogram) : statistics;
+		simulate_point(parameters, counterHash(seed, task), 1, sink, false);
+
+		results.finishPoint(task, point, statistics, histogram);
+
+		size_t done = ++completed;
+		if (worker == 0)
+		{
+			printf("\rComputation in progress: %02.0f%%", 100.0 * done / points.size());
+			fflush(stdout);
+		}
+	});
+}
+
+// Repetitions of a point are consecutive, they are split into groups of at most
+// replica_batch and every thread runs whole groups on its own:
+void run_batch_replicas(const std::vector<BatchPoint>& points, BatchResults& results)
+{
+	if (strcmp(update_engine, "checkerboard") != 0 && strcmp(update_engine, "multispin") != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Replica batching runs checkerboard sweeps, "
+		                "update engine \"%s\" is not supported\n", update_engine);
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<size_t> groupStarts;
+	for (size_t task = 0; task < points.size(); ++task)
+	{
+		if (points[task].repetition % replica_batch == 0) groupStarts.push_back(task);
+	}
+	groupStarts.push_back(points.size());
+
+	ThreadPool pool(threads);
+	std::atomic<size_t> completed(0);
+
+	pool.run(groupStarts.size() - 1, [&](size_t group, size_t worker)
+	{
+		size_t first = groupStarts[group];
+		size_t last  = groupStarts[group + 1];
+
+		std::vector<std::unique_ptr<SampleBuffer>>   buffers;
+		std::vector<std::unique_ptr<StatisticsSink>> statistics;
+		std::vector<std::unique_ptr<HistogramSink>>  histograms;
+		std::vector<SampleSink*> sinks;
+		std::vector<uint64_t> replicaSeeds;
+
+		ModelParameters parameters = make_parameters(points[first].temperature, points[first].field);
+
+		for (size_t task = first; task < last; ++task)
+		{
+			buffers   .emplace_back(new SampleBuffer(&results.data[2 * saved_data_samples * task], saved_data_samples));
+			statistics.emplace_back(new StatisticsSink(*buffers.back()));
+			histograms.emplace_back(new HistogramSink(*statistics.back(), parameters));
+
+			if (histogram_resolution > 0.0) sinks.push_back(histograms.back().get());
+			else                            sinks.push_back(statistics.back().get());
+
+			// Same initial state as the repetition run on its own:
+			replicaSeeds.push_back(counterHash(seed, task));
+		}
+
+		simulate_replicas(parameters, replicaSeeds, counterHash(seed, first), 1, sinks);
+
+		for (size_t task = first; task < last; ++task)
+		{
+			results.finishPoint(task, points[task], *statistics[task - first], *histograms[task - first]);
+		}
+
+		size_t done = (completed += last - first);
+		if (worker == 0)
+		{
+			printf("\rComputation in progress: %02.0f%%", 100.0 * done / points.size());
+			fflush(stdout);
+		}
+	});
+}
+
+void save_histograms(const char* output_file, const std::vector<JointHistogram>& histograms)
+{
+	std::vector<double> rows;
+	for (size_t point = 0; point < histograms.size(); ++point)
+	{
+		const JointHistogram& histogram = histograms[point];
+		for (const auto& bin : histogram.counts)
+		{
+			rows.insert(rows.end(), {double(point), histogram.center(bin.first.first),
+			                         histogram.center(bin.first.second), double(bin.second)});
+		}
+	}
+
+	cnpy::npz_save(output_file, "histograms", rows.data(), {rows.size() / 4, 4}, "a");
+}
+
+void reweight_batch(const char* output_file, const std::vector<BatchPoint>& points, const BatchResults& results)
+{
+	size_t sites = size_t(lattice_size_x) * lattice_size_y * ((lattice_dimension == 3)? lattice_size_z : 1);
+
+	MultiHistogram combined(sites);
+	for (size_t task = 0; task < points.size(); ++task)
+	{
+		combined.addPoint(points[task].temperature, points[task].field, results.histograms[task],
+		                  results.inefficiencies[task]);
+	}
+
+	size_t iterations = combined.solve();
+
+	size_t fieldSteps = (reweight_field_steps == 0)? 1 : reweight_field_steps;
+	size_t gridPoints = reweight_temperature_steps * fieldSteps;
+
+	printf("Reweighting %zu histograms of %zu bins onto %zu points (%zu iterations)\n",
+	       combined.betas.size(), combined.counts.size(), gridPoints, iterations);
+
+	std::vector<double> reweighted(REWEIGHTED_COLUMNS * gridPoints);
+	for (size_t t = 0; t < reweight_temperature_steps; ++t) {
+	for (size_t h = 0; h <                 fieldSteps; ++h) {
+		ReweightedPoint point = combined.reweight(
+			linspace_at(temperature_start, temperature_end, reweight_temperature_steps, t),
+			linspace_at(      field_start,       field_end,                 fieldSteps, h));
+
+		reweighted_to_row(point, &reweighted[REWEIGHTED_COLUMNS * (t * fieldSteps + h)]);
+	}}
+
+	cnpy::npz_save(output_file, "reweighted", reweighted.data(), {gridPoints, REWEIGHTED_COLUMNS}, "a");
+}
+
+void run_batch(const char* output_file)
+{
+	std::vector<BatchPoint> points = batch_points();
+
+	printf("Computing %zu points (%zu temperatures, %zu fields, %zu repetitions)\n",
+	       points.size(), temperature_steps, field_steps, repetitions);
+
+	if (reweight_temperature_steps != 0 && histogram_resolution <= 0.0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Reweighting requires histogram_resolution > 0\n");
+		exit(EXIT_FAILURE);
+	}
+
+	BatchResults results(points.size());
+
+	if (replica_batch != 0) run_batch_replicas(points, results);
+	else                    run_batch_points  (points, results);
+
+	printf("\rComputation in progress: %02.0f%%", 100.0);
+	printf("\nComputation completed!\n");
+
+	cnpy::npz_save(output_file, "index", results.index.data(), {points.size(), 3},                     "w");
+	cnpy::npz_save(output_file, "data",  results.data.data(),  {points.size(), saved_data_samples, 2}, "a");
+	cnpy::npz_save(output_file, "statistics", results.summaries.data(), {points.size(), STATISTICS_COLUMNS}, "a");
+
+	if (histogram_resolution > 0.0) save_histograms(output_file, results.histograms);
+	if (reweight_temperature_steps != 0) reweight_batch(output_file, points, results);
+}
+
+#endif  // POTTS_MODEL_BATCH_HPP_INCLUDED
@@ -0,0 +1,125 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_CHECKERBOARD_HPP_INCLUDED
+#define POTTS_MODEL_CHECKERBOARD_HPP_INCLUDED
+
+#include "Model.hpp"
+#include "ThreadPool.hpp"
+
+#include <vector>
+
+// Full-sweep update engine.
+// The lattice is split into two sublattices by the parity of (x + y + z).
+// Every neighbour of a site belongs to the other sublattice, so all sites of one
+// colour can be updated concurrently. One sweep attempts one move on every site.
+// Every x-plane draws from its own random stream, so results do not depend
+// on the number of threads or on the order in which planes are scheduled.
+template <typename Kind>
+struct CheckerboardSweep
+{
+	Lattice<Kind>& lattice;
+	ThreadPool& pool;
+	std::vector<RandomStream> planeStreams;
+	std::vector<LatticeTotals> planeDeltas;
+	std::vector<MoveCounters> planeMoves;
+
+	CheckerboardSweep(Lattice<Kind>& sweptLattice, ThreadPool& threadPool);
+
+	void sweep();
+	void halfSweep(int parity);
+
+	template <typename Archive>
+	void serialize(Archive& archive);
+};
+
+template <typename Kind>
+CheckerboardSweep<Kind>::CheckerboardSweep(Lattice<Kind>& sweptLattice, ThreadPool& threadPool) :
+	lattice      (sweptLattice),
+	pool         (threadPool),
+	planeStreams (),
+	planeDeltas  (sweptLattice.sizeX),
+	planeMoves   (sweptLattice.sizeX)
+{
+	// A two-dimensional lattice has a single z-layer and no z-bonds:
+	bool oddZ = Kind::DIMENSION == 3 && lattice.sizeZ % 2 != 0;
+	if (lattice.sizeX % 2 != 0 || lattice.sizeY % 2 != 0 || oddZ)
+	{
+		fprintf(stderr, "[ISING-MODEL] Checkerboard sweep requires even lattice sizes\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Stream 0 belongs to the lattice itself:
+	planeStreams.reserve(lattice.sizeX);
+	for (int x = 0; x < lattice.sizeX; ++x)
+	{
+		planeStreams.emplace_back(lattice.seed, 1 + x);
+	}
+}
+
+template <typename Kind>
+template <typename Archive>
+void CheckerboardSweep<Kind>::serialize(Archive& archive)
+{
+	for (RandomStream& stream : planeStreams)
+	{
+		stream.serialize(archive);
+	}
+}
+
+template <typename Kind>
+void CheckerboardSweep<Kind>::sweep()
+{
+	lattice.refreshParameters();
+
+	halfSweep(0);
+	halfSweep(1);
+}
+
+template <typename Kind>
+void CheckerboardSweep<Kind>::halfSweep(int parity)
+{
+	// One task per x-plane keeps the pool busy even for thin lattices:
+	pool.run(lattice.sizeX, [this, parity](size_t task, size_t /* worker */)
+	{
+		RandomStream& stream = planeStreams[task];
+		LatticeTotals& deltas = planeDeltas[task];
+		MoveCounters& moveCount = planeMoves[task];
+		int x = task;
+
+		deltas = {0.0, 0.0};
+		moveCount = {0, 0};
+
+		// Moves are two bits each, 32 of them are taken from one random word:
+		uint64_t moves = 0;
+		int movesLeft = 0;
+
+		for (int y = 0; y < lattice.sizeY; ++y)
+		{
+			for (int z = (x + y + parity) % 2; z < lattice.sizeZ; z += 2)
+			{
+				if (movesLeft == 0)
+				{
+					moves = stream.next();
+					movesLeft = 32;
+				}
+
+				moveCount.attempted += 1;
+				moveCount.accepted  += lattice.metropolisStepAt(x, y, z, moves & 3, stream, deltas);
+
+				moves >>= 2;
+				--movesLeft;
+			}
+		}
+	});
+
+	// Summed in plane order to keep the totals independent of scheduling:
+	for (int x = 0; x < lattice.sizeX; ++x)
+	{
+		lattice.totals.magnetization += planeDeltas[x].magnetization;
+		lattice.totals.energy        += planeDeltas[x].energy;
+
+		lattice.moves.attempted += planeMoves[x].attempted;
+		lattice.moves.accepted  += planeMoves[x].accepted;
+	}
+}
+
+#endif  // POTTS_MODEL_CHECKERBOARD_HPP_INCLUDED
@@ -0,0 +1,314 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_CHECKPOINT_HPP_INCLUDED
+#define POTTS_MODEL_CHECKPOINT_HPP_INCLUDED
+
+// Checkpoints of a running simulation, written through a memory-mapped file.
+// File layout:
+//   CheckpointHeader - magic, version and every config entry the trajectory depends on;
+//   two slots        - CheckpointSlot followed by the payload.
+// The payload is whatever the serialize() functions of the simulation walk through:
+// saved samples, lattice sites, random streams, running totals.
+// Slots are written alternately. A slot is invalidated before it is overwritten and
+// gets its generation only after the payload reached the disk, so a job killed
+// in the middle of a write still has the previous checkpoint in the other slot.
+// The seed is part of the payload, so a run with a random seed resumes exactly too.
+
+#include "Config.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ========================================================================
+// Archive
+// ========================================================================
+
+// The same serialize() code measures, stores and restores the state:
+struct CheckpointArchive
+{
+	enum Mode
+	{
+		MEASURE,
+		STORE,
+		RESTORE
+	};
+
+	Mode mode;
+	uint8_t* data;
+	size_t size;
+
+	inline void bytes(void* value, size_t count);
+
+	template <typename T>
+	inline void value(T& value) { bytes(&value, sizeof(T)); }
+};
+
+inline void CheckpointArchive::bytes(void* value, size_t count)
+{
+	if (mode == STORE)   memcpy(data + size, value, count);
+	if (mode == RESTORE) memcpy(value, data + size, count);
+
+	size += count;
+}
+
+// ========================================================================
+// File Format
+// ========================================================================
+
+const char     CHECKPOINT_MAGIC[8]  = {'I', 'S', 'I', 'N', 'G', 'C', 'K', 'P'};
+const uint32_t CHECKPOINT_VERSION   = 3;
+const size_t   CHECKPOINT_ALIGNMENT = 64;
+
+struct CheckpointHeader
+{
+	char     magic[8];
+	uint32_t version;
+	int32_t  statesX, statesY, dimension;
+	int32_t  sizeX, sizeY, sizeZ;
+	char     layout[32];
+	char     engine[32];
+	char     observables[256];
+	double   temperature, fieldZ, interactivity, magneticMoment;
+	uint64_t burnInSamples, savedDataSamples;
+	uint64_t sweepsPerSample, mcItersPerSample, driftCheckInterval;
+	uint64_t seed; // configured_seed, the resolved seed is part of the payload
+	double   targetErrors[2]; // Of magnetization and energy
+	uint64_t payloadSize;
+};
+
+struct CheckpointSlot
+{
+	uint64_t generation; // 0 for an empty or invalidated slot
+	uint64_t checksum;   // Of the progress counters and the payload
+	uint64_t iteration;  // Samples advanced so far, burn-in included
+	uint64_t savedData;
+};
+
+// Header of a run with the current configuration:
+CheckpointHeader make_checkpoint_header(int sizeX, int sizeY, int sizeZ,
+                                        const ModelParameters& parameters, size_t payloadSize)
+{
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version            = CHECKPOINT_VERSION;
+	header.statesX            = state_graph_size_x;
+	header.statesY            = state_graph_size_y;
+	header.dimension          = lattice_dimension;
+	header.sizeX              = sizeX;
+	header.sizeY              = sizeY;
+	header.sizeZ              = sizeZ;
+	strcpy(header.layout, lattice_layout);
+	strcpy(header.engine, update_engine);
+	strcpy(header.observables, observables);
+	header.temperature        = parameters.temperature;
+	header.fieldZ             = parameters.externalField.z;
+	header.interactivity      = parameters.interactivity;
+	header.magneticMoment     = magnetic_moment;
+	header.burnInSamples      = burn_in_samples;
+	header.savedDataSamples   = saved_data_samples;
+	header.sweepsPerSample    = sweeps_per_sample;
+	header.mcItersPerSample   = mc_iters_per_sample;
+	header.driftCheckInterval = drift_check_interval;
+	header.seed               = configured_seed;
+	header.targetErrors[0]    = target_error_magnetization;
+	header.targetErrors[1]    = target_error_energy;
+	header.payloadSize        = payloadSize;
+
+	return header;
+}
+
+// FNV-1a:
+uint64_t checkpoint_checksum(const uint8_t* data, size_t size, uint64_t hash = 0xCBF29CE484222325ull)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ data[i]) * 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+// ========================================================================
+// Checkpoint File
+// ========================================================================
+
+struct Checkpoint
+{
+	const char* filename;
+	int fd;
+	uint8_t* map;
+	size_t mapSize;
+	size_t slotStride;
+	size_t payloadSize;
+	uint64_t generation;
+
+	// Opens an existing checkpoint of the same configuration or creates an empty one:
+	Checkpoint(const char* checkpointFile, const CheckpointHeader& header);
+	~Checkpoint();
+
+	Checkpoint(const Checkpoint&) = delete;
+	Checkpoint& operator=(const Checkpoint&) = delete;
+
+	inline CheckpointSlot* slot(int index);
+	inline uint8_t* payload(int index);
+	uint64_t slotChecksum(int index);
+
+	// Returns false if there is nothing to resume from:
+	template <typename Serialize>
+	bool restore(uint64_t* iteration, uint64_t* savedData, Serialize serialize);
+
+	template <typename Serialize>
+	void store(uint64_t iteration, uint64_t savedData, Serialize serialize);
+};
+
+inline size_t align_checkpoint(size_t size)
+{
+	return (size + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+Checkpoint::Checkpoint(const char* checkpointFile, const CheckpointHeader& header) :
+	filename    (checkpointFile),
+	fd          (-1),
+	map         (nullptr),
+	mapSize     (0),
+	slotStride  (align_checkpoint(sizeof(CheckpointSlot) + header.payloadSize)),
+	payloadSize (header.payloadSize),
+	generation  (0)
+{
+	mapSize = align_checkpoint(sizeof(CheckpointHeader)) + 2 * slotStride;
+
+	fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to open checkpoint file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to stat checkpoint file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	bool created = info.st_size == 0;
+	if (created && ftruncate(fd, mapSize) == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to allocate checkpoint file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!created && size_t(info.st_size) != mapSize)
+	{
+		fprintf(stderr, "[ISING-MODEL] Checkpoint %s was written for a different configuration\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	map = (uint8_t*) mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to map checkpoint file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	if (created)
+	{
+		// Fresh file is zero-filled, so both slots are already empty:
+		memcpy(map, &header, sizeof(header));
+		msync(map, mapSize, MS_SYNC);
+	}
+	else if (memcmp(map, &header, sizeof(header)) != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Checkpoint %s was written for a different configuration\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+Checkpoint::~Checkpoint()
+{
+	munmap(map, mapSize);
+	close(fd);
+}
+
+inline CheckpointSlot* Checkpoint::slot(int index)
+{
+	return (CheckpointSlot*) (map + align_checkpoint(sizeof(CheckpointHeader)) + index * slotStride);
+}
+
+inline uint8_t* Checkpoint::payload(int index)
+{
+	return (uint8_t*) (slot(index) + 1);
+}
+
+uint64_t Checkpoint::slotChecksum(int index)
+{
+	uint64_t hash = checkpoint_checksum((const uint8_t*) &slot(index)->iteration, 2 * sizeof(uint64_t));
+	return checkpoint_checksum(payload(index), payloadSize, hash);
+}
+
+template <typename Serialize>
+bool Checkpoint::restore(uint64_t* iteration, uint64_t* savedData, Serialize serialize)
+{
+	// The newest slot that survived its write:
+	int latest = -1;
+	for (int index = 0; index < 2; ++index)
+	{
+		CheckpointSlot* candidate = slot(index);
+		if (candidate->generation == 0 || candidate->checksum != slotChecksum(index)) continue;
+
+		if (latest == -1 || candidate->generation > slot(latest)->generation) latest = index;
+	}
+
+	if (latest == -1) return false;
+
+	CheckpointArchive archive = {CheckpointArchive::RESTORE, payload(latest), 0};
+	serialize(archive);
+
+	generation = slot(latest)->generation;
+	*iteration = slot(latest)->iteration;
+	*savedData = slot(latest)->savedData;
+	return true;
+}
+
+template <typename Serialize>
+void Checkpoint::store(uint64_t iteration, uint64_t savedData, Serialize serialize)
+{
+	generation += 1;
+
+	int index = generation % 2;
+	CheckpointSlot* target = slot(index);
+
+	target->generation = 0;
+	msync(map, mapSize, MS_SYNC);
+
+	CheckpointArchive archive = {CheckpointArchive::STORE, payload(index), 0};
+	serialize(archive);
+
+	target->iteration = iteration;
+	target->savedData = savedData;
+	target->checksum  = slotChecksum(index);
+	msync(map, mapSize, MS_SYNC);
+
+	target->generation = generation;
+	msync(map, mapSize, MS_SYNC);
+}
+
+// Payload size of a serialize() function:
+template <typename Serialize>
+size_t checkpoint_payload_size(Serialize serialize)
+{
+	CheckpointArchive archive = {CheckpointArchive::MEASURE, nullptr, 0};
+	serialize(archive);
+
+	return archive.size;
+}
+
+#endif  // POTTS_MODEL_CHECKPOINT_HPP_INCLUDED
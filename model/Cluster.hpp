@@ -0,0 +1,396 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_CLUSTER_HPP_INCLUDED
+#define POTTS_MODEL_CLUSTER_HPP_INCLUDED
+
+#include "Model.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <vector>
+
+// Cluster update engines for two-state graphs with opposite spins (s1 = -s0).
+// Aligned neighbours are bonded with probability 1 - exp(-2 J s0.s0 / T).
+// The field enters through a ghost spin pointing along the favoured state:
+// sites in that state bond to the ghost with probability 1 - exp(-2 |H.s0| / T),
+// and clusters bonded to the ghost never flip.
+//
+// Wolff: grows one cluster from a random site and flips it. Ghost bonds are drawn
+// while the cluster grows, so a cluster bonded to the ghost is abandoned early.
+//
+// Swendsen-Wang: every bond is drawn in parallel and clusters are labelled by
+// a lock-free union-find. Roots are always linked under smaller roots, so every
+// cluster ends up labelled by its smallest site regardless of thread timing,
+// and each cluster flips with probability 1/2 decided by hashing its label.
+template <typename Kind>
+struct ClusterUpdater
+{
+	static_assert(Kind::STATES == 2, "Cluster updates require a two-state graph");
+
+	Lattice<Kind>& lattice;
+	ThreadPool& pool;
+	size_t sites;
+
+	int fieldState;
+	double bondProbability;
+	double ghostBondFactor; // exp(-2 |H.s0| / T)
+	uint32_t bondThreshold;
+	uint32_t ghostThreshold;
+
+	// Wolff:
+	std::vector<uint32_t> clusterMark;
+	uint32_t clusterEpoch;
+	std::vector<uint32_t> clusterStack;
+
+	// Swendsen-Wang:
+	std::vector<std::atomic<uint32_t>> parent;
+	std::vector<RandomStream> planeStreams;
+	uint64_t sweepCounter;
+
+	ClusterUpdater(Lattice<Kind>& updatedLattice, ThreadPool& threadPool);
+
+	void prepare();
+
+	inline uint32_t siteId(int x, int y, int z) const;
+	inline void siteCoords(uint32_t id, int& x, int& y, int& z) const;
+	inline void neighbourSites(uint32_t id, uint32_t (&neighbours)[Kind::NEIGHBOURS]) const;
+	inline int state(uint32_t id);
+	inline void flip(uint32_t id);
+
+	size_t wolffStep();
+	void wolffSweep();
+
+	inline uint32_t find(uint32_t id);
+	inline void unite(uint32_t a, uint32_t b);
+	void swendsenWangSweep();
+
+	// Cluster marks and labels are rebuilt every step, only the random state persists:
+	template <typename Archive>
+	void serialize(Archive& archive);
+};
+
+template <typename Kind>
+ClusterUpdater<Kind>::ClusterUpdater(Lattice<Kind>& updatedLattice, ThreadPool& threadPool) :
+	lattice         (updatedLattice),
+	pool            (threadPool),
+	sites           (updatedLattice.sites),
+	fieldState      (0),
+	bondProbability (0.0),
+	ghostBondFactor (1.0),
+	bondThreshold   (0),
+	ghostThreshold  (0),
+	clusterMark     (),
+	clusterEpoch    (0),
+	clusterStack    (),
+	parent          (),
+	planeStreams    (),
+	sweepCounter    (0)
+{
+	Vector spin0 = lattice.stateGraph.spins[0];
+	Vector spin1 = lattice.stateGraph.spins[1];
+	if ((spin0 + spin1).length() > 1e-9)
+	{
+		fprintf(stderr, "[ISING-MODEL] Cluster updates require a state graph with two opposite states\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Same stream numbering as CheckerboardSweep:
+	planeStreams.reserve(lattice.sizeX);
+	for (int x = 0; x < lattice.sizeX; ++x)
+	{
+		planeStreams.emplace_back(lattice.seed, 1 + x);
+	}
+}
+
+template <typename Kind>
+void ClusterUpdater<Kind>::prepare()
+{
+	lattice.refreshParameters();
+
+	const ModelParameters& parameters = lattice.parameters;
+	Vector spin0 = lattice.stateGraph.spins[0];
+
+	double bondEnergy  = 2.0 * parameters.interactivity * spin0.scalar(spin0);
+	double fieldEnergy = parameters.externalField.scalar(spin0);
+
+	fieldState      = (fieldEnergy >= 0.0)? 0 : 1;
+	bondProbability = (bondEnergy > 0.0)? 1.0 - exp(-bondEnergy / parameters.temperature) : 0.0;
+	ghostBondFactor = exp(-2.0 * std::abs(fieldEnergy) / parameters.temperature);
+
+	bondThreshold  = std::min(bondProbability         * 0x1.0p32, 0x1.0p32 - 1.0);
+	ghostThreshold = std::min((1.0 - ghostBondFactor) * 0x1.0p32, 0x1.0p32 - 1.0);
+}
+
+template <typename Kind>
+template <typename Archive>
+void ClusterUpdater<Kind>::serialize(Archive& archive)
+{
+	for (RandomStream& stream : planeStreams)
+	{
+		stream.serialize(archive);
+	}
+
+	archive.value(sweepCounter);
+}
+
+template <typename Kind>
+inline uint32_t ClusterUpdater<Kind>::siteId(int x, int y, int z) const
+{
+	return (x * lattice.sizeY + y) * lattice.sizeZ + z;
+}
+
+template <typename Kind>
+inline void ClusterUpdater<Kind>::siteCoords(uint32_t id, int& x, int& y, int& z) const
+{
+	z = id % lattice.sizeZ;
+	id /= lattice.sizeZ;
+	y = id % lattice.sizeY;
+	x = id / lattice.sizeY;
+}
+
+template <typename Kind>
+inline void ClusterUpdater<Kind>::neighbourSites(uint32_t id, uint32_t (&neighbours)[Kind::NEIGHBOURS]) const
+{
+	int x, y, z;
+	siteCoords(id, x, y, z);
+
+	neighbours[0] = siteId((x == 0)? (lattice.sizeX - 1) : (x - 1), y, z);
+	neighbours[1] = siteId((x + 1) % lattice.sizeX, y, z);
+	neighbours[2] = siteId(x, (y == 0)? (lattice.sizeY - 1) : (y - 1), z);
+	neighbours[3] = siteId(x, (y + 1) % lattice.sizeY, z);
+
+	if constexpr (Kind::DIMENSION == 3)
+	{
+		neighbours[4] = siteId(x, y, (z == 0)? (lattice.sizeZ - 1) : (z - 1));
+		neighbours[5] = siteId(x, y, (z + 1) % lattice.sizeZ);
+	}
+}
+
+template <typename Kind>
+inline int ClusterUpdater<Kind>::state(uint32_t id)
+{
+	int x, y, z;
+	siteCoords(id, x, y, z);
+
+	return lattice.get(x, y, z);
+}
+
+template <typename Kind>
+inline void ClusterUpdater<Kind>::flip(uint32_t id)
+{
+	int x, y, z;
+	siteCoords(id, x, y, z);
+
+	lattice.set(x, y, z, 1 - lattice.get(x, y, z));
+}
+
+//=======
+// Wolff
+//=======
+
+template <typename Kind>
+size_t ClusterUpdater<Kind>::wolffStep()
+{
+	if (clusterMark.size() != sites) clusterMark.assign(sites, 0);
+
+	// Epoch stamps avoid clearing the marks between clusters:
+	if (++clusterEpoch == 0)
+	{
+		std::fill(clusterMark.begin(), clusterMark.end(), 0);
+		clusterEpoch = 1;
+	}
+
+	RandomStream& rng = lattice.rng;
+	uint32_t seedSite = rng.below(sites);
+	int clusterState = state(seedSite);
+
+	clusterStack.clear();
+	clusterStack.push_back(seedSite);
+	clusterMark[seedSite] = clusterEpoch;
+
+	size_t clusterSize = 0;
+	for (size_t top = 0; top < clusterStack.size(); ++top)
+	{
+		uint32_t id = clusterStack[top];
+		++clusterSize;
+
+		// Cluster bonded to the ghost spin stays as it is:
+		if (clusterState == fieldState && rng.uniform() >= ghostBondFactor) return clusterSize;
+
+		uint32_t neighbours[Kind::NEIGHBOURS];
+		neighbourSites(id, neighbours);
+
+		for (uint32_t neighbour : neighbours)
+		{
+			if (clusterMark[neighbour] == clusterEpoch || state(neighbour) != clusterState) continue;
+			if (rng.uniform() >= bondProbability) continue;
+
+			clusterMark[neighbour] = clusterEpoch;
+			clusterStack.push_back(neighbour);
+		}
+	}
+
+	// Energy change comes from the cluster boundary and the field:
+	const ModelParameters& parameters = lattice.parameters;
+	Vector oldSpin = lattice.stateGraph.spins[    clusterState];
+	Vector newSpin = lattice.stateGraph.spins[1 - clusterState];
+	Vector change  = newSpin - oldSpin;
+
+	double deltaEnergy = -change.scalar(parameters.externalField) * clusterSize;
+	for (uint32_t id : clusterStack)
+	{
+		uint32_t neighbours[Kind::NEIGHBOURS];
+		neighbourSites(id, neighbours);
+
+		for (uint32_t neighbour : neighbours)
+		{
+			if (clusterMark[neighbour] == clusterEpoch) continue;
+
+			deltaEnergy -= parameters.interactivity * change.scalar(lattice.stateGraph.spins[state(neighbour)]);
+		}
+	}
+
+	for (uint32_t id : clusterStack)
+	{
+		flip(id);
+	}
+
+	lattice.totals.magnetization += change.z * clusterSize;
+	lattice.totals.energy        += deltaEnergy;
+
+	lattice.moves.attempted += clusterSize;
+	lattice.moves.accepted  += clusterSize;
+
+	return clusterSize;
+}
+
+// Flips clusters until as many sites have been visited as the lattice has:
+template <typename Kind>
+void ClusterUpdater<Kind>::wolffSweep()
+{
+	prepare();
+
+	for (size_t visited = 0; visited < sites; )
+	{
+		visited += wolffStep();
+	}
+}
+
+//===============
+// Swendsen-Wang
+//===============
+
+template <typename Kind>
+inline uint32_t ClusterUpdater<Kind>::find(uint32_t id)
+{
+	// Path halving; a lost race only leaves a longer path behind:
+	while (true)
+	{
+		uint32_t up = parent[id].load(std::memory_order_relaxed);
+		if (up == id) return id;
+
+		uint32_t upper = parent[up].load(std::memory_order_relaxed);
+		if (upper != up) parent[id].compare_exchange_weak(up, upper, std::memory_order_relaxed);
+
+		id = upper;
+	}
+}
+
+template <typename Kind>
+inline void ClusterUpdater<Kind>::unite(uint32_t a, uint32_t b)
+{
+	while (true)
+	{
+		a = find(a);
+		b = find(b);
+		if (a == b) return;
+
+		// Larger root goes under the smaller one:
+		if (a < b) std::swap(a, b);
+
+		uint32_t expected = a;
+		if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) return;
+	}
+}
+
+template <typename Kind>
+void ClusterUpdater<Kind>::swendsenWangSweep()
+{
+	prepare();
+
+	// Index sites is the ghost spin:
+	uint32_t ghost = sites;
+	if (parent.size() != sites + 1) parent = std::vector<std::atomic<uint32_t>>(sites + 1);
+
+	int sizeX = lattice.sizeX;
+	int sizeY = lattice.sizeY;
+	int sizeZ = lattice.sizeZ;
+
+	pool.run(sizeX, [&](size_t x, size_t /* worker */)
+	{
+		for (uint32_t id = siteId(x, 0, 0); id < siteId(x + 1, 0, 0); ++id)
+		{
+			parent[id].store(id, std::memory_order_relaxed);
+		}
+		if (x == 0) parent[ghost].store(ghost, std::memory_order_relaxed);
+	});
+
+	// Every site draws bonds to its R, D and (in 3D) B neighbours and to the ghost:
+	pool.run(sizeX, [&](size_t task, size_t /* worker */)
+	{
+		RandomStream& stream = planeStreams[task];
+		int x = task;
+
+		for (int y = 0; y < sizeY; ++y) {
+		for (int z = 0; z < sizeZ; ++z) {
+			uint32_t id = siteId(x, y, z);
+			int siteState = lattice.get(x, y, z);
+
+			uint64_t tosses[2] = {stream.next(), stream.next()};
+			uint32_t bondTosses[4] = {uint32_t(tosses[0]), uint32_t(tosses[0] >> 32),
+			                          uint32_t(tosses[1]), uint32_t(tosses[1] >> 32)};
+
+			int rX = (x + 1) % sizeX;
+			int dY = (y + 1) % sizeY;
+			int bZ = (z + 1) % sizeZ;
+
+			if (bondTosses[0] < bondThreshold && lattice.get(rX, y, z) == siteState)
+				unite(id, siteId(rX, y, z));
+			if (bondTosses[1] < bondThreshold && lattice.get(x, dY, z) == siteState)
+				unite(id, siteId(x, dY, z));
+			if (Kind::DIMENSION == 3 &&
+			    bondTosses[2] < bondThreshold && lattice.get(x, y, bZ) == siteState)
+				unite(id, siteId(x, y, bZ));
+			if (bondTosses[3] < ghostThreshold && siteState == fieldState)
+				unite(id, ghost);
+		}}
+	});
+
+	// Each cluster flips with probability 1/2 unless it contains the ghost:
+	uint64_t sweepKey = counterHash(lattice.seed, sweepCounter++);
+	uint32_t ghostRoot = find(ghost);
+
+	std::atomic<uint64_t> flipped(0);
+
+	pool.run(sizeX, [&](size_t x, size_t /* worker */)
+	{
+		uint64_t planeFlipped = 0;
+		for (uint32_t id = siteId(x, 0, 0); id < siteId(x + 1, 0, 0); ++id)
+		{
+			uint32_t root = find(id);
+			if (root != ghostRoot && (counterHash(sweepKey, root) & 1))
+			{
+				flip(id);
+				planeFlipped += 1;
+			}
+		}
+
+		flipped.fetch_add(planeFlipped, std::memory_order_relaxed);
+	});
+
+	lattice.moves.attempted += sites;
+	lattice.moves.accepted  += flipped.load(std::memory_order_relaxed);
+
+	lattice.resyncTotals();
+}
+
+#endif  // POTTS_MODEL_CLUSTER_HPP_INCLUDED
@@ -0,0 +1,296 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_CONFIG_HPP_INCLUDED
+#define POTTS_MODEL_CONFIG_HPP_INCLUDED
+
+// Configuration globals and the config file parser.
+// Shared by the model executable and the computing grid; the headers that
+// run simulations (Simulation.hpp, Batch.hpp, Tempering.hpp) read these globals.
+
+#include "Vector.hpp"
+#include "Parameters.hpp"
+#include "Random.hpp"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <cmath>
+
+double temperature;
+Vector externalField;
+double interactivity;
+double magnetic_moment;
+size_t saved_data_samples;
+size_t burn_in_samples;
+size_t mc_iters_per_sample;
+size_t iters_per_render_frame;
+char   render_output[32];
+size_t render_frames;
+char   update_engine[32];
+size_t threads;
+size_t sweeps_per_sample;
+uint64_t seed;
+uint64_t configured_seed; // Before resolveSeed, 0 for a random one
+size_t drift_check_interval;
+char   run_mode[32];
+double temperature_start;
+double temperature_end;
+size_t temperature_steps;
+double field_start;
+double field_end;
+size_t field_steps;
+size_t repetitions;
+size_t exchange_interval;
+int    state_graph_size_x;
+int    state_graph_size_y;
+int    lattice_dimension;
+int    lattice_size_x;
+int    lattice_size_y;
+int    lattice_size_z;
+char   lattice_layout[32];
+int    grid_port;
+double grid_heartbeat_interval;
+double grid_heartbeat_timeout;
+char   checkpoint_file[256];
+size_t checkpoint_interval;
+char   observables[256];
+size_t output_chunk_samples;
+double target_error_magnetization;
+double target_error_energy;
+char   benchmark_sizes[256];
+char   benchmark_threads[256];
+double benchmark_min_time;
+size_t benchmark_repeats;
+char   metrics_file[256];
+double metrics_interval;
+size_t domain_processes;
+size_t replica_batch;
+char   schedule_path[256];
+size_t schedule_steps;
+char   schedule_ramp[32];
+size_t schedule_burn_in_samples;
+double histogram_resolution;
+size_t reweight_temperature_steps;
+size_t reweight_field_steps;
+double wang_landau_bin_width;
+size_t wang_landau_windows;
+double wang_landau_overlap;
+double wang_landau_flatness;
+double wang_landau_final_ln_f;
+size_t wang_landau_sweeps;
+char   correlation_file[256];
+size_t correlation_interval;
+size_t correlation_buffers;
+
+struct ConfigEntry
+{
+	const char* name;
+	const char* format;
+	void* value;
+};
+
+const ConfigEntry CONFIG_ENTRIES[] =
+{
+	{"temperature",                "%lf",      &temperature               },
+	{"field",                      "%lf",      &externalField.z           },
+	{"interactivity",              "%lf",      &interactivity             },
+	{"magnetic_moment",            "%lf",      &magnetic_moment           },
+	{"saved_data_samples",         "%zu",      &saved_data_samples        },
+	{"burn_in_samples",            "%zu",      &burn_in_samples           },
+	{"mc_iters_per_sample",        "%zu",      &mc_iters_per_sample       },
+	{"iters_per_render_frame",     "%zu",      &iters_per_render_frame    },
+	{"render_output",              "%31s",     render_output              },
+	{"render_frames",              "%zu",      &render_frames             },
+	{"update_engine",              "%31s",     update_engine              },
+	{"threads",                    "%zu",      &threads                   },
+	{"sweeps_per_sample",          "%zu",      &sweeps_per_sample         },
+	{"seed",                       "%" SCNu64, &seed                      },
+	{"drift_check_interval",       "%zu",      &drift_check_interval      },
+	{"run_mode",                   "%31s",     run_mode                   },
+	{"temperature_start",          "%lf",      &temperature_start         },
+	{"temperature_end",            "%lf",      &temperature_end           },
+	{"temperature_steps",          "%zu",      &temperature_steps         },
+	{"field_start",                "%lf",      &field_start               },
+	{"field_end",                  "%lf",      &field_end                 },
+	{"field_steps",                "%zu",      &field_steps               },
+	{"repetitions",                "%zu",      &repetitions               },
+	{"exchange_interval",          "%zu",      &exchange_interval         },
+	{"state_graph_size_x",         "%d",       &state_graph_size_x        },
+	{"state_graph_size_y",         "%d",       &state_graph_size_y        },
+	{"lattice_dimension",          "%d",       &lattice_dimension         },
+	{"lattice_size_x",             "%d",       &lattice_size_x            },
+	{"lattice_size_y",             "%d",       &lattice_size_y            },
+	{"lattice_size_z",             "%d",       &lattice_size_z            },
+	{"lattice_layout",             "%31s",     lattice_layout             },
+	{"grid_port",                  "%d",       &grid_port                 },
+	{"grid_heartbeat_interval",    "%lf",      &grid_heartbeat_interval   },
+	{"grid_heartbeat_timeout",     "%lf",      &grid_heartbeat_timeout    },
+	{"checkpoint_file",            "%255s",    checkpoint_file            },
+	{"checkpoint_interval",        "%zu",      &checkpoint_interval       },
+	{"observables",                "%255s",    observables                },
+	{"output_chunk_samples",       "%zu",      &output_chunk_samples      },
+	{"target_error_magnetization", "%lf",      &target_error_magnetization},
+	{"target_error_energy",        "%lf",      &target_error_energy       },
+	{"benchmark_sizes",            "%255s",    benchmark_sizes            },
+	{"benchmark_threads",          "%255s",    benchmark_threads          },
+	{"benchmark_min_time",         "%lf",      &benchmark_min_time        },
+	{"benchmark_repeats",          "%zu",      &benchmark_repeats         },
+	{"metrics_file",               "%255s",    metrics_file               },
+	{"metrics_interval",           "%lf",      &metrics_interval          },
+	{"domain_processes",           "%zu",      &domain_processes          },
+	{"replica_batch",              "%zu",      &replica_batch             },
+	{"schedule_path",              "%255s",    schedule_path              },
+	{"schedule_steps",             "%zu",      &schedule_steps            },
+	{"schedule_ramp",              "%31s",     schedule_ramp              },
+	{"schedule_burn_in_samples",   "%zu",      &schedule_burn_in_samples  },
+	{"histogram_resolution",       "%lf",      &histogram_resolution      },
+	{"reweight_temperature_steps", "%zu",      &reweight_temperature_steps},
+	{"reweight_field_steps",       "%zu",      &reweight_field_steps      },
+	{"wang_landau_bin_width",      "%lf",      &wang_landau_bin_width     },
+	{"wang_landau_windows",        "%zu",      &wang_landau_windows       },
+	{"wang_landau_overlap",        "%lf",      &wang_landau_overlap       },
+	{"wang_landau_flatness",       "%lf",      &wang_landau_flatness      },
+	{"wang_landau_final_ln_f",     "%lf",      &wang_landau_final_ln_f    },
+	{"wang_landau_sweeps",         "%zu",      &wang_landau_sweeps        },
+	{"correlation_file",           "%255s",    correlation_file           },
+	{"correlation_interval",       "%zu",      &correlation_interval      },
+	{"correlation_buffers",        "%zu",      &correlation_buffers       }
+};
+
+// Reads the whole config from an open stream, which may also be an in-memory one:
+void read_config_stream(FILE* conf_file)
+{
+	// Defaults for entries missing from the config:
+	temperature            = 100.0;
+	externalField.z        = 0.0;
+	interactivity          = 1.0;
+	magnetic_moment        = 1.0;
+	saved_data_samples     = 100;
+	burn_in_samples        = 20;
+	mc_iters_per_sample    = 100000;
+	iters_per_render_frame = 50000;
+	strcpy(render_output, "framebuffer");
+	render_frames          = 0;
+	strcpy(update_engine, "metropolis");
+	threads                = 1;
+	sweeps_per_sample      = 1;
+	seed                   = 0;
+	drift_check_interval   = 100;
+	strcpy(run_mode, "single");
+	temperature_start      = NAN;
+	temperature_end        = NAN;
+	temperature_steps      = 1;
+	field_start            = NAN;
+	field_end              = NAN;
+	field_steps            = 1;
+	repetitions            = 1;
+	exchange_interval      = 1;
+	state_graph_size_x     = 1;
+	state_graph_size_y     = 2;
+	lattice_dimension      = 3;
+	lattice_size_x         = 30;
+	lattice_size_y         = 30;
+	lattice_size_z         = 30;
+	strcpy(lattice_layout, "linear");
+	grid_port               = 50000;
+	grid_heartbeat_interval = 1.0;
+	grid_heartbeat_timeout  = 10.0;
+	strcpy(checkpoint_file, "none");
+	checkpoint_interval     = 100;
+	strcpy(observables, "magnetization,energy");
+	output_chunk_samples       = 64;
+	target_error_magnetization = 0.0;
+	target_error_energy        = 0.0;
+	strcpy(benchmark_sizes, "16,32,64");
+	strcpy(benchmark_threads, "1,2,4");
+	benchmark_min_time      = 0.2;
+	benchmark_repeats       = 5;
+	strcpy(metrics_file, "none");
+	metrics_interval        = 1.0;
+	domain_processes        = 2;
+	replica_batch           = 0;
+	strcpy(schedule_path, "none");
+	schedule_steps           = 10;
+	schedule_burn_in_samples = 10;
+	strcpy(schedule_ramp, "stepwise");
+	histogram_resolution       = 0.0;
+	reweight_temperature_steps = 0;
+	reweight_field_steps       = 1;
+	wang_landau_bin_width      = 0.01;
+	wang_landau_windows        = 1;
+	wang_landau_overlap        = 0.75;
+	wang_landau_flatness       = 0.8;
+	wang_landau_final_ln_f     = 1e-6;
+	wang_landau_sweeps         = 1;
+	strcpy(correlation_file, "none");
+	correlation_interval    = 1;
+	correlation_buffers     = 4;
+
+	// Entries are "<name> <value>" pairs in arbitrary order:
+	char name[64];
+	while (fscanf(conf_file, "%63s", name) == 1)
+	{
+		const ConfigEntry* entry = NULL;
+		for (const ConfigEntry& candidate : CONFIG_ENTRIES)
+		{
+			if (strcmp(candidate.name, name) == 0) entry = &candidate;
+		}
+
+		if (entry == NULL)
+		{
+			fprintf(stderr, "[ISING-MODEL] Unknown config entry \"%s\"\n", name);
+			exit(EXIT_FAILURE);
+		}
+
+		if (fscanf(conf_file, entry->format, entry->value) != 1)
+		{
+			fprintf(stderr, "[ISING-MODEL] Unable to parse value of config entry \"%s\"\n", name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (lattice_size_x < 1 || lattice_size_y < 1 || lattice_size_z < 1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Lattice sizes must be positive\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Grid ranges default to the single point:
+	if (std::isnan(temperature_start)) temperature_start = temperature;
+	if (std::isnan(temperature_end))   temperature_end   = temperature_start;
+	if (std::isnan(field_start))       field_start       = externalField.z;
+	if (std::isnan(field_end))         field_end         = field_start;
+
+	interactivity *= 1.6e-19; // Joules
+	temperature *= 1.38e-23; // kT
+
+	externalField.z *= 0.01 * magnetic_moment;
+
+	externalField.x = 0.0;
+	externalField.y = 0.0;
+
+	configured_seed = seed;
+	seed = resolveSeed(seed);
+}
+
+void read_config(const char* filename)
+{
+	FILE* conf_file = std::fopen(filename, "r");
+	if (conf_file == NULL)
+	{
+		fprintf(stderr, "[ISING_MODEL] Unable to open config file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	read_config_stream(conf_file);
+
+	fclose(conf_file);
+}
+
+// Converts temperature in Kelvins and field in config units the same way read_config does:
+ModelParameters make_parameters(double kelvins, double field)
+{
+	return {kelvins * 1.38e-23, Vector(0.0, 0.0, field * 0.01 * magnetic_moment), interactivity};
+}
+
+#endif  // POTTS_MODEL_CONFIG_HPP_INCLUDED
@@ -0,0 +1,290 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_CORRELATION_HPP_INCLUDED
+#define POTTS_MODEL_CORRELATION_HPP_INCLUDED
+
+// Spin-spin correlation function and structure factor, measured off the sampling thread.
+// Every correlation_interval samples the sampling thread copies the lattice states into
+// a free buffer of a pool of correlation_buffers, and hands it to a background thread.
+// When every buffer is still queued or being measured the snapshot is dropped instead,
+// so sampling never waits for a measurement. The background thread transforms every spin
+// component with the built-in FFT of Fft.hpp and accumulates, per site:
+//   S(k) = |sum_x s(x) exp(-i k x)|^2 / sites, summed over spin components,
+//   G(r) = sum_x s(x).s(x + r) / sites = sum_k S(k) exp(i k r) / sites.
+// Averages over the measured snapshots go to correlation_file, a .npz file next to the output:
+//   structure_factor - (lattice_size_x, lattice_size_y[, lattice_size_z]) S(k),
+//                      k = 2 pi (i / size_x, j / size_y, l / size_z);
+//   correlation      - same shape, G(r) at displacement r = (i, j, l), not connected;
+//   snapshots        - (2) measured and dropped snapshots.
+// The averages are not part of checkpoints, a resumed run averages the snapshots taken
+// after the restart.
+
+#include "Config.hpp"
+#include "Output.hpp"
+#include "Fft.hpp"
+#include "ModelKind.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vendor/cnpy/cnpy.h"
+
+// Forwards samples to another sink and measures snapshots of the lattice on the way:
+struct CorrelationSink : SampleSink
+{
+	SampleSink& output;
+	const char* filename;
+	int sizeX, sizeY, sizeZ;
+	size_t sites;
+	std::vector<std::vector<double>> components; // Spin components of every state, constant ones left out
+
+	// Buffer pool, the lock is held for queue operations only:
+	std::vector<std::vector<uint8_t>> buffers;
+	std::vector<size_t> freeBuffers;
+	std::deque<size_t> filledBuffers;
+	size_t takenBuffer; // Being filled by the sampling thread
+	std::mutex mutex;
+	std::condition_variable filled;
+	bool stopping;
+	uint64_t dropped;
+
+	// Owned by the background thread until it is joined:
+	LatticeFft fft;
+	std::vector<Complex> field;
+	std::vector<double> power;
+	std::vector<double> structureFactor; // Sums over the snapshots
+	std::vector<double> correlation;
+	uint64_t measured;
+	std::thread worker;
+
+	CorrelationSink(SampleSink& outputSink, const char* outputFile,
+	                int latticeSizeX, int latticeSizeY, int latticeSizeZ, const std::vector<Vector>& stateSpins);
+	~CorrelationSink();
+
+	CorrelationSink(const CorrelationSink&) = delete;
+	CorrelationSink& operator=(const CorrelationSink&) = delete;
+
+	void start() override { output.start(); }
+	void write(const Observation& observation) override { output.write(observation); }
+	void flush() override { output.flush(); }
+	bool done() override { return output.done(); }
+	void serialize(CheckpointArchive& archive) override { output.serialize(archive); }
+
+	uint8_t* snapshotBuffer(uint64_t sample) override;
+	void snapshotTaken() override;
+
+	void workerLoop();
+	void measure(const uint8_t* states);
+
+	// Measures the queued snapshots and saves the averages:
+	void finish();
+	void stop();
+};
+
+CorrelationSink::CorrelationSink(SampleSink& outputSink, const char* outputFile,
+                                 int latticeSizeX, int latticeSizeY, int latticeSizeZ,
+                                 const std::vector<Vector>& stateSpins) :
+	output          (outputSink),
+	filename        (outputFile),
+	sizeX           (latticeSizeX),
+	sizeY           (latticeSizeY),
+	sizeZ           (latticeSizeZ),
+	sites           (size_t(latticeSizeX) * latticeSizeY * latticeSizeZ),
+	components      (),
+	buffers         (),
+	freeBuffers     (),
+	filledBuffers   (),
+	takenBuffer     (0),
+	mutex           (),
+	filled          (),
+	stopping        (false),
+	dropped         (0),
+	fft             (latticeSizeX, latticeSizeY, latticeSizeZ),
+	field           (sites),
+	power           (sites),
+	structureFactor (sites, 0.0),
+	correlation     (sites, 0.0),
+	measured        (0),
+	worker          ()
+{
+	if (correlation_buffers == 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Correlation measurements require correlation_buffers >= 1\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// A component equal for all states only adds to S(0):
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		std::vector<double> component;
+		bool constant = true;
+		for (const Vector& spin : stateSpins)
+		{
+			double value = (axis == 0)? spin.x : (axis == 1)? spin.y : spin.z;
+			constant = constant && (component.empty() || value == component[0]);
+			component.push_back(value);
+		}
+
+		if (!constant || component[0] != 0.0) components.push_back(component);
+	}
+
+	buffers.resize(correlation_buffers, std::vector<uint8_t>(sites));
+	for (size_t buffer = 0; buffer < correlation_buffers; ++buffer)
+	{
+		freeBuffers.push_back(buffer);
+	}
+
+	worker = std::thread(&CorrelationSink::workerLoop, this);
+}
+
+CorrelationSink::~CorrelationSink()
+{
+	stop();
+}
+
+uint8_t* CorrelationSink::snapshotBuffer(uint64_t sample)
+{
+	if (correlation_interval == 0 || sample % correlation_interval != 0) return nullptr;
+
+	// A contended lock counts as a full pool, the sampling thread never waits:
+	std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+	if (!lock.owns_lock() || freeBuffers.empty())
+	{
+		++dropped;
+		return nullptr;
+	}
+
+	takenBuffer = freeBuffers.back();
+	freeBuffers.pop_back();
+
+	return buffers[takenBuffer].data();
+}
+
+void CorrelationSink::snapshotTaken()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		filledBuffers.push_back(takenBuffer);
+	}
+
+	filled.notify_one();
+}
+
+void CorrelationSink::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		filled.wait(lock, [this]() { return stopping || !filledBuffers.empty(); });
+
+		// Queued snapshots are measured before stopping:
+		if (filledBuffers.empty()) return;
+
+		size_t buffer = filledBuffers.front();
+		filledBuffers.pop_front();
+
+		lock.unlock();
+		measure(buffers[buffer].data());
+		lock.lock();
+
+		freeBuffers.push_back(buffer);
+	}
+}
+
+void CorrelationSink::measure(const uint8_t* states)
+{
+	std::fill(power.begin(), power.end(), 0.0);
+
+	for (const std::vector<double>& component : components)
+	{
+		for (size_t site = 0; site < sites; ++site)
+		{
+			field[site] = Complex(component[states[site]], 0.0);
+		}
+
+		fft.transform(field, false);
+
+		for (size_t site = 0; site < sites; ++site)
+		{
+			power[site] += std::norm(field[site]);
+		}
+	}
+
+	for (size_t k = 0; k < sites; ++k)
+	{
+		structureFactor[k] += power[k] / sites;
+		field[k] = Complex(power[k] / sites, 0.0);
+	}
+
+	fft.transform(field, true);
+
+	for (size_t r = 0; r < sites; ++r)
+	{
+		correlation[r] += field[r].real() / sites;
+	}
+
+	++measured;
+}
+
+void CorrelationSink::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	filled.notify_one();
+	if (worker.joinable()) worker.join();
+}
+
+void CorrelationSink::finish()
+{
+	stop();
+
+	printf("Correlations: %" PRIu64 " snapshots measured, %" PRIu64 " dropped\n", measured, dropped);
+	if (measured == 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] No snapshots to save to %s\n", filename);
+		return;
+	}
+
+	for (size_t site = 0; site < sites; ++site)
+	{
+		structureFactor[site] /= measured;
+		correlation    [site] /= measured;
+	}
+
+	std::vector<size_t> shape = {size_t(sizeX), size_t(sizeY)};
+	if (sizeZ != 1) shape.push_back(size_t(sizeZ));
+
+	double snapshots[2] = {double(measured), double(dropped)};
+
+	cnpy::npz_save(filename, "structure_factor", structureFactor.data(), shape, "w");
+	cnpy::npz_save(filename, "correlation",      correlation.data(),     shape, "a");
+	cnpy::npz_save(filename, "snapshots",        snapshots,              {2},   "a");
+}
+
+// Sink of the model of the config:
+std::unique_ptr<CorrelationSink> make_correlation_sink(SampleSink& output, const char* outputFile)
+{
+	std::unique_ptr<CorrelationSink> sink;
+
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		typedef decltype(kind) Kind;
+
+		typename Kind::StateGraph stateGraph;
+		std::vector<Vector> spins(stateGraph.spins, stateGraph.spins + Kind::STATES);
+
+		int sizeZ = (Kind::DIMENSION == 3)? lattice_size_z : 1;
+		sink.reset(new CorrelationSink(output, outputFile, lattice_size_x, lattice_size_y, sizeZ, spins));
+	});
+
+	return sink;
+}
+
+#endif  // POTTS_MODEL_CORRELATION_HPP_INCLUDED
@@ -0,0 +1,523 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_DOMAIN_HPP_INCLUDED
+#define POTTS_MODEL_DOMAIN_HPP_INCLUDED
+
+// Domain decomposition mode: one point on a lattice split into slabs of x-planes,
+// each owned by its own process. The first process forks domain_processes - 1 others.
+// A slab is a Lattice with two extra ghost planes holding copies of the neighbouring
+// slabs' boundary planes, so metropolisStepAt needs no changes: owned planes never
+// wrap in x, and y and z are whole.
+// Every sweep is a checkerboard sweep. After each half-sweep the processes publish
+// their boundary planes and slab totals to a shared anonymous mapping, meet at a
+// process-shared barrier and copy their ghosts in. Publications alternate between two
+// buffer sets, so one barrier per half-sweep is enough: a set is only overwritten
+// after every process passed the barrier that follows its reads.
+// The first process takes the samples: global totals are the slab totals summed in
+// slab order. Plane x draws from stream 1 + x of the seed exactly as in CheckerboardSweep,
+// so the trajectory equals the one of a single-process CheckerboardSweep run and only the
+// last bits of resynchronized totals depend on the number of processes. Single mode runs
+// "checkerboard" as multi-spin sweeps on 3D two-state graphs, see with_engine, so there
+// the trajectories differ and only the statistics agree.
+// Output is the same as in single mode.
+
+#include "Config.hpp"
+#include "Simulation.hpp"
+#include "Metrics.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// ========================================================================
+// Shared Memory
+// ========================================================================
+
+struct DomainControl
+{
+	pthread_barrier_t barrier;
+	std::atomic<uint64_t> stopAt; // Exchange after which every process leaves
+};
+
+// Published by every process at every exchange:
+struct DomainSlot
+{
+	LatticeTotals totals;
+	MoveCounters moves;
+};
+
+// Layout of the mapping: DomainControl, then per buffer set the slots of all
+// processes and the first and last owned plane of every process:
+struct DomainMapping
+{
+	uint8_t* base;
+	size_t size;
+	size_t processes;
+	size_t planeBytes;
+
+	DomainMapping(size_t processCount, size_t planeSites);
+	~DomainMapping();
+
+	DomainMapping(const DomainMapping&) = delete;
+	DomainMapping& operator=(const DomainMapping&) = delete;
+
+	inline DomainControl* control();
+	inline size_t setBytes() const;
+	inline DomainSlot* slot(int set, int process);
+	inline uint8_t* plane(int set, int process, int side);
+};
+
+DomainMapping::DomainMapping(size_t processCount, size_t planeSites) :
+	base       (nullptr),
+	size       (0),
+	processes  (processCount),
+	planeBytes (planeSites)
+{
+	size = sizeof(DomainControl) + 2 * setBytes();
+
+	base = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to map %zu bytes of shared memory\n", size);
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_barrierattr_t attributes;
+	pthread_barrierattr_init(&attributes);
+	pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+
+	if (pthread_barrier_init(&control()->barrier, &attributes, processes) != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to create a barrier of %zu processes\n", processes);
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_barrierattr_destroy(&attributes);
+
+	new (&control()->stopAt) std::atomic<uint64_t>(0);
+}
+
+DomainMapping::~DomainMapping()
+{
+	munmap(base, size);
+}
+
+inline DomainControl* DomainMapping::control()
+{
+	return (DomainControl*) base;
+}
+
+inline size_t DomainMapping::setBytes() const
+{
+	return processes * (sizeof(DomainSlot) + 2 * planeBytes);
+}
+
+inline DomainSlot* DomainMapping::slot(int set, int process)
+{
+	return (DomainSlot*) (base + sizeof(DomainControl) + set * setBytes()) + process;
+}
+
+inline uint8_t* DomainMapping::plane(int set, int process, int side)
+{
+	uint8_t* planes = base + sizeof(DomainControl) + set * setBytes() + processes * sizeof(DomainSlot);
+	return planes + (2 * process + side) * planeBytes;
+}
+
+// ========================================================================
+// Slab Of The Lattice
+// ========================================================================
+
+// Owned planes are local planes 1..planes, local plane 0 and planes + 1 are ghosts.
+// Observables are those of the whole lattice, so collect_samples can run on the
+// first process as if the lattice were local:
+template <typename Kind>
+struct DomainLattice
+{
+	int process, processes;
+	int sizeX, sizeY, sizeZ; // Whole lattice
+	int firstX, planes;      // Owned planes of the whole lattice
+	ModelParameters parameters;
+	Lattice<Kind> slab;
+	ThreadPool& pool;
+	DomainMapping& mapping;
+	std::vector<RandomStream> planeStreams;
+	std::vector<LatticeTotals> planeDeltas;
+	std::vector<MoveCounters> planeMoves;
+	uint64_t exchanges;
+
+	// Sums over all slabs as of the last exchange:
+	LatticeTotals totals;
+	MoveCounters moves;
+
+	DomainLattice(int processIndex, int processCount, const ModelParameters& modelParameters,
+	              ThreadPool& threadPool, DomainMapping& sharedMapping);
+
+	DomainLattice(const DomainLattice&) = delete;
+	DomainLattice& operator=(const DomainLattice&) = delete;
+
+	// Both return false once the first process asked everyone to stop:
+	bool sweep();
+	bool exchange();
+	void halfSweep(int parity);
+
+	// Called by the first process only:
+	void reduce();
+	void stop();
+
+	inline double magnetization() const;
+	inline double energy() const;
+
+	// Totals of the own slab, published at the next exchange:
+	double resyncTotals();
+};
+
+template <typename Kind>
+DomainLattice<Kind>::DomainLattice(int processIndex, int processCount, const ModelParameters& modelParameters,
+                                   ThreadPool& threadPool, DomainMapping& sharedMapping) :
+	process      (processIndex),
+	processes    (processCount),
+	sizeX        (lattice_size_x),
+	sizeY        (lattice_size_y),
+	sizeZ        ((Kind::DIMENSION == 3)? lattice_size_z : 1),
+	firstX       (lattice_size_x * processIndex / processCount),
+	planes       (lattice_size_x * (processIndex + 1) / processCount - lattice_size_x * processIndex / processCount),
+	parameters   (modelParameters),
+	slab         (planes + 2, sizeY, sizeZ, getStateX<Kind>, getStateY<Kind>, seed, modelParameters,
+	              layout_from_name(lattice_layout)),
+	pool         (threadPool),
+	mapping      (sharedMapping),
+	planeStreams (),
+	planeDeltas  (planes),
+	planeMoves   (planes),
+	exchanges    (0),
+	totals       ({0.0, 0.0}),
+	moves        ({0, 0})
+{
+	// Initial states of the whole lattice, ghosts included:
+	for (int x = 0; x < planes + 2; ++x) {
+	for (int y = 0; y < sizeY; ++y) {
+	for (int z = 0; z < sizeZ; ++z) {
+		int globalX = (firstX + x - 1 + sizeX) % sizeX;
+		slab.set(x, y, z, getStateX<Kind>(globalX, y, z, seed) * Kind::STATES_Y + getStateY<Kind>(globalX, y, z, seed));
+	}}}
+
+	slab.refreshParameters();
+	resyncTotals();
+
+	// Same stream numbering as CheckerboardSweep:
+	planeStreams.reserve(planes);
+	for (int x = 0; x < planes; ++x)
+	{
+		planeStreams.emplace_back(seed, 1 + firstX + x);
+	}
+}
+
+template <typename Kind>
+bool DomainLattice<Kind>::sweep()
+{
+	slab.refreshParameters();
+
+	halfSweep(0);
+	if (!exchange()) return false;
+
+	halfSweep(1);
+	return exchange();
+}
+
+// Same site order and random numbers as CheckerboardSweep::halfSweep:
+template <typename Kind>
+void DomainLattice<Kind>::halfSweep(int parity)
+{
+	pool.run(planes, [this, parity](size_t task, size_t /* worker */)
+	{
+		RandomStream& stream = planeStreams[task];
+		LatticeTotals& deltas = planeDeltas[task];
+		MoveCounters& moveCount = planeMoves[task];
+		int x = task + 1;
+		int globalX = firstX + task;
+
+		deltas = {0.0, 0.0};
+		moveCount = {0, 0};
+
+		uint64_t moves = 0;
+		int movesLeft = 0;
+
+		for (int y = 0; y < sizeY; ++y)
+		{
+			for (int z = (globalX + y + parity) % 2; z < sizeZ; z += 2)
+			{
+				if (movesLeft == 0)
+				{
+					moves = stream.next();
+					movesLeft = 32;
+				}
+
+				moveCount.attempted += 1;
+				moveCount.accepted  += slab.metropolisStepAt(x, y, z, moves & 3, stream, deltas);
+
+				moves >>= 2;
+				--movesLeft;
+			}
+		}
+	});
+
+	for (int x = 0; x < planes; ++x)
+	{
+		slab.totals.magnetization += planeDeltas[x].magnetization;
+		slab.totals.energy        += planeDeltas[x].energy;
+
+		slab.moves.attempted += planeMoves[x].attempted;
+		slab.moves.accepted  += planeMoves[x].accepted;
+	}
+}
+
+template <typename Kind>
+bool DomainLattice<Kind>::exchange()
+{
+	int set = exchanges % 2;
+
+	*mapping.slot(set, process) = {slab.totals, slab.moves};
+
+	uint8_t* first = mapping.plane(set, process, 0);
+	uint8_t* last  = mapping.plane(set, process, 1);
+	for (int y = 0; y < sizeY; ++y) {
+	for (int z = 0; z < sizeZ; ++z) {
+		first[y * sizeZ + z] = slab.get(1,      y, z);
+		last [y * sizeZ + z] = slab.get(planes, y, z);
+	}}
+
+	pthread_barrier_wait(&mapping.control()->barrier);
+	exchanges += 1;
+
+	if (mapping.control()->stopAt.load() == exchanges) return false;
+
+	// Ghosts are the last plane of the previous slab and the first plane of the next one:
+	const uint8_t* previous = mapping.plane(set, (process + processes - 1) % processes, 1);
+	const uint8_t* next     = mapping.plane(set, (process + 1)             % processes, 0);
+	for (int y = 0; y < sizeY; ++y) {
+	for (int z = 0; z < sizeZ; ++z) {
+		slab.set(0,          y, z, previous[y * sizeZ + z]);
+		slab.set(planes + 1, y, z, next    [y * sizeZ + z]);
+	}}
+
+	return true;
+}
+
+// Slabs are summed in order, so the totals do not depend on process timing:
+template <typename Kind>
+void DomainLattice<Kind>::reduce()
+{
+	int set = (exchanges + 1) % 2;
+
+	totals = {0.0, 0.0};
+	moves  = {0, 0};
+	for (int other = 0; other < processes; ++other)
+	{
+		const DomainSlot& published = *mapping.slot(set, other);
+
+		totals.magnetization += published.totals.magnetization;
+		totals.energy        += published.totals.energy;
+
+		moves.attempted += published.moves.attempted;
+		moves.accepted  += published.moves.accepted;
+	}
+}
+
+// The stop flag is set before this process reaches the next barrier
+// and read by the others only after it, so nobody waits there alone:
+template <typename Kind>
+void DomainLattice<Kind>::stop()
+{
+	mapping.control()->stopAt.store(exchanges + 1);
+	pthread_barrier_wait(&mapping.control()->barrier);
+}
+
+template <typename Kind>
+inline double DomainLattice<Kind>::magnetization() const
+{
+	return totals.magnetization / (size_t(sizeX) * sizeY * sizeZ);
+}
+
+template <typename Kind>
+inline double DomainLattice<Kind>::energy() const
+{
+	return totals.energy;
+}
+
+// Moves on a face book the whole change of the bond to the ghost plane to their own slab,
+// while the scan books that bond to the lower slab. Sums over all slabs agree,
+// slab energies do not, so only the magnetization tells drift from bookkeeping:
+template <typename Kind>
+double DomainLattice<Kind>::resyncTotals()
+{
+	LatticeTotals exact = {slab.calculateSpinSum(1, planes + 1), slab.calculateEnergy(1, planes + 1)};
+
+	double drift = std::abs(exact.magnetization - slab.totals.magnetization) / (size_t(planes) * sizeY * sizeZ);
+
+	slab.totals = exact;
+
+	return drift;
+}
+
+// ========================================================================
+// Processes
+// ========================================================================
+
+// Loop of every process but the first, it follows the sample schedule of collect_samples:
+template <typename Kind>
+void run_domain_slab(DomainLattice<Kind>& lattice)
+{
+	for (uint64_t iteration = 0; ; ++iteration)
+	{
+		for (size_t sweep = 0; sweep < sweeps_per_sample; ++sweep)
+		{
+			if (!lattice.sweep()) return;
+		}
+
+		if (drift_check_interval != 0 && (iteration + 1) % drift_check_interval == 0)
+		{
+			lattice.resyncTotals();
+		}
+	}
+}
+
+template <typename Kind>
+void run_domain_kind(const char* output_file)
+{
+	size_t processes = domain_processes;
+	if (processes == 0 || processes > size_t(lattice_size_x))
+	{
+		fprintf(stderr, "[ISING-MODEL] Domain mode needs 1 to lattice_size_x processes\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int sizeZ = (Kind::DIMENSION == 3)? lattice_size_z : 1;
+	bool oddZ = Kind::DIMENSION == 3 && sizeZ % 2 != 0;
+	if (lattice_size_x % 2 != 0 || lattice_size_y % 2 != 0 || oddZ)
+	{
+		fprintf(stderr, "[ISING-MODEL] Checkerboard sweep requires even lattice sizes\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (strcmp(update_engine, "checkerboard") != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Domain mode only supports the checkerboard engine\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (strcmp(checkpoint_file, "none") != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Domain mode does not support checkpoints\n");
+		exit(EXIT_FAILURE);
+	}
+
+	DomainMapping mapping(processes, size_t(lattice_size_y) * sizeZ);
+
+	// Threads are started after the fork, so the children inherit no locked mutexes:
+	int process = 0;
+	std::vector<pid_t> children;
+	for (size_t child = 1; child < processes; ++child)
+	{
+		pid_t pid = fork();
+		if (pid == -1)
+		{
+			fprintf(stderr, "[ISING-MODEL] Unable to fork domain process %zu\n", child);
+			exit(EXIT_FAILURE);
+		}
+
+		if (pid == 0)
+		{
+			// Nobody would release the barrier for a child left behind:
+			prctl(PR_SET_PDEATHSIG, SIGKILL);
+			if (getppid() == 1) _exit(EXIT_FAILURE);
+
+			process = child;
+			break;
+		}
+
+		children.push_back(pid);
+	}
+
+	ModelParameters parameters = {temperature, externalField, interactivity};
+	ThreadPool pool(threads);
+
+	if (process != 0)
+	{
+		DomainLattice<Kind> lattice(process, processes, parameters, pool, mapping);
+		run_domain_slab(lattice);
+
+		fflush(stdout);
+		_exit(EXIT_SUCCESS);
+	}
+
+	// A dead child would leave the others at the barrier forever:
+	std::thread watcher([]()
+	{
+		int status;
+		pid_t pid;
+		while ((pid = wait(&status)) != -1)
+		{
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			{
+				fprintf(stderr, "\n[ISING-MODEL] Domain process %d failed\n", int(pid));
+				_exit(EXIT_FAILURE);
+			}
+		}
+	});
+
+	std::unique_ptr<MetricsExporter> exporter;
+	if (strcmp(metrics_file, "none") != 0)
+	{
+		exporter.reset(new MetricsExporter(metrics_file, metrics_interval));
+	}
+
+	printf("Computing for T=%lf H=%lf on %zu processes of %d to %d x-planes\n",
+	       temperature / 1.38e-23, 100.0 * externalField.z / magnetic_moment, processes,
+	       lattice_size_x / int(processes), (lattice_size_x + int(processes) - 1) / int(processes));
+
+	NpyStream output(output_file, observables, output_chunk_samples);
+	StatisticsSink statistics(output);
+
+	{
+		DomainLattice<Kind> lattice(0, processes, parameters, pool, mapping);
+
+		collect_samples(lattice, statistics, true, nullptr, [&]()
+		{
+			for (size_t sweep = 0; sweep < sweeps_per_sample; ++sweep)
+				lattice.sweep();
+
+			lattice.reduce();
+		},
+		[&](CheckpointArchive& /* archive */) {});
+
+		lattice.stop();
+	}
+
+	watcher.join();
+
+	printf("\rComputation in progress: %02.0f%%", 100.0);
+	printf("\nComputation completed!\n");
+
+	print_summary(statistics.statistics.summary());
+}
+
+void run_domain(const char* output_file)
+{
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		run_domain_kind<decltype(kind)>(output_file);
+	});
+}
+
+#endif  // POTTS_MODEL_DOMAIN_HPP_INCLUDED
@@ -0,0 +1,202 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_FFT_HPP_INCLUDED
+#define POTTS_MODEL_FFT_HPP_INCLUDED
+
+// Built-in complex FFT for lattice-sized transforms.
+// Lengths that are powers of two go through an iterative radix-2 transform,
+// other lengths through Bluestein's chirp-z algorithm, which turns the transform
+// into a convolution computed by radix-2 transforms of at least twice the length.
+// Transforms are unnormalized: forward uses exp(-2 pi i k x / n), inverse exp(+2 pi i k x / n).
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+typedef std::complex<double> Complex;
+
+struct Fft
+{
+	size_t size;
+	size_t radixSize; // Length of the radix-2 transform, the padded one for Bluestein
+	bool powerOfTwo;
+
+	std::vector<Complex> twiddles; // exp(-2 pi i k / radixSize), k < radixSize / 2
+	std::vector<size_t> reversed;  // Bit-reversal permutation of radixSize
+
+	// Bluestein:
+	std::vector<Complex> chirp;         // exp(-pi i k^2 / size)
+	std::vector<Complex> chirpSpectrum; // Radix-2 transform of the conjugate chirp, wrapped
+	std::vector<Complex> work;
+
+	Fft(size_t length = 1);
+
+	// In place, data holds size elements:
+	void transform(Complex* data, bool inverse);
+
+	void radix2(Complex* data, bool inverse) const;
+};
+
+Fft::Fft(size_t length) :
+	size          (length),
+	radixSize     (1),
+	powerOfTwo    ((length & (length - 1)) == 0),
+	twiddles      (),
+	reversed      (),
+	chirp         (),
+	chirpSpectrum (),
+	work          ()
+{
+	size_t minimum = (powerOfTwo)? length : 2 * length - 1;
+	while (radixSize < minimum) radixSize *= 2;
+
+	int bits = 0;
+	while ((size_t(1) << bits) < radixSize) ++bits;
+
+	reversed.resize(radixSize);
+	for (size_t index = 0; index < radixSize; ++index)
+	{
+		size_t mirrored = 0;
+		for (int bit = 0; bit < bits; ++bit)
+		{
+			if (index & (size_t(1) << bit)) mirrored |= size_t(1) << (bits - 1 - bit);
+		}
+		reversed[index] = mirrored;
+	}
+
+	twiddles.resize(radixSize / 2);
+	for (size_t k = 0; k < radixSize / 2; ++k)
+	{
+		twiddles[k] = std::polar(1.0, -2.0 * M_PI * k / radixSize);
+	}
+
+	if (powerOfTwo) return;
+
+	// k^2 is reduced modulo 2 * size first, so the phase keeps its precision:
+	chirp.resize(size);
+	for (size_t k = 0; k < size; ++k)
+	{
+		chirp[k] = std::polar(1.0, -M_PI * double((k * k) % (2 * size)) / size);
+	}
+
+	chirpSpectrum.assign(radixSize, Complex(0.0, 0.0));
+	chirpSpectrum[0] = std::conj(chirp[0]);
+	for (size_t k = 1; k < size; ++k)
+	{
+		chirpSpectrum[k]             = std::conj(chirp[k]);
+		chirpSpectrum[radixSize - k] = std::conj(chirp[k]);
+	}
+	radix2(chirpSpectrum.data(), false);
+
+	work.resize(radixSize);
+}
+
+void Fft::radix2(Complex* data, bool inverse) const
+{
+	for (size_t index = 0; index < radixSize; ++index)
+	{
+		if (index < reversed[index]) std::swap(data[index], data[reversed[index]]);
+	}
+
+	for (size_t half = 1; half < radixSize; half *= 2)
+	{
+		size_t stride = radixSize / (2 * half);
+		for (size_t block = 0; block < radixSize; block += 2 * half)
+		{
+			for (size_t k = 0; k < half; ++k)
+			{
+				Complex twiddle = (inverse)? std::conj(twiddles[k * stride]) : twiddles[k * stride];
+
+				Complex even = data[block + k];
+				Complex odd  = data[block + k + half] * twiddle;
+
+				data[block + k]        = even + odd;
+				data[block + k + half] = even - odd;
+			}
+		}
+	}
+}
+
+void Fft::transform(Complex* data, bool inverse)
+{
+	if (size <= 1) return;
+
+	if (powerOfTwo)
+	{
+		radix2(data, inverse);
+		return;
+	}
+
+	// The inverse transform is the conjugate of the forward one of the conjugate:
+	for (size_t k = 0; k < size; ++k)
+	{
+		Complex value = (inverse)? std::conj(data[k]) : data[k];
+		work[k] = value * chirp[k];
+	}
+	std::fill(work.begin() + size, work.end(), Complex(0.0, 0.0));
+
+	radix2(work.data(), false);
+	for (size_t k = 0; k < radixSize; ++k) work[k] *= chirpSpectrum[k];
+	radix2(work.data(), true);
+
+	for (size_t k = 0; k < size; ++k)
+	{
+		Complex value = work[k] * chirp[k] / double(radixSize);
+		data[k] = (inverse)? std::conj(value) : value;
+	}
+}
+
+// ========================================================================
+// Transforms Over The Whole Lattice
+// ========================================================================
+
+// Fields indexed as (x * sizeY + y) * sizeZ + z, transformed along every axis:
+struct LatticeFft
+{
+	int sizeX, sizeY, sizeZ;
+	Fft fftX, fftY, fftZ;
+	std::vector<Complex> line;
+
+	LatticeFft(int latticeSizeX, int latticeSizeY, int latticeSizeZ);
+
+	void transform(std::vector<Complex>& field, bool inverse);
+};
+
+LatticeFft::LatticeFft(int latticeSizeX, int latticeSizeY, int latticeSizeZ) :
+	sizeX (latticeSizeX),
+	sizeY (latticeSizeY),
+	sizeZ (latticeSizeZ),
+	fftX  (latticeSizeX),
+	fftY  (latticeSizeY),
+	fftZ  (latticeSizeZ),
+	line  (std::max(latticeSizeX, std::max(latticeSizeY, latticeSizeZ)))
+{}
+
+void LatticeFft::transform(std::vector<Complex>& field, bool inverse)
+{
+	// Rows along z are contiguous:
+	for (size_t row = 0; row < size_t(sizeX) * sizeY; ++row)
+	{
+		fftZ.transform(&field[row * sizeZ], inverse);
+	}
+
+	for (int x = 0; x < sizeX && sizeY > 1; ++x) {
+	for (int z = 0; z < sizeZ;              ++z) {
+		Complex* base = &field[size_t(x) * sizeY * sizeZ + z];
+
+		for (int y = 0; y < sizeY; ++y) line[y] = base[size_t(y) * sizeZ];
+		fftY.transform(line.data(), inverse);
+		for (int y = 0; y < sizeY; ++y) base[size_t(y) * sizeZ] = line[y];
+	}}
+
+	size_t planeSize = size_t(sizeY) * sizeZ;
+	for (size_t offset = 0; offset < planeSize && sizeX > 1; ++offset)
+	{
+		for (int x = 0; x < sizeX; ++x) line[x] = field[x * planeSize + offset];
+		fftX.transform(line.data(), inverse);
+		for (int x = 0; x < sizeX; ++x) field[x * planeSize + offset] = line[x];
+	}
+}
+
+#endif  // POTTS_MODEL_FFT_HPP_INCLUDED
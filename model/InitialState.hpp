@@ -0,0 +1,22 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_INITIAL_STATE_HPP_INCLUDED
+#define POTTS_MODEL_INITIAL_STATE_HPP_INCLUDED
+
+#include "Random.hpp"
+
+#include <cstdint>
+
+// Counter-based, so the initial state depends only on the seed and the site:
+template <typename Kind>
+int getStateX(int x, int y, int z, uint64_t seed)
+{
+	return counterHash(seed, 2 * ((uint64_t(x) << 42) ^ (uint64_t(y) << 21) ^ z) + 0) % Kind::STATES_X;
+}
+
+template <typename Kind>
+int getStateY(int x, int y, int z, uint64_t seed)
+{
+	return counterHash(seed, 2 * ((uint64_t(x) << 42) ^ (uint64_t(y) << 21) ^ z) + 1) % Kind::STATES_Y;
+}
+
+#endif  // POTTS_MODEL_INITIAL_STATE_HPP_INCLUDED
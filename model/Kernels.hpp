@@ -0,0 +1,205 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_KERNELS_HPP_INCLUDED
+#define POTTS_MODEL_KERNELS_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+#include <immintrin.h>
+
+// Reduction kernels for observables over rows of one-byte state indices.
+// Observables are sums of per-state values (spin components, field energy) and
+// of per-pair values (spin products of neighbours), so both reduce to summing
+// a small table indexed by the states:
+//   tableSum(states, n, table)              = sum table[states[i]];
+//   pairSum (first, second, n, table, row)  = sum table[first[i] * row + second[i]].
+// The binary is built for the baseline ISA. AVX2 and AVX-512 versions are compiled
+// with target attributes and picked at startup from CPUID.
+
+typedef double (*TableSumKernel)(const uint8_t* states, size_t count, const double* table);
+typedef double (*PairSumKernel) (const uint8_t* first, const uint8_t* second, size_t count,
+                                 const double* table, int row);
+
+struct ObservableKernels
+{
+	const char* isa;
+	TableSumKernel tableSum;
+	PairSumKernel  pairSum;
+};
+
+// ========================================================================
+// Scalar
+// ========================================================================
+
+double tableSumScalar(const uint8_t* states, size_t count, const double* table)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		sum += table[states[i]];
+	}
+
+	return sum;
+}
+
+double pairSumScalar(const uint8_t* first, const uint8_t* second, size_t count, const double* table, int row)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		sum += table[first[i] * row + second[i]];
+	}
+
+	return sum;
+}
+
+// ========================================================================
+// AVX2: 8 sites per iteration, 4 per gather
+// ========================================================================
+
+// Masked forms with zero sources throughout: the unmasked intrinsics start from
+// undefined registers, which trips -Wmaybe-uninitialized.
+__attribute__((target("avx2")))
+inline __m256d gatherAvx2(const double* table, __m128i indices)
+{
+	return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table, indices,
+	                                _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+}
+
+__attribute__((target("avx2")))
+double tableSumAvx2(const uint8_t* states, size_t count, const double* table)
+{
+	__m256d sumLo = _mm256_setzero_pd();
+	__m256d sumHi = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i bytes = _mm_loadl_epi64((const __m128i*) (states + i));
+		__m128i idxLo = _mm_cvtepu8_epi32(bytes);
+		__m128i idxHi = _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4));
+
+		sumLo = _mm256_add_pd(sumLo, gatherAvx2(table, idxLo));
+		sumHi = _mm256_add_pd(sumHi, gatherAvx2(table, idxHi));
+	}
+
+	alignas(32) double lanes[4];
+	_mm256_store_pd(lanes, _mm256_add_pd(sumLo, sumHi));
+
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + tableSumScalar(states + i, count - i, table);
+}
+
+__attribute__((target("avx2")))
+double pairSumAvx2(const uint8_t* first, const uint8_t* second, size_t count, const double* table, int row)
+{
+	__m256d sumLo = _mm256_setzero_pd();
+	__m256d sumHi = _mm256_setzero_pd();
+	__m128i rows  = _mm_set1_epi32(row);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i bytesA = _mm_loadl_epi64((const __m128i*) (first  + i));
+		__m128i bytesB = _mm_loadl_epi64((const __m128i*) (second + i));
+
+		__m128i idxLo = _mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu8_epi32(bytesA), rows),
+		                              _mm_cvtepu8_epi32(bytesB));
+		__m128i idxHi = _mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(bytesA, 4)), rows),
+		                              _mm_cvtepu8_epi32(_mm_srli_si128(bytesB, 4)));
+
+		sumLo = _mm256_add_pd(sumLo, gatherAvx2(table, idxLo));
+		sumHi = _mm256_add_pd(sumHi, gatherAvx2(table, idxHi));
+	}
+
+	alignas(32) double lanes[4];
+	_mm256_store_pd(lanes, _mm256_add_pd(sumLo, sumHi));
+
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+	       pairSumScalar(first + i, second + i, count - i, table, row);
+}
+
+// ========================================================================
+// AVX-512: 16 sites per iteration, 8 per gather
+// ========================================================================
+
+__attribute__((target("avx512f")))
+inline __m512d gatherAvx512(const double* table, __m256i indices)
+{
+	return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, indices, table, 8);
+}
+
+__attribute__((target("avx512f")))
+inline __m512i loadIndicesAvx512(const uint8_t* bytes)
+{
+	return _mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128((const __m128i*) bytes));
+}
+
+__attribute__((target("avx512f")))
+inline double reduceAvx512(__m512d sumLo, __m512d sumHi)
+{
+	alignas(64) double lanes[8];
+	_mm512_store_pd(lanes, _mm512_add_pd(sumLo, sumHi));
+
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+__attribute__((target("avx512f")))
+double tableSumAvx512(const uint8_t* states, size_t count, const double* table)
+{
+	__m512d sumLo = _mm512_setzero_pd();
+	__m512d sumHi = _mm512_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m512i idx = loadIndicesAvx512(states + i);
+
+		sumLo = _mm512_add_pd(sumLo, gatherAvx512(table, _mm512_maskz_extracti64x4_epi64(0xF, idx, 0)));
+		sumHi = _mm512_add_pd(sumHi, gatherAvx512(table, _mm512_maskz_extracti64x4_epi64(0xF, idx, 1)));
+	}
+
+	return reduceAvx512(sumLo, sumHi) + tableSumScalar(states + i, count - i, table);
+}
+
+__attribute__((target("avx512f")))
+double pairSumAvx512(const uint8_t* first, const uint8_t* second, size_t count, const double* table, int row)
+{
+	__m512d sumLo = _mm512_setzero_pd();
+	__m512d sumHi = _mm512_setzero_pd();
+	__m512i rows  = _mm512_set1_epi32(row);
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m512i idxA = loadIndicesAvx512(first  + i);
+		__m512i idxB = loadIndicesAvx512(second + i);
+		__m512i idx  = _mm512_add_epi32(_mm512_mullo_epi32(idxA, rows), idxB);
+
+		sumLo = _mm512_add_pd(sumLo, gatherAvx512(table, _mm512_maskz_extracti64x4_epi64(0xF, idx, 0)));
+		sumHi = _mm512_add_pd(sumHi, gatherAvx512(table, _mm512_maskz_extracti64x4_epi64(0xF, idx, 1)));
+	}
+
+	return reduceAvx512(sumLo, sumHi) + pairSumScalar(first + i, second + i, count - i, table, row);
+}
+
+// ========================================================================
+// Runtime Dispatch
+// ========================================================================
+
+ObservableKernels selectObservableKernels()
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f")) return {"avx512", tableSumAvx512, pairSumAvx512};
+	if (__builtin_cpu_supports("avx2"))    return {"avx2",   tableSumAvx2,   pairSumAvx2  };
+
+	return {"scalar", tableSumScalar, pairSumScalar};
+}
+
+// Selected once per process:
+inline const ObservableKernels& observableKernels()
+{
+	static const ObservableKernels kernels = selectObservableKernels();
+	return kernels;
+}
+
+#endif  // POTTS_MODEL_KERNELS_HPP_INCLUDED
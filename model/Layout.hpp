@@ -0,0 +1,124 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_LAYOUT_HPP_INCLUDED
+#define POTTS_MODEL_LAYOUT_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Order of lattice sites in memory.
+// Every supported order is separable: the offset of (x, y, z) is
+// offsetX[x] + offsetY[y] + offsetZ[z], so a layout is three small tables.
+//   linear - (x * sizeY + y) * sizeZ + z;
+//   tiled  - TILE^3 blocks stored one after another, linear inside a block;
+//   morton - bits of x, y and z interleaved (Z-order curve), an axis drops out
+//            of the interleaving once its bits run out.
+// Tiled and Morton layouts keep all six neighbours of most sites within a few
+// cache lines. Their storage is padded up to whole blocks.
+enum LayoutType
+{
+	LAYOUT_LINEAR,
+	LAYOUT_TILED,
+	LAYOUT_MORTON
+};
+
+struct LatticeLayout
+{
+	static constexpr int TILE = 8;
+
+	std::vector<size_t> offsetX, offsetY, offsetZ;
+	size_t capacity;
+	bool contiguousZ; // Rows along z are contiguous in memory
+
+	LatticeLayout(int sizeX, int sizeY, int sizeZ, LayoutType type);
+
+	inline size_t offset(int x, int y, int z) const;
+};
+
+// Bit number bit of value moved to position positions[bit]:
+inline size_t depositBits(size_t value, const std::vector<int>& positions)
+{
+	size_t deposited = 0;
+	for (size_t bit = 0; bit < positions.size(); ++bit)
+	{
+		deposited |= ((value >> bit) & 1) << positions[bit];
+	}
+
+	return deposited;
+}
+
+LatticeLayout::LatticeLayout(int sizeX, int sizeY, int sizeZ, LayoutType type) :
+	offsetX  (sizeX),
+	offsetY  (sizeY),
+	offsetZ  (sizeZ),
+	capacity (0),
+	contiguousZ (true)
+{
+	switch (type)
+	{
+		case LAYOUT_LINEAR:
+		{
+			for (int x = 0; x < sizeX; ++x) offsetX[x] = size_t(x) * sizeY * sizeZ;
+			for (int y = 0; y < sizeY; ++y) offsetY[y] = size_t(y) * sizeZ;
+			for (int z = 0; z < sizeZ; ++z) offsetZ[z] = z;
+			break;
+		}
+		case LAYOUT_TILED:
+		{
+			// Thin axes (a 2D lattice has sizeZ = 1) are not tiled:
+			int tileX = std::min(TILE, sizeX), tileY = std::min(TILE, sizeY), tileZ = std::min(TILE, sizeZ);
+			size_t tilesY = (sizeY + tileY - 1) / tileY;
+			size_t tilesZ = (sizeZ + tileZ - 1) / tileZ;
+			size_t tileSize = size_t(tileX) * tileY * tileZ;
+
+			for (int x = 0; x < sizeX; ++x) offsetX[x] = (x / tileX) * tilesY * tilesZ * tileSize + (x % tileX) * tileY * tileZ;
+			for (int y = 0; y < sizeY; ++y) offsetY[y] = (y / tileY) *          tilesZ * tileSize + (y % tileY) *         tileZ;
+			for (int z = 0; z < sizeZ; ++z) offsetZ[z] = (z / tileZ) *                   tileSize + (z % tileZ);
+			break;
+		}
+		case LAYOUT_MORTON:
+		{
+			// Every axis takes as many bits as its largest coordinate has, so an
+			// anisotropic lattice is not padded up to a cube of its longest axis:
+			std::vector<int> positionsX, positionsY, positionsZ;
+			int position = 0;
+			for (int bit = 0; (size_t(std::max(sizeX, std::max(sizeY, sizeZ)) - 1) >> bit) != 0; ++bit)
+			{
+				if ((size_t(sizeZ - 1) >> bit) != 0) positionsZ.push_back(position++);
+				if ((size_t(sizeY - 1) >> bit) != 0) positionsY.push_back(position++);
+				if ((size_t(sizeX - 1) >> bit) != 0) positionsX.push_back(position++);
+			}
+
+			for (int x = 0; x < sizeX; ++x) offsetX[x] = depositBits(x, positionsX);
+			for (int y = 0; y < sizeY; ++y) offsetY[y] = depositBits(y, positionsY);
+			for (int z = 0; z < sizeZ; ++z) offsetZ[z] = depositBits(z, positionsZ);
+			break;
+		}
+	}
+
+	capacity = offsetX[sizeX - 1] + offsetY[sizeY - 1] + offsetZ[sizeZ - 1] + 1;
+
+	for (int z = 0; z < sizeZ; ++z)
+	{
+		if (offsetZ[z] != size_t(z)) contiguousZ = false;
+	}
+}
+
+inline size_t LatticeLayout::offset(int x, int y, int z) const
+{
+	return offsetX[x] + offsetY[y] + offsetZ[z];
+}
+
+LayoutType layout_from_name(const char* name)
+{
+	if (strcmp(name, "linear") == 0) return LAYOUT_LINEAR;
+	if (strcmp(name, "tiled")  == 0) return LAYOUT_TILED;
+	if (strcmp(name, "morton") == 0) return LAYOUT_MORTON;
+
+	fprintf(stderr, "[ISING-MODEL] Unknown lattice layout \"%s\"\n", name);
+	exit(EXIT_FAILURE);
+}
+
+#endif  // POTTS_MODEL_LAYOUT_HPP_INCLUDED
@@ -0,0 +1,383 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_METRICS_HPP_INCLUDED
+#define POTTS_MODEL_METRICS_HPP_INCLUDED
+
+// Live counters of a running process.
+// Engines count attempted and accepted moves in plain MoveCounters of the lattice.
+// Once per sample, collect_samples publishes the change together with the time
+// spent in the MC, measurement and I/O phases into the WorkerMetrics of the
+// calling thread (output chunks written as they fill count as measurement).
+// Every thread writes only its own slot, so publishing is a few relaxed stores;
+// moves of finished points are folded into per-temperature totals.
+// With metrics_file set, a MetricsExporter thread rewrites that file every
+// metrics_interval seconds in the Prometheus text format (suitable for the
+// node_exporter textfile collector). Every series carries the pid label, so
+// several processes on one host may share a collector directory.
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// Site updates of one lattice. Accepted ones are those that changed the site,
+// cluster engines count flipped sites as attempted and accepted alike:
+struct MoveCounters
+{
+	uint64_t attempted;
+	uint64_t accepted;
+};
+
+inline uint64_t metrics_clock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ========================================================================
+// Per-thread Counters
+// ========================================================================
+
+enum MetricsPhase
+{
+	PHASE_MC,
+	PHASE_MEASURE,
+	PHASE_IO,
+	PHASE_COUNT
+};
+
+const char* const METRICS_PHASE_NAMES[PHASE_COUNT] = {"mc", "measure", "io"};
+
+// Written by its owner thread only, read by the exporter:
+struct alignas(64) WorkerMetrics
+{
+	std::atomic<uint64_t> attempted;
+	std::atomic<uint64_t> accepted;
+	std::atomic<uint64_t> samples;
+	std::atomic<uint64_t> points;
+	std::atomic<uint64_t> phaseNanoseconds[PHASE_COUNT];
+	std::atomic<uint64_t> lastActivity; // metrics_clock() of the last update
+
+	// Point in progress, NaN when idle:
+	std::atomic<double>   temperature;  // Kelvins
+	std::atomic<uint64_t> pointAttempted;
+	std::atomic<uint64_t> pointAccepted;
+
+	WorkerMetrics();
+
+	inline void beginPoint(double kelvins);
+	inline void addMoves(const MoveCounters& moves);
+	inline void addPhase(MetricsPhase phase, uint64_t nanoseconds);
+	inline void addSample();
+	void endPoint();
+};
+
+// A single writer needs no read-modify-write instructions:
+inline void metrics_add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+WorkerMetrics::WorkerMetrics() :
+	attempted        (0),
+	accepted         (0),
+	samples          (0),
+	points           (0),
+	phaseNanoseconds (),
+	lastActivity     (metrics_clock()),
+	temperature      (NAN),
+	pointAttempted   (0),
+	pointAccepted    (0)
+{}
+
+inline void WorkerMetrics::beginPoint(double kelvins)
+{
+	pointAttempted.store(0, std::memory_order_relaxed);
+	pointAccepted .store(0, std::memory_order_relaxed);
+	temperature   .store(kelvins, std::memory_order_relaxed);
+	lastActivity  .store(metrics_clock(), std::memory_order_relaxed);
+}
+
+inline void WorkerMetrics::addMoves(const MoveCounters& moves)
+{
+	metrics_add(attempted,      moves.attempted);
+	metrics_add(accepted,       moves.accepted);
+	metrics_add(pointAttempted, moves.attempted);
+	metrics_add(pointAccepted,  moves.accepted);
+}
+
+inline void WorkerMetrics::addPhase(MetricsPhase phase, uint64_t nanoseconds)
+{
+	metrics_add(phaseNanoseconds[phase], nanoseconds);
+	lastActivity.store(metrics_clock(), std::memory_order_relaxed);
+}
+
+inline void WorkerMetrics::addSample()
+{
+	metrics_add(samples, 1);
+}
+
+// ========================================================================
+// Registry
+// ========================================================================
+
+struct MetricsRegistry
+{
+	std::mutex mutex;
+	std::deque<WorkerMetrics> workers; // Never moves its elements
+	std::map<double, MoveCounters> temperatures; // Moves of finished points by Kelvins
+
+	WorkerMetrics& registerWorker();
+
+	// For engines that advance several temperatures on one thread, see Tempering.hpp:
+	void addTemperatureMoves(double kelvins, const MoveCounters& moves);
+};
+
+MetricsRegistry metrics_registry;
+
+WorkerMetrics& MetricsRegistry::registerWorker()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	workers.emplace_back();
+	return workers.back();
+}
+
+void MetricsRegistry::addTemperatureMoves(double kelvins, const MoveCounters& moves)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	MoveCounters& total = temperatures[kelvins];
+	total.attempted += moves.attempted;
+	total.accepted  += moves.accepted;
+}
+
+// Slot of the calling thread, registered on first use:
+WorkerMetrics& worker_metrics()
+{
+	thread_local WorkerMetrics* slot = nullptr;
+	if (slot == nullptr) slot = &metrics_registry.registerWorker();
+
+	return *slot;
+}
+
+void WorkerMetrics::endPoint()
+{
+	if (!std::isnan(temperature.load(std::memory_order_relaxed)))
+	{
+		std::lock_guard<std::mutex> lock(metrics_registry.mutex);
+
+		MoveCounters& total = metrics_registry.temperatures[temperature.load(std::memory_order_relaxed)];
+		total.attempted += pointAttempted.load(std::memory_order_relaxed);
+		total.accepted  += pointAccepted .load(std::memory_order_relaxed);
+
+		// Under the lock, so the exporter never counts the point twice or not at all:
+		pointAttempted.store(0, std::memory_order_relaxed);
+		pointAccepted .store(0, std::memory_order_relaxed);
+		temperature   .store(NAN, std::memory_order_relaxed);
+	}
+
+	metrics_add(points, 1);
+	lastActivity.store(metrics_clock(), std::memory_order_relaxed);
+}
+
+// ========================================================================
+// Exporter
+// ========================================================================
+
+struct MetricsExporter
+{
+	const char* filename;
+	double interval; // Seconds
+	pid_t pid;
+
+	std::mutex mutex;
+	std::condition_variable stopRequested;
+	bool stopping;
+	std::thread thread;
+
+	// Previous snapshot, for the rates:
+	std::vector<uint64_t> lastAttempted;
+	uint64_t lastWrite;
+
+	MetricsExporter(const char* metricsFile, double writeInterval);
+	~MetricsExporter();
+
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	void exportLoop();
+	void write();
+};
+
+MetricsExporter::MetricsExporter(const char* metricsFile, double writeInterval) :
+	filename      (metricsFile),
+	interval      ((writeInterval > 0.0)? writeInterval : 1.0),
+	pid           (getpid()),
+	mutex         (),
+	stopRequested (),
+	stopping      (false),
+	thread        (),
+	lastAttempted (),
+	lastWrite     (metrics_clock())
+{
+	thread = std::thread(&MetricsExporter::exportLoop, this);
+}
+
+// The final counters are written once more on the way out:
+MetricsExporter::~MetricsExporter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	stopRequested.notify_all();
+
+	thread.join();
+	write();
+}
+
+void MetricsExporter::exportLoop()
+{
+	auto period = std::chrono::duration<double>(interval);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopRequested.wait_for(lock, period, [this]() { return stopping; }))
+	{
+		write();
+	}
+}
+
+// Written next to the target and renamed over it, so readers never see a partial file:
+void MetricsExporter::write()
+{
+	char temporary[512];
+	snprintf(temporary, sizeof(temporary), "%s.tmp", filename);
+
+	FILE* file = fopen(temporary, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "\n[ISING-MODEL] Unable to write metrics file %s\n", temporary);
+		return;
+	}
+
+	uint64_t now = metrics_clock();
+	double elapsed = 1e-9 * (now - lastWrite);
+	lastWrite = now;
+
+	std::lock_guard<std::mutex> lock(metrics_registry.mutex);
+
+	std::deque<WorkerMetrics>& workers = metrics_registry.workers;
+	lastAttempted.resize(workers.size(), 0);
+
+	fprintf(file, "# HELP ising_flips_attempted_total Attempted site updates.\n");
+	fprintf(file, "# TYPE ising_flips_attempted_total counter\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		fprintf(file, "ising_flips_attempted_total{pid=\"%d\",worker=\"%zu\"} %" PRIu64 "\n",
+		        pid, w, workers[w].attempted.load(std::memory_order_relaxed));
+	}
+
+	fprintf(file, "# HELP ising_flips_accepted_total Accepted site updates.\n");
+	fprintf(file, "# TYPE ising_flips_accepted_total counter\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		fprintf(file, "ising_flips_accepted_total{pid=\"%d\",worker=\"%zu\"} %" PRIu64 "\n",
+		        pid, w, workers[w].accepted.load(std::memory_order_relaxed));
+	}
+
+	fprintf(file, "# HELP ising_flips_per_second Attempted site updates per second since the previous write.\n");
+	fprintf(file, "# TYPE ising_flips_per_second gauge\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		uint64_t attempted = workers[w].attempted.load(std::memory_order_relaxed);
+		fprintf(file, "ising_flips_per_second{pid=\"%d\",worker=\"%zu\"} %.6g\n",
+		        pid, w, (attempted - lastAttempted[w]) / elapsed);
+
+		lastAttempted[w] = attempted;
+	}
+
+	fprintf(file, "# HELP ising_samples_total Samples taken.\n");
+	fprintf(file, "# TYPE ising_samples_total counter\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		fprintf(file, "ising_samples_total{pid=\"%d\",worker=\"%zu\"} %" PRIu64 "\n",
+		        pid, w, workers[w].samples.load(std::memory_order_relaxed));
+	}
+
+	fprintf(file, "# HELP ising_points_total Finished (temperature, field) points.\n");
+	fprintf(file, "# TYPE ising_points_total counter\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		fprintf(file, "ising_points_total{pid=\"%d\",worker=\"%zu\"} %" PRIu64 "\n",
+		        pid, w, workers[w].points.load(std::memory_order_relaxed));
+	}
+
+	fprintf(file, "# HELP ising_phase_seconds_total Time spent in the MC, measurement and I/O phases.\n");
+	fprintf(file, "# TYPE ising_phase_seconds_total counter\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		for (int phase = 0; phase < PHASE_COUNT; ++phase)
+		{
+			fprintf(file, "ising_phase_seconds_total{pid=\"%d\",worker=\"%zu\",phase=\"%s\"} %.9f\n",
+			        pid, w, METRICS_PHASE_NAMES[phase],
+			        1e-9 * workers[w].phaseNanoseconds[phase].load(std::memory_order_relaxed));
+		}
+	}
+
+	fprintf(file, "# HELP ising_worker_idle_seconds Time since the worker last reported progress.\n");
+	fprintf(file, "# TYPE ising_worker_idle_seconds gauge\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		uint64_t lastActivity = workers[w].lastActivity.load(std::memory_order_relaxed);
+		fprintf(file, "ising_worker_idle_seconds{pid=\"%d\",worker=\"%zu\"} %.3f\n",
+		        pid, w, (now > lastActivity)? 1e-9 * (now - lastActivity) : 0.0);
+	}
+
+	fprintf(file, "# HELP ising_worker_temperature_kelvin Temperature of the point in progress, NaN when idle.\n");
+	fprintf(file, "# TYPE ising_worker_temperature_kelvin gauge\n");
+	for (size_t w = 0; w < workers.size(); ++w)
+	{
+		fprintf(file, "ising_worker_temperature_kelvin{pid=\"%d\",worker=\"%zu\"} %g\n",
+		        pid, w, workers[w].temperature.load(std::memory_order_relaxed));
+	}
+
+	// Finished points plus the ones in progress:
+	std::map<double, MoveCounters> temperatures = metrics_registry.temperatures;
+	for (const WorkerMetrics& worker : workers)
+	{
+		double kelvins = worker.temperature.load(std::memory_order_relaxed);
+		if (std::isnan(kelvins)) continue;
+
+		MoveCounters& total = temperatures[kelvins];
+		total.attempted += worker.pointAttempted.load(std::memory_order_relaxed);
+		total.accepted  += worker.pointAccepted .load(std::memory_order_relaxed);
+	}
+
+	fprintf(file, "# HELP ising_acceptance_ratio Accepted over attempted site updates at one temperature.\n");
+	fprintf(file, "# TYPE ising_acceptance_ratio gauge\n");
+	for (const auto& entry : temperatures)
+	{
+		const MoveCounters& total = entry.second;
+		fprintf(file, "ising_acceptance_ratio{pid=\"%d\",temperature=\"%g\"} %.6g\n",
+		        pid, entry.first, (total.attempted == 0)? 0.0 : double(total.accepted) / total.attempted);
+	}
+
+	fclose(file);
+
+	if (rename(temporary, filename) == -1)
+	{
+		fprintf(stderr, "\n[ISING-MODEL] Unable to replace metrics file %s\n", filename);
+	}
+}
+
+#endif  // POTTS_MODEL_METRICS_HPP_INCLUDED
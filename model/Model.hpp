@@ -5,205 +5,470 @@
 // MAXIM LOH
 // VLADIK SUPER MOLODEC
 
-#include "StateGraph.hpp"
+#include "ModelKind.hpp"
+#include "Parameters.hpp"
+#include "Random.hpp"
+#include "AcceptanceTable.hpp"
+#include "Layout.hpp"
+#include "Kernels.hpp"
+#include "Metrics.hpp"
 
-#include <random>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 #include <assert.h>
 
-struct LatticePoint
+// Running sums kept up to date by accepted moves:
+struct LatticeTotals
 {
-	int stateX;
-	int stateY;
+	double magnetization; // Sum of spin z-components
+	double energy;
 };
 
+// Lattice of spins of one model kind, see ModelKind.hpp.
+// Every site stores its state index (stateX * STATES_Y + stateY) in one byte,
+// sites are placed in memory by the layout, see Layout.hpp:
+template <typename Kind>
 struct Lattice
 {
+	static_assert(Kind::STATES <= 256, "State index must fit into one byte");
+
 	int sizeX, sizeY, sizeZ;
-	FibonacciSpinStateGraph stateGraph;
-	LatticePoint* points;
+	size_t sites;
+	ModelParameters parameters;
+	typename Kind::StateGraph stateGraph;
+	AcceptanceTable<Kind> acceptance;
+	LatticeLayout layout;
+	uint8_t* states;
+	uint64_t seed;
+	RandomStream rng;
+	LatticeTotals totals;
+	MoveCounters moves; // Not part of the state, see Metrics.hpp
 
 	Lattice(int latticeSizeX, int latticeSizeY, int latticeSizeZ,
-	        int (*getStateX) (int, int, int),
-            int (*getStateY) (int, int, int));
+	        int (*getStateX) (int, int, int, uint64_t),
+            int (*getStateY) (int, int, int, uint64_t),
+	        uint64_t rngSeed, const ModelParameters& modelParameters,
+	        LayoutType layoutType = LAYOUT_LINEAR);
 
 	~Lattice();
 
-	inline LatticePoint& get(int x, int y, int z);
+	Lattice(const Lattice&) = delete;
+	Lattice& operator=(const Lattice&) = delete;
+
+	// Exchanges spin configurations together with their running totals:
+	void swapConfiguration(Lattice& other);
+
+	inline int get(int x, int y, int z) const;
+	inline void set(int x, int y, int z, int state);
+
+	// States of the row along z, copied into buffer unless the layout keeps it contiguous:
+	inline const uint8_t* row(int x, int y, uint8_t* buffer) const;
+
+	// One byte per site, indexed as (x * sizeY + y) * sizeZ + z whatever the layout:
+	void copyStates(uint8_t* buffer) const;
+
+	inline void refreshParameters();
 
 	inline void metropolisStep();
-	void metropolisStepAt(int alteredX, int alteredY, int alteredZ, int randomNum);
 
+	// Returns whether the site changed, accepted null moves of small state graphs do not count:
+	bool metropolisStepAt(int alteredX, int alteredY, int alteredZ, int move,
+	                      RandomStream& stream, LatticeTotals& deltas);
+
+	// Energy change of setting the site to newState, see WangLandau.hpp:
+	double moveEnergy(int alteredX, int alteredY, int alteredZ, int newState) const;
+
+	// O(1) observables from the running totals:
+	inline double magnetization() const;
+	inline double energy() const;
+
+	// Full recomputation, returns the relative drift of the running totals:
+	double resyncTotals();
+
+	// Full scans through the SIMD kernels of Kernels.hpp:
 	double calculateMagnetization();
+	Vector calculateMoments();
 	double calculateEnergy();
+
+	// Sum of spin z-components and energy of the planes beginX..endX-1 only,
+	// bonds to plane endX included, see Domain.hpp:
+	double calculateSpinSum(int beginX, int endX);
+	double calculateEnergy(int beginX, int endX);
+
+	// Sites, random stream and running totals, see Checkpoint.hpp:
+	template <typename Archive>
+	void serialize(Archive& archive);
 };
 
-Lattice::Lattice(int latticeSizeX, int latticeSizeY, int latticeSizeZ,
-	             int (*getStateX) (int, int, int),
-                 int (*getStateY) (int, int, int)) : 
+template <typename Kind>
+Lattice<Kind>::Lattice(int latticeSizeX, int latticeSizeY, int latticeSizeZ,
+	                   int (*getStateX) (int, int, int, uint64_t),
+                       int (*getStateY) (int, int, int, uint64_t),
+	                   uint64_t rngSeed, const ModelParameters& modelParameters,
+	                   LayoutType layoutType) : 
 	sizeX (latticeSizeX),
 	sizeY (latticeSizeY),
 	sizeZ (latticeSizeZ),
+	sites (size_t(latticeSizeX) * latticeSizeY * latticeSizeZ),
+	parameters (modelParameters),
 	stateGraph (),
-	points (new LatticePoint[latticeSizeX * latticeSizeY * latticeSizeZ])
+	acceptance (stateGraph),
+	layout (latticeSizeX, latticeSizeY, latticeSizeZ, layoutType),
+	states (nullptr),
+	seed (rngSeed),
+	rng (rngSeed, 0),
+	totals ({0.0, 0.0}),
+	moves ({0, 0})
 {
+	if (Kind::DIMENSION == 2 && sizeZ != 1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Two-dimensional lattice must have sizeZ = 1\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (sites > UINT32_MAX)
+	{
+		fprintf(stderr, "[ISING-MODEL] Lattice with %zu sites is too large\n", sites);
+		exit(EXIT_FAILURE);
+	}
+
+	// Padding of tiled and Morton layouts stays zero and is never read:
+	states = new uint8_t[layout.capacity]();
+
 	for (int x = 0; x < sizeX; ++x) {
 	for (int y = 0; y < sizeY; ++y) {
 	for (int z = 0; z < sizeZ; ++z) {
-		points[(x * sizeY + y) * sizeZ + z].stateX = getStateX(x, y, z);
-		points[(x * sizeY + y) * sizeZ + z].stateY = getStateY(x, y, z);
+		set(x, y, z, getStateX(x, y, z, seed) * Kind::STATES_Y + getStateY(x, y, z, seed));
 	}}}
+
+	refreshParameters();
 }
 
-Lattice::~Lattice()
+template <typename Kind>
+Lattice<Kind>::~Lattice()
 {
-	delete[] points;
+	delete[] states;
 }
 
-inline LatticePoint& Lattice::get(int x, int y, int z)
+template <typename Kind>
+void Lattice<Kind>::swapConfiguration(Lattice& other)
 {
-	return points[(x * sizeY + y) * sizeZ + z];
+	assert(sizeX == other.sizeX && sizeY == other.sizeY && sizeZ == other.sizeZ);
+	assert(layout.offsetX == other.layout.offsetX && layout.offsetY == other.layout.offsetY &&
+	       layout.offsetZ == other.layout.offsetZ);
+
+	std::swap(states, other.states);
+	std::swap(totals, other.totals);
 }
 
-inline void Lattice::metropolisStep()
+template <typename Kind>
+template <typename Archive>
+void Lattice<Kind>::serialize(Archive& archive)
 {
-	static std::random_device rd;
-	static std::uniform_int_distribution<int> dist{0, 100 * sizeX * sizeY * sizeZ};
+	archive.bytes(states, layout.capacity);
+	archive.value(seed);
+	rng.serialize(archive);
+	archive.value(totals);
+}
 
-	int randomNum = dist(rd);
+template <typename Kind>
+inline int Lattice<Kind>::get(int x, int y, int z) const
+{
+	return states[layout.offset(x, y, z)];
+}
 
-	int alteredX = randomNum % sizeX;
-	randomNum /= sizeX;
-	int alteredY = randomNum % sizeY;
-	randomNum /= sizeY;
-	int alteredZ = randomNum % sizeZ;
-	randomNum /= sizeZ;
+template <typename Kind>
+inline void Lattice<Kind>::set(int x, int y, int z, int state)
+{
+	states[layout.offset(x, y, z)] = state;
+}
 
-	metropolisStepAt(alteredX, alteredY, alteredZ, randomNum);
+template <typename Kind>
+inline const uint8_t* Lattice<Kind>::row(int x, int y, uint8_t* buffer) const
+{
+	const uint8_t* base = states + layout.offsetX[x] + layout.offsetY[y];
+	if (layout.contiguousZ) return base;
+
+	const size_t* offsetZ = layout.offsetZ.data();
+	for (int z = 0; z < sizeZ; ++z)
+	{
+		buffer[z] = base[offsetZ[z]];
+	}
+
+	return buffer;
 }
-	
-void Lattice::metropolisStepAt(int alteredX, int alteredY, int alteredZ, int randomNum)
+
+// A non-contiguous row is gathered straight into the snapshot:
+template <typename Kind>
+void Lattice<Kind>::copyStates(uint8_t* buffer) const
 {
-	static std::random_device rd;
-	static std::mt19937 gen{rd()};
-	static std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	for (int x = 0; x < sizeX; ++x) {
+	for (int y = 0; y < sizeY; ++y) {
+		uint8_t* dest = buffer + (size_t(x) * sizeY + y) * sizeZ;
+
+		const uint8_t* source = row(x, y, dest);
+		if (source != dest) memcpy(dest, source, sizeZ);
+	}}
+}
+
+// Must be called before moves whenever parameters may have changed:
+template <typename Kind>
+inline void Lattice<Kind>::refreshParameters()
+{
+	if (!acceptance.stale(parameters)) return;
+
+	// Energy does not depend on temperature, so a temperature change keeps the totals valid:
+	bool energyChanged = acceptance.built.interactivity   != parameters.interactivity   ||
+	                     acceptance.built.externalField.x != parameters.externalField.x ||
+	                     acceptance.built.externalField.y != parameters.externalField.y ||
+	                     acceptance.built.externalField.z != parameters.externalField.z;
+
+	acceptance.rebuild(parameters);
+	if (energyChanged) resyncTotals();
+}
+
+template <typename Kind>
+inline void Lattice<Kind>::metropolisStep()
+{
+	refreshParameters();
+
+	// High half of the random word picks the site, the lowest bits pick the move:
+	uint64_t randomNum = rng.next();
 
+	uint32_t site = ((randomNum >> 32) * uint32_t(sites)) >> 32;
+
+	int alteredZ = site % sizeZ;
+	site /= sizeZ;
+	int alteredY = site % sizeY;
+	site /= sizeY;
+	int alteredX = site;
+
+	moves.attempted += 1;
+	moves.accepted  += metropolisStepAt(alteredX, alteredY, alteredZ, randomNum & 3, rng, totals);
+}
+
+template <typename Kind>
+bool Lattice<Kind>::metropolisStepAt(int alteredX, int alteredY, int alteredZ, int move,
+                                     RandomStream& stream, LatticeTotals& deltas)
+{
 	int lX = (alteredX == 0)? (sizeX - 1) : (alteredX - 1);
 	int uY = (alteredY == 0)? (sizeY - 1) : (alteredY - 1);
-	int tZ = (alteredZ == 0)? (sizeZ - 1) : (alteredZ - 1);
 	
 	int rX = (alteredX + 1) % sizeX;
 	int dY = (alteredY + 1) % sizeY;
-	int bZ = (alteredZ + 1) % sizeZ;
-
-	LatticePoint& alteredPoint = get(alteredX, alteredY, alteredZ);
-	LatticePoint  neighbourL   = get(      lX, alteredY, alteredZ);
-	LatticePoint  neighbourR   = get(      rX, alteredY, alteredZ);
-	LatticePoint  neighbourU   = get(alteredX,       uY, alteredZ);
-	LatticePoint  neighbourD   = get(alteredX,       dY, alteredZ);
-	LatticePoint  neighbourT   = get(alteredX, alteredY,       tZ);
-	LatticePoint  neighbourB   = get(alteredX, alteredY,       bZ);
-
-	Vector spinL = stateGraph.get(neighbourL.stateX, neighbourL.stateY);
-	Vector spinR = stateGraph.get(neighbourR.stateX, neighbourR.stateY);
-	Vector spinU = stateGraph.get(neighbourU.stateX, neighbourU.stateY);
-	Vector spinD = stateGraph.get(neighbourD.stateX, neighbourD.stateY);
-	Vector spinT = stateGraph.get(neighbourT.stateX, neighbourT.stateY);
-	Vector spinB = stateGraph.get(neighbourB.stateX, neighbourB.stateY);
-	Vector interactionVector = (spinL + spinR + spinU + spinD + spinT + spinB) * interactivity +
-	                           externalField;
-
-	int newStateX = alteredPoint.stateX;
-	int newStateY = alteredPoint.stateY;
-	switch (randomNum % 4)
+
+	size_t offX = layout.offsetX[alteredX];
+	size_t offY = layout.offsetY[alteredY];
+	size_t offZ = layout.offsetZ[alteredZ];
+
+	// Neighbours in L, R, U, D, T, B order, the last two only in three dimensions:
+	uint8_t& alteredState = states[offX + offY + offZ];
+	int neighbours[Kind::NEIGHBOURS];
+	neighbours[0] = states[layout.offsetX[lX] + offY + offZ];
+	neighbours[1] = states[layout.offsetX[rX] + offY + offZ];
+	neighbours[2] = states[offX + layout.offsetY[uY] + offZ];
+	neighbours[3] = states[offX + layout.offsetY[dY] + offZ];
+
+	if constexpr (Kind::DIMENSION == 3)
 	{
-		case 0:
-		{
-			newStateX = (newStateX + 1) % STATE_GRAPH_SIZE_X;
-			break;
-		}
-		case 1:
-		{
-			if (newStateX == 0) newStateX = STATE_GRAPH_SIZE_X - 1;
-			else                newStateX = newStateX - 1;
-			break;
-		}
-		case 2:
+		int tZ = (alteredZ == 0)? (sizeZ - 1) : (alteredZ - 1);
+		int bZ = (alteredZ + 1) % sizeZ;
+
+		neighbours[4] = states[offX + offY + layout.offsetZ[tZ]];
+		neighbours[5] = states[offX + offY + layout.offsetZ[bZ]];
+	}
+
+	int curState = alteredState;
+	int newState = acceptance.newState[curState][move];
+
+	// Table lookup instead of energy evaluation; the caller keeps the table fresh:
+	if (acceptance.enabled)
+	{
+		int code = 0;
+		for (int neighbour : neighbours)
 		{
-			newStateY = (newStateY + 1) % STATE_GRAPH_SIZE_Y;
-			break;
+			code += acceptance.codeOf[neighbour];
 		}
-		case 3:
+
+		size_t entry = acceptance.entry(code, curState, move);
+
+		double acceptanceRatio = acceptance.probability[entry];
+		if (acceptanceRatio > 1.0 || stream.uniform() < acceptanceRatio)
 		{
-			if (newStateY == 0) newStateY = STATE_GRAPH_SIZE_Y - 1;
-			else                newStateY = newStateY - 1;
-			break;
+			alteredState = newState;
+
+			deltas.magnetization += acceptance.deltaMagnetization[curState][move];
+			deltas.energy        += acceptance.deltaEnergy[entry];
+			return newState != curState;
 		}
+		return false;
 	}
 
-	Vector curSpin = stateGraph.get(alteredPoint.stateX, alteredPoint.stateY);
-	Vector nxtSpin = stateGraph.get(          newStateX,           newStateY);
+	Vector neighbourSum(0.0, 0.0, 0.0);
+	for (int neighbour : neighbours)
+	{
+		neighbourSum += stateGraph.spins[neighbour];
+	}
+	Vector interactionVector = neighbourSum * parameters.interactivity + parameters.externalField;
+
+	Vector curSpin = stateGraph.spins[curState];
+	Vector nxtSpin = stateGraph.spins[newState];
 
 	double curEnergy = -curSpin.scalar(interactionVector);
 	double nxtEnergy = -nxtSpin.scalar(interactionVector);
 
-	if (curEnergy > nxtEnergy)
+	if (curEnergy > nxtEnergy || stream.uniform() < exp((curEnergy - nxtEnergy) / parameters.temperature))
 	{
-		alteredPoint.stateX = newStateX;
-		alteredPoint.stateY = newStateY;
-		return;
+		alteredState = newState;
+
+		deltas.magnetization += nxtSpin.z - curSpin.z;
+		deltas.energy        += nxtEnergy - curEnergy;
+		return newState != curState;
 	}
 
-	double acceptanceRatio = exp((curEnergy - nxtEnergy) / temperature);
-	double toss = distribution(gen);
+	return false;
+}
 
-	if (toss < acceptanceRatio)
+template <typename Kind>
+double Lattice<Kind>::moveEnergy(int alteredX, int alteredY, int alteredZ, int newState) const
+{
+	Vector neighbourSum = stateGraph.spins[get((alteredX == 0)? (sizeX - 1) : (alteredX - 1), alteredY, alteredZ)] +
+	                      stateGraph.spins[get((alteredX + 1) % sizeX,                      alteredY, alteredZ)] +
+	                      stateGraph.spins[get(alteredX, (alteredY == 0)? (sizeY - 1) : (alteredY - 1), alteredZ)] +
+	                      stateGraph.spins[get(alteredX, (alteredY + 1) % sizeY,                       alteredZ)];
+
+	if constexpr (Kind::DIMENSION == 3)
 	{
-		alteredPoint.stateX = newStateX;
-		alteredPoint.stateY = newStateY;
+		neighbourSum += stateGraph.spins[get(alteredX, alteredY, (alteredZ == 0)? (sizeZ - 1) : (alteredZ - 1))];
+		neighbourSum += stateGraph.spins[get(alteredX, alteredY, (alteredZ + 1) % sizeZ)];
 	}
+
+	Vector interactionVector = neighbourSum * parameters.interactivity + parameters.externalField;
+
+	return -(stateGraph.spins[newState] - stateGraph.spins[get(alteredX, alteredY, alteredZ)]).scalar(interactionVector);
+}
+
+template <typename Kind>
+inline double Lattice<Kind>::magnetization() const
+{
+	return totals.magnetization / sites;
+}
+
+template <typename Kind>
+inline double Lattice<Kind>::energy() const
+{
+	return totals.energy;
+}
+
+template <typename Kind>
+double Lattice<Kind>::resyncTotals()
+{
+	LatticeTotals exact = {calculateMagnetization() * sites, calculateEnergy()};
+
+	// Magnetization may legitimately be zero, so its drift is relative to the number of sites:
+	double drift = std::max(std::abs(exact.magnetization - totals.magnetization) / sites,
+	                        std::abs(exact.energy - totals.energy) / std::max(std::abs(exact.energy), 1e-300));
+
+	totals = exact;
+
+	return drift;
+}
+
+template <typename Kind>
+double Lattice<Kind>::calculateMagnetization()
+{
+	return calculateSpinSum(0, sizeX) / sites;
+}
+
+template <typename Kind>
+double Lattice<Kind>::calculateSpinSum(int beginX, int endX)
+{
+	const ObservableKernels& kernels = observableKernels();
+	std::vector<uint8_t> buffer(sizeZ);
+
+	double spinSum = 0.0;
+
+	for (int x = beginX; x < endX; ++x) {
+	for (int y = 0; y < sizeY; ++y) {
+		spinSum += kernels.tableSum(row(x, y, buffer.data()), sizeZ, Kind::StateGraph::SPIN_Z.data());
+	}}
+
+	return spinSum;
 }
 
-double Lattice::calculateMagnetization()
+// Mean spin along every axis:
+template <typename Kind>
+Vector Lattice<Kind>::calculateMoments()
 {
-	double magnetization = 0.0;
+	const ObservableKernels& kernels = observableKernels();
+	std::vector<uint8_t> buffer(sizeZ);
+
+	Vector moments(0.0, 0.0, 0.0);
 
 	for (int x = 0; x < sizeX; ++x) {
 	for (int y = 0; y < sizeY; ++y) {
-	for (int z = 0; z < sizeZ; ++z) {
-		LatticePoint curPoint = get(x, y, z);
-		Vector spin = stateGraph.get(curPoint.stateX, curPoint.stateY);
+		const uint8_t* cur = row(x, y, buffer.data());
 
-		magnetization += spin.z;
-	}}}
-	
-	magnetization /= sizeX*sizeY*sizeZ;
+		moments.x += kernels.tableSum(cur, sizeZ, Kind::StateGraph::SPIN_X.data());
+		moments.y += kernels.tableSum(cur, sizeZ, Kind::StateGraph::SPIN_Y.data());
+		moments.z += kernels.tableSum(cur, sizeZ, Kind::StateGraph::SPIN_Z.data());
+	}}
 
-	return magnetization;
+	return moments / sites;
 }
 
-double Lattice::calculateEnergy()
+template <typename Kind>
+double Lattice<Kind>::calculateEnergy()
 {
-	double energy = 0.0;
+	return calculateEnergy(0, sizeX);
+}
 
-	for (int x = 0; x < sizeX; ++x) {
+// Sums bonds to the R, D and (in 3D) B neighbours of every row:
+template <typename Kind>
+double Lattice<Kind>::calculateEnergy(int beginX, int endX)
+{
+	const ObservableKernels& kernels = observableKernels();
+	std::vector<uint8_t> bufferCur(sizeZ), bufferR(sizeZ), bufferD(sizeZ);
+
+	// Spin products of every pair of states and field energies of every state:
+	double bondTable [Kind::STATES * Kind::STATES];
+	double fieldTable[Kind::STATES];
+	for (int a = 0; a < Kind::STATES; ++a)
+	{
+		for (int b = 0; b < Kind::STATES; ++b)
+		{
+			bondTable[a * Kind::STATES + b] = stateGraph.spins[a].scalar(stateGraph.spins[b]);
+		}
+
+		fieldTable[a] = stateGraph.spins[a].scalar(parameters.externalField);
+	}
+
+	double bonds  = 0.0;
+	double fields = 0.0;
+
+	for (int x = beginX; x < endX; ++x) {
 	for (int y = 0; y < sizeY; ++y) {
-	for (int z = 0; z < sizeY; ++z) {
-		LatticePoint& cur        = get(              x,               y,               z);
-		LatticePoint& neighbourR = get((x + 1) % sizeX,               y,               z);
-		LatticePoint& neighbourD = get(              x, (y + 1) % sizeY,               z);
-		LatticePoint& neighbourB = get(              x,               y, (z + 1) % sizeZ);
-
-		Vector spin  = stateGraph.get(       cur.stateX,        cur.stateY);
-		Vector spinR = stateGraph.get(neighbourR.stateX, neighbourR.stateY);
-		Vector spinD = stateGraph.get(neighbourD.stateX, neighbourD.stateY);
-		Vector spinB = stateGraph.get(neighbourB.stateX, neighbourB.stateY);	
-
-		energy -= spin.scalar((spinR + spinD + spinB) * interactivity + externalField);
-	}}}
+		const uint8_t* cur  = row(              x,               y, bufferCur.data());
+		const uint8_t* rowR = row((x + 1) % sizeX,               y,   bufferR.data());
+		const uint8_t* rowD = row(              x, (y + 1) % sizeY,   bufferD.data());
+
+		bonds += kernels.pairSum(cur, rowR, sizeZ, bondTable, Kind::STATES);
+		bonds += kernels.pairSum(cur, rowD, sizeZ, bondTable, Kind::STATES);
+
+		if constexpr (Kind::DIMENSION == 3)
+		{
+			bonds += kernels.pairSum(cur, cur + 1, sizeZ - 1, bondTable, Kind::STATES);
+			bonds += bondTable[cur[sizeZ - 1] * Kind::STATES + cur[0]];
+		}
+
+		fields += kernels.tableSum(cur, sizeZ, fieldTable);
+	}}
 
-	return energy;
+	return -(parameters.interactivity * bonds + fields);
 }
 
 #endif  // POTTS_MODEL_MODEL_HPP_INCLUDED
\ No newline at end of file
@@ -0,0 +1,54 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_MODEL_KIND_HPP_INCLUDED
+#define POTTS_MODEL_MODEL_KIND_HPP_INCLUDED
+
+#include "StateGraph.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Compile-time description of a model: state graph size and lattice dimension.
+// Lattices and update engines are templates over a kind, so every kind gets
+// its own kernels with constant state counts and neighbour loops.
+// A two-dimensional lattice is an (x, y) lattice with sizeZ = 1 and no z-bonds.
+template <int GRAPH_SIZE_X, int GRAPH_SIZE_Y, int LATTICE_DIMENSION>
+struct ModelKind
+{
+	static constexpr int STATES_X   = GRAPH_SIZE_X;
+	static constexpr int STATES_Y   = GRAPH_SIZE_Y;
+	static constexpr int STATES     = GRAPH_SIZE_X * GRAPH_SIZE_Y;
+	static constexpr int DIMENSION  = LATTICE_DIMENSION;
+	static constexpr int NEIGHBOURS = 2 * LATTICE_DIMENSION;
+
+	static_assert(DIMENSION == 2 || DIMENSION == 3, "Only square and cubic lattices are supported");
+
+	using StateGraph = FibonacciSpinStateGraph<GRAPH_SIZE_X, GRAPH_SIZE_Y>;
+};
+
+// Calls function(ModelKind<...>()) for the precompiled kind matching the config.
+// New kinds are added to this list:
+template <typename Function>
+void dispatch_model_kind(int statesX, int statesY, int dimension, Function function)
+{
+	#define DISPATCH_MODEL_KIND(SIZE_X, SIZE_Y, DIMENSION)                              \
+		if (statesX == SIZE_X && statesY == SIZE_Y && dimension == DIMENSION)          \
+		{                                                                             \
+			function(ModelKind<SIZE_X, SIZE_Y, DIMENSION>());                         \
+			return;                                                                   \
+		}
+
+	DISPATCH_MODEL_KIND(1, 2, 3)
+	DISPATCH_MODEL_KIND(1, 2, 2)
+	DISPATCH_MODEL_KIND(1, 3, 3)
+	DISPATCH_MODEL_KIND(1, 3, 2)
+	DISPATCH_MODEL_KIND(4, 4, 3)
+	DISPATCH_MODEL_KIND(4, 4, 2)
+
+	#undef DISPATCH_MODEL_KIND
+
+	fprintf(stderr, "[ISING-MODEL] No precompiled model for a %dx%d state graph on a %dD lattice "
+	                "(available: 1x2, 1x3, 4x4 in 2D and 3D)\n", statesX, statesY, dimension);
+	exit(EXIT_FAILURE);
+}
+
+#endif  // POTTS_MODEL_MODEL_KIND_HPP_INCLUDED
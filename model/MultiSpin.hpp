@@ -0,0 +1,414 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_MULTI_SPIN_HPP_INCLUDED
+#define POTTS_MODEL_MULTI_SPIN_HPP_INCLUDED
+
+#include "ModelKind.hpp"
+#include "Parameters.hpp"
+#include "Random.hpp"
+#include "ThreadPool.hpp"
+#include "Metrics.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// ========================================================================
+// Bit-sliced Metropolis Acceptance
+// ========================================================================
+
+// Metropolis test of 64 independent two-state lanes at once, shared by the
+// bit-packed engines (this one and ReplicaLattice of Replicas.hpp).
+// A lane is classified by its state c and the number k of its neighbours also in state c,
+// its flip is accepted outright or if its 32-bit uniform is below the class threshold:
+template <typename Kind>
+struct BitSlicedMetropolis
+{
+	static_assert(Kind::STATES == 2, "Bit-sliced acceptance requires a two-state graph");
+
+	static constexpr int NEIGHBOURS = Kind::NEIGHBOURS;
+
+	uint64_t alwaysAccept[2][NEIGHBOURS + 1];
+	uint32_t thresholds  [2][NEIGHBOURS + 1];
+
+	void computeThresholds(const typename Kind::StateGraph& stateGraph, const ModelParameters& parameters);
+
+	// Lanes of proposed that flip. The aligned neighbour count of every lane is
+	// given bit-sliced in (bit0, bit1, bit2), uniforms are drawn from stream:
+	inline uint64_t accept(uint64_t spins, uint64_t bit0, uint64_t bit1, uint64_t bit2, uint64_t proposed,
+	                       RandomStream& stream) const;
+};
+
+template <typename Kind>
+void BitSlicedMetropolis<Kind>::computeThresholds(const typename Kind::StateGraph& stateGraph,
+                                                  const ModelParameters& parameters)
+{
+	Vector spins[2] = {stateGraph.spins[0], stateGraph.spins[1]};
+
+	for (int cur = 0; cur < 2; ++cur)
+	{
+		for (int aligned = 0; aligned <= NEIGHBOURS; ++aligned)
+		{
+			Vector neighbourSum = spins[cur] * aligned + spins[1 - cur] * (NEIGHBOURS - aligned);
+			Vector interactionVector = neighbourSum * parameters.interactivity + parameters.externalField;
+
+			double deltaEnergy = -(spins[1 - cur] - spins[cur]).scalar(interactionVector);
+
+			alwaysAccept[cur][aligned] = (deltaEnergy <= 0.0)? ~0ull : 0ull;
+			thresholds  [cur][aligned] = (deltaEnergy <= 0.0)? 0 :
+			                             uint32_t(exp(-deltaEnergy / parameters.temperature) * 0x1.0p32);
+		}
+	}
+}
+
+template <typename Kind>
+inline uint64_t BitSlicedMetropolis<Kind>::accept(uint64_t spins, uint64_t bit0, uint64_t bit1, uint64_t bit2,
+                                                  uint64_t proposed, RandomStream& stream) const
+{
+	// Lanes of every (state, aligned count) class:
+	uint64_t classes[2][NEIGHBOURS + 1];
+	for (int aligned = 0; aligned <= NEIGHBOURS; ++aligned)
+	{
+		uint64_t countMask = ((aligned & 1)? bit0 : ~bit0) &
+		                     ((aligned & 2)? bit1 : ~bit1) &
+		                     ((aligned & 4)? bit2 : ~bit2);
+
+		classes[0][aligned] = ~spins & countMask;
+		classes[1][aligned] =  spins & countMask;
+	}
+
+	uint64_t accepted = 0;
+	for (int state = 0; state < 2; ++state)
+	{
+		for (int aligned = 0; aligned <= NEIGHBOURS; ++aligned)
+		{
+			accepted |= classes[state][aligned] & alwaysAccept[state][aligned];
+		}
+	}
+	accepted &= proposed;
+
+	// Lane accepts iff its 32-bit uniform is below its threshold.
+	// Compare from the most significant bit until every lane has differed:
+	uint64_t undecided = proposed & ~accepted;
+	for (int bit = 31; bit >= 0 && undecided != 0; --bit)
+	{
+		uint64_t thresholdBits = 0;
+		for (int state = 0; state < 2; ++state)
+		{
+			for (int aligned = 0; aligned <= NEIGHBOURS; ++aligned)
+			{
+				if ((thresholds[state][aligned] >> bit) & 1) thresholdBits |= classes[state][aligned];
+			}
+		}
+
+		uint64_t randomBits = stream.next();
+
+		accepted  |= undecided & ~randomBits & thresholdBits;
+		undecided &= ~(randomBits ^ thresholdBits);
+	}
+
+	return accepted;
+}
+
+// ========================================================================
+// Multi-spin Coded Lattice
+// ========================================================================
+
+// Multi-spin coding engine for state graphs with exactly two states.
+// A spin is one bit (the state index), rows along z are packed into 64-bit words.
+// Sites are updated by checkerboard sweeps with all 64 lanes of a word evaluated
+// by bitwise logic: neighbour agreement is counted by bit-sliced adders and the
+// Metropolis toss compares bit-sliced random numbers against per-lane thresholds.
+// As in Lattice::metropolisStepAt for a two-state graph, half of the proposals are
+// null moves, so one sweep corresponds to one checkerboard sweep of Lattice.
+template <typename Kind>
+struct MultiSpinLattice
+{
+	static_assert(Kind::STATES == 2 && Kind::DIMENSION == 3,
+	              "Multi-spin coding requires a two-state graph on a cubic lattice");
+
+	static constexpr int NEIGHBOURS = Kind::NEIGHBOURS;
+
+	int sizeX, sizeY, sizeZ;
+	int wordsPerRow;
+	uint64_t lastWordMask;
+	ModelParameters parameters;
+	typename Kind::StateGraph stateGraph;
+	uint64_t* words;
+	uint64_t seed;
+	ThreadPool& pool;
+	std::vector<RandomStream> planeStreams;
+	std::vector<MoveCounters> planeMoves;
+	MoveCounters moves; // Not part of the state, see Metrics.hpp
+	BitSlicedMetropolis<Kind> acceptance;
+
+	MultiSpinLattice(int latticeSizeX, int latticeSizeY, int latticeSizeZ,
+	                 int (*getStateX) (int, int, int, uint64_t),
+	                 int (*getStateY) (int, int, int, uint64_t),
+	                 uint64_t rngSeed, const ModelParameters& modelParameters,
+	                 ThreadPool& threadPool);
+
+	~MultiSpinLattice();
+
+	MultiSpinLattice(const MultiSpinLattice&) = delete;
+	MultiSpinLattice& operator=(const MultiSpinLattice&) = delete;
+
+	inline uint64_t* row(int x, int y);
+	inline int getState(int x, int y, int z);
+
+	// One byte per site, as Lattice::copyStates:
+	void copyStates(uint8_t* buffer);
+
+	void sweep();
+	void halfSweep(int parity);
+	void updateRow(int x, int y, int parity, RandomStream& stream, uint64_t* zPrev, uint64_t* zNext,
+	               MoveCounters& moveCount);
+
+	// Observables are counted from the bits directly, which is cheap enough
+	// to need no running totals, so there is nothing to drift:
+	inline double magnetization() { return calculateMagnetization(); }
+	inline double energy()        { return calculateEnergy(); }
+	inline double resyncTotals()  { return 0.0; }
+
+	double calculateMagnetization();
+	double calculateEnergy();
+
+	template <typename Archive>
+	void serialize(Archive& archive);
+};
+
+template <typename Kind>
+MultiSpinLattice<Kind>::MultiSpinLattice(int latticeSizeX, int latticeSizeY, int latticeSizeZ,
+                                         int (*getStateX) (int, int, int, uint64_t),
+                                         int (*getStateY) (int, int, int, uint64_t),
+                                         uint64_t rngSeed, const ModelParameters& modelParameters,
+                                         ThreadPool& threadPool) :
+	sizeX        (latticeSizeX),
+	sizeY        (latticeSizeY),
+	sizeZ        (latticeSizeZ),
+	wordsPerRow  ((latticeSizeZ + 63) / 64),
+	lastWordMask ((latticeSizeZ % 64 == 0)? ~0ull : (1ull << (latticeSizeZ % 64)) - 1),
+	parameters   (modelParameters),
+	stateGraph   (),
+	words        (new uint64_t[latticeSizeX * latticeSizeY * ((latticeSizeZ + 63) / 64)]()),
+	seed         (rngSeed),
+	pool         (threadPool),
+	planeStreams (),
+	planeMoves   (latticeSizeX),
+	moves        ({0, 0}),
+	acceptance   ()
+{
+	if (sizeX % 2 != 0 || sizeY % 2 != 0 || sizeZ % 2 != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Checkerboard sweep requires even lattice sizes\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int x = 0; x < sizeX; ++x) {
+	for (int y = 0; y < sizeY; ++y) {
+	for (int z = 0; z < sizeZ; ++z) {
+		uint64_t state = getStateX(x, y, z, seed) * Kind::STATES_Y + getStateY(x, y, z, seed);
+		row(x, y)[z / 64] |= state << (z % 64);
+	}}}
+
+	// Same stream numbering as CheckerboardSweep:
+	planeStreams.reserve(sizeX);
+	for (int x = 0; x < sizeX; ++x)
+	{
+		planeStreams.emplace_back(seed, 1 + x);
+	}
+}
+
+template <typename Kind>
+MultiSpinLattice<Kind>::~MultiSpinLattice()
+{
+	delete[] words;
+}
+
+template <typename Kind>
+template <typename Archive>
+void MultiSpinLattice<Kind>::serialize(Archive& archive)
+{
+	archive.bytes(words, size_t(sizeX) * sizeY * wordsPerRow * sizeof(uint64_t));
+	archive.value(seed);
+
+	for (RandomStream& stream : planeStreams)
+	{
+		stream.serialize(archive);
+	}
+}
+
+template <typename Kind>
+inline uint64_t* MultiSpinLattice<Kind>::row(int x, int y)
+{
+	return words + (x * sizeY + y) * wordsPerRow;
+}
+
+template <typename Kind>
+inline int MultiSpinLattice<Kind>::getState(int x, int y, int z)
+{
+	return (row(x, y)[z / 64] >> (z % 64)) & 1;
+}
+
+template <typename Kind>
+void MultiSpinLattice<Kind>::copyStates(uint8_t* buffer)
+{
+	for (int x = 0; x < sizeX; ++x) {
+	for (int y = 0; y < sizeY; ++y) {
+	for (int z = 0; z < sizeZ; ++z) {
+		*buffer++ = getState(x, y, z);
+	}}}
+}
+
+template <typename Kind>
+void MultiSpinLattice<Kind>::sweep()
+{
+	acceptance.computeThresholds(stateGraph, parameters);
+
+	halfSweep(0);
+	halfSweep(1);
+}
+
+template <typename Kind>
+void MultiSpinLattice<Kind>::halfSweep(int parity)
+{
+	pool.run(sizeX, [this, parity](size_t task, size_t /* worker */)
+	{
+		std::vector<uint64_t> scratch(2 * wordsPerRow);
+		planeMoves[task] = {0, 0};
+
+		for (int y = 0; y < sizeY; ++y)
+		{
+			updateRow(task, y, parity, planeStreams[task], scratch.data(), scratch.data() + wordsPerRow,
+			          planeMoves[task]);
+		}
+	});
+
+	for (const MoveCounters& planeCount : planeMoves)
+	{
+		moves.attempted += planeCount.attempted;
+		moves.accepted  += planeCount.accepted;
+	}
+}
+
+template <typename Kind>
+void MultiSpinLattice<Kind>::updateRow(int x, int y, int parity, RandomStream& stream, uint64_t* zPrev, uint64_t* zNext,
+                                       MoveCounters& moveCount)
+{
+	uint64_t* cur = row(x, y);
+	uint64_t* xL  = row((x == 0)? (sizeX - 1) : (x - 1), y);
+	uint64_t* xR  = row((x + 1) % sizeX, y);
+	uint64_t* yU  = row(x, (y == 0)? (sizeY - 1) : (y - 1));
+	uint64_t* yD  = row(x, (y + 1) % sizeY);
+
+	// Neighbours along z are the row itself shifted by one bit with periodic wrap:
+	int last = sizeZ - 1;
+	for (int w = 0; w < wordsPerRow; ++w)
+	{
+		zPrev[w] = (cur[w] << 1) | ((w > 0)?               cur[w - 1] >> 63 : 0);
+		zNext[w] = (cur[w] >> 1) | ((w < wordsPerRow - 1)? cur[w + 1] << 63 : 0);
+	}
+	zPrev[0]        = (zPrev[0] & ~1ull)                | ((cur[last / 64] >> (last % 64)) & 1);
+	zNext[last / 64] = (zNext[last / 64] & ~(1ull << (last % 64))) | ((cur[0] & 1) << (last % 64));
+
+	uint64_t colourMask = ((x + y + parity) % 2 == 0)? 0x5555555555555555ull : 0xAAAAAAAAAAAAAAAAull;
+
+	for (int w = 0; w < wordsPerRow; ++w)
+	{
+		uint64_t spins = cur[w];
+
+		// Bit-sliced count of neighbours in the same state as the site:
+		uint64_t a1 = ~(spins ^ xL[w]);
+		uint64_t a2 = ~(spins ^ xR[w]);
+		uint64_t a3 = ~(spins ^ yU[w]);
+		uint64_t a4 = ~(spins ^ yD[w]);
+		uint64_t a5 = ~(spins ^ zPrev[w]);
+		uint64_t a6 = ~(spins ^ zNext[w]);
+
+		uint64_t sumA   = a1 ^ a2 ^ a3;
+		uint64_t carryA = (a1 & a2) | (a3 & (a1 ^ a2));
+		uint64_t sumB   = a4 ^ a5 ^ a6;
+		uint64_t carryB = (a4 & a5) | (a6 & (a4 ^ a5));
+
+		uint64_t bit0   = sumA ^ sumB;
+		uint64_t carry0 = sumA & sumB;
+		uint64_t bit1   = carryA ^ carryB ^ carry0;
+		uint64_t bit2   = (carryA & carryB) | (carry0 & (carryA ^ carryB));
+
+		uint64_t proposed = colourMask & stream.next();
+		if (w == wordsPerRow - 1) proposed &= lastWordMask;
+
+		uint64_t accepted = acceptance.accept(spins, bit0, bit1, bit2, proposed, stream);
+
+		cur[w] = spins ^ accepted;
+
+		// Every site of the colour is one attempt, null moves included, as in Lattice:
+		uint64_t valid = (w == wordsPerRow - 1)? lastWordMask : ~0ull;
+		moveCount.attempted += __builtin_popcountll(colourMask & valid);
+		moveCount.accepted  += __builtin_popcountll(accepted);
+	}
+}
+
+template <typename Kind>
+double MultiSpinLattice<Kind>::calculateMagnetization()
+{
+	size_t ones = 0;
+	for (int i = 0; i < sizeX * sizeY * wordsPerRow; ++i)
+	{
+		ones += __builtin_popcountll(words[i]);
+	}
+
+	size_t sites = size_t(sizeX) * sizeY * sizeZ;
+	double magnetization = (sites - ones) * stateGraph.spins[0].z + ones * stateGraph.spins[1].z;
+
+	return magnetization / sites;
+}
+
+template <typename Kind>
+double MultiSpinLattice<Kind>::calculateEnergy()
+{
+	// Count bonds of every kind along the R, D and B directions, as Lattice::calculateEnergy does:
+	size_t bonds00 = 0, bonds11 = 0, bonds01 = 0, ones = 0;
+	std::vector<uint64_t> zPrev(wordsPerRow), zNext(wordsPerRow);
+
+	for (int x = 0; x < sizeX; ++x) {
+	for (int y = 0; y < sizeY; ++y) {
+		uint64_t* cur = row(x, y);
+		uint64_t* xR  = row((x + 1) % sizeX, y);
+		uint64_t* yD  = row(x, (y + 1) % sizeY);
+
+		int last = sizeZ - 1;
+		for (int w = 0; w < wordsPerRow; ++w)
+		{
+			zNext[w] = (cur[w] >> 1) | ((w < wordsPerRow - 1)? cur[w + 1] << 63 : 0);
+		}
+		zNext[last / 64] = (zNext[last / 64] & ~(1ull << (last % 64))) | ((cur[0] & 1) << (last % 64));
+
+		for (int w = 0; w < wordsPerRow; ++w)
+		{
+			uint64_t valid = (w == wordsPerRow - 1)? lastWordMask : ~0ull;
+			uint64_t neighbours[3] = {xR[w], yD[w], zNext[w]};
+
+			for (uint64_t neighbour : neighbours)
+			{
+				bonds11 += __builtin_popcountll( cur[w] &  neighbour & valid);
+				bonds00 += __builtin_popcountll(~cur[w] & ~neighbour & valid);
+				bonds01 += __builtin_popcountll((cur[w] ^  neighbour) & valid);
+			}
+
+			ones += __builtin_popcountll(cur[w] & valid);
+		}
+	}}
+
+	size_t sites = size_t(sizeX) * sizeY * sizeZ;
+	Vector spin0 = stateGraph.spins[0];
+	Vector spin1 = stateGraph.spins[1];
+
+	double energy = -parameters.interactivity * (bonds00 * spin0.scalar(spin0) +
+	                                  bonds11 * spin1.scalar(spin1) +
+	                                  bonds01 * spin0.scalar(spin1));
+	energy -= (sites - ones) * spin0.scalar(parameters.externalField) +
+	                   ones  * spin1.scalar(parameters.externalField);
+
+	return energy;
+}
+
+#endif  // POTTS_MODEL_MULTI_SPIN_HPP_INCLUDED
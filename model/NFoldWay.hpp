@@ -0,0 +1,400 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_N_FOLD_WAY_HPP_INCLUDED
+#define POTTS_MODEL_N_FOLD_WAY_HPP_INCLUDED
+
+#include "Model.hpp"
+
+#include <cmath>
+#include <vector>
+
+// Rejection-free n-fold way (Bortz-Kalos-Lebowitz) engine, the same stochastic process
+// as Lattice::metropolisStep with the rejected attempts skipped.
+// The class of a site is its state and its neighbour code in the acceptance table,
+// which fix the rate at which metropolisStep changes the site:
+//   rate = sum over moves of 1/4 * min(1, acceptance), null moves left out.
+// Sites are kept in per-class lists and a Fenwick tree sums the rates of the classes,
+// so every event picks a class, a site of it and a move, and always changes the lattice.
+// Time is counted in metropolisStep attempts: an attempt changes the lattice with
+// probability Q = (total rate) / sites, so the attempts up to the next event are drawn
+// from the geometric distribution with mean 1 / Q. A sample covers mc_iters_per_sample
+// attempts, as for the metropolis engine, however few events that takes.
+template <typename Kind>
+struct NFoldWay
+{
+	static constexpr int STATES     = Kind::STATES;
+	static constexpr int MOVES      = AcceptanceTable<Kind>::MOVES;
+	static constexpr int NEIGHBOURS = Kind::NEIGHBOURS;
+
+	Lattice<Kind>& lattice;
+	size_t sites;
+	size_t classes; // Neighbour codes times states
+
+	// Per site, sites numbered as in Lattice::metropolisStep:
+	std::vector<uint32_t> classOf;
+	std::vector<uint32_t> slotOf; // Position in the list of the class
+
+	// Per class:
+	std::vector<std::vector<uint32_t>> members;
+	std::vector<double> classRate; // Of a single site
+	std::vector<double> moveRates; // classes x MOVES
+
+	// Fenwick tree over members[class].size() * classRate[class]:
+	std::vector<double> tree;
+	size_t treeStep; // Largest power of two not above the number of classes
+	size_t eventsSinceRebuild;
+
+	ModelParameters built;
+	double pendingAttempts; // Attempts left until the next event
+
+	NFoldWay(Lattice<Kind>& updatedLattice);
+
+	inline uint32_t siteId(int x, int y, int z) const;
+	inline void siteCoords(uint32_t id, int& x, int& y, int& z) const;
+	inline void neighbourSites(uint32_t id, uint32_t (&neighbours)[NEIGHBOURS]) const;
+
+	// Recomputes the rates after a change of the parameters and redraws the waiting time:
+	void prepare();
+
+	// Leave the random stream alone, returns whether the rates changed:
+	bool rebuildRates();
+	void rebuildClasses();
+	void rebuildTree();
+
+	inline void treeAdd(size_t cls, double delta);
+	inline double totalRate() const;
+	inline void moveSite(uint32_t id, uint32_t newClass);
+
+	inline double drawAttempts();
+	void event();
+
+	// Moves the lattice by the given number of metropolisStep attempts:
+	void advance(uint64_t attempts);
+
+	// The order of the class lists and the incrementally updated tree decide the next events,
+	// so both are stored as they are rather than rebuilt from the lattice:
+	template <typename Archive>
+	void serialize(Archive& archive);
+};
+
+template <typename Kind>
+NFoldWay<Kind>::NFoldWay(Lattice<Kind>& updatedLattice) :
+	lattice            (updatedLattice),
+	sites              (updatedLattice.sites),
+	classes            (size_t(updatedLattice.acceptance.neighbourCodes) * STATES),
+	classOf            (updatedLattice.sites),
+	slotOf             (updatedLattice.sites),
+	members            (classes),
+	classRate          (classes, 0.0),
+	moveRates          (classes * MOVES, 0.0),
+	tree               (classes + 1, 0.0),
+	treeStep           (1),
+	eventsSinceRebuild (0),
+	built              ({NAN, Vector(NAN, NAN, NAN), NAN}),
+	pendingAttempts    (INFINITY)
+{
+	if (!lattice.acceptance.enabled)
+	{
+		fprintf(stderr, "[ISING-MODEL] The n-fold way engine requires an acceptance table, "
+		                "which is too large for this state graph\n");
+		exit(EXIT_FAILURE);
+	}
+
+	while (2 * treeStep <= classes) treeStep *= 2;
+
+	rebuildClasses();
+	prepare();
+}
+
+template <typename Kind>
+inline uint32_t NFoldWay<Kind>::siteId(int x, int y, int z) const
+{
+	return (uint32_t(x) * lattice.sizeY + y) * lattice.sizeZ + z;
+}
+
+template <typename Kind>
+inline void NFoldWay<Kind>::siteCoords(uint32_t id, int& x, int& y, int& z) const
+{
+	z = id % lattice.sizeZ;
+	id /= lattice.sizeZ;
+	y = id % lattice.sizeY;
+	x = id / lattice.sizeY;
+}
+
+// Neighbours in the order of Lattice::metropolisStepAt:
+template <typename Kind>
+inline void NFoldWay<Kind>::neighbourSites(uint32_t id, uint32_t (&neighbours)[NEIGHBOURS]) const
+{
+	int x, y, z;
+	siteCoords(id, x, y, z);
+
+	neighbours[0] = siteId((x == 0)? lattice.sizeX - 1 : x - 1, y, z);
+	neighbours[1] = siteId((x + 1) % lattice.sizeX,             y, z);
+	neighbours[2] = siteId(x, (y == 0)? lattice.sizeY - 1 : y - 1, z);
+	neighbours[3] = siteId(x, (y + 1) % lattice.sizeY,             z);
+
+	if constexpr (Kind::DIMENSION == 3)
+	{
+		neighbours[4] = siteId(x, y, (z == 0)? lattice.sizeZ - 1 : z - 1);
+		neighbours[5] = siteId(x, y, (z + 1) % lattice.sizeZ);
+	}
+}
+
+template <typename Kind>
+void NFoldWay<Kind>::prepare()
+{
+	// The waiting time is memoryless, so it is simply redrawn with the new rates:
+	if (rebuildRates()) pendingAttempts = drawAttempts();
+}
+
+template <typename Kind>
+bool NFoldWay<Kind>::rebuildRates()
+{
+	lattice.refreshParameters();
+
+	const AcceptanceTable<Kind>& acceptance = lattice.acceptance;
+	if (built == acceptance.built) return false;
+
+	built = acceptance.built;
+
+	for (int code = 0; code < acceptance.neighbourCodes; ++code)
+	{
+		for (int state = 0; state < STATES; ++state)
+		{
+			size_t cls = size_t(code) * STATES + state;
+
+			classRate[cls] = 0.0;
+			for (int move = 0; move < MOVES; ++move)
+			{
+				bool null = acceptance.newState[state][move] == state;
+				double probability = std::min(1.0, acceptance.probability[acceptance.entry(code, state, move)]);
+
+				moveRates[cls * MOVES + move] = (null)? 0.0 : 0.25 * probability;
+				classRate[cls] += moveRates[cls * MOVES + move];
+			}
+		}
+	}
+
+	rebuildTree();
+	return true;
+}
+
+template <typename Kind>
+void NFoldWay<Kind>::rebuildClasses()
+{
+	const AcceptanceTable<Kind>& acceptance = lattice.acceptance;
+
+	for (std::vector<uint32_t>& list : members) list.clear();
+
+	for (uint32_t id = 0; id < sites; ++id)
+	{
+		int x, y, z;
+		siteCoords(id, x, y, z);
+
+		uint32_t neighbours[NEIGHBOURS];
+		neighbourSites(id, neighbours);
+
+		int code = 0;
+		for (uint32_t neighbour : neighbours)
+		{
+			int nx, ny, nz;
+			siteCoords(neighbour, nx, ny, nz);
+			code += acceptance.codeOf[lattice.get(nx, ny, nz)];
+		}
+
+		classOf[id] = uint32_t(code) * STATES + lattice.get(x, y, z);
+		slotOf [id] = members[classOf[id]].size();
+		members[classOf[id]].push_back(id);
+	}
+
+	// Forces the rates and the tree to be rebuilt by the next rebuildRates():
+	built = {NAN, Vector(NAN, NAN, NAN), NAN};
+}
+
+template <typename Kind>
+void NFoldWay<Kind>::rebuildTree()
+{
+	// Linear-time construction, every node passes its sum to its parent:
+	for (size_t cls = 0; cls < classes; ++cls)
+	{
+		tree[cls + 1] = members[cls].size() * classRate[cls];
+	}
+
+	for (size_t node = 1; node <= classes; ++node)
+	{
+		size_t parent = node + (node & (~node + 1));
+		if (parent <= classes) tree[parent] += tree[node];
+	}
+
+	eventsSinceRebuild = 0;
+}
+
+template <typename Kind>
+inline void NFoldWay<Kind>::treeAdd(size_t cls, double delta)
+{
+	for (size_t node = cls + 1; node <= classes; node += node & (~node + 1))
+	{
+		tree[node] += delta;
+	}
+}
+
+template <typename Kind>
+inline double NFoldWay<Kind>::totalRate() const
+{
+	double total = 0.0;
+	for (size_t node = classes; node != 0; node &= node - 1)
+	{
+		total += tree[node];
+	}
+
+	return total;
+}
+
+template <typename Kind>
+inline void NFoldWay<Kind>::moveSite(uint32_t id, uint32_t newClass)
+{
+	uint32_t oldClass = classOf[id];
+
+	// The last site of the list takes the place of the removed one:
+	std::vector<uint32_t>& oldList = members[oldClass];
+	uint32_t last = oldList.back();
+	oldList[slotOf[id]] = last;
+	slotOf[last]        = slotOf[id];
+	oldList.pop_back();
+
+	classOf[id] = newClass;
+	slotOf [id] = members[newClass].size();
+	members[newClass].push_back(id);
+
+	treeAdd(oldClass, -classRate[oldClass]);
+	treeAdd(newClass,  classRate[newClass]);
+}
+
+template <typename Kind>
+inline double NFoldWay<Kind>::drawAttempts()
+{
+	double changeProbability = totalRate() / sites;
+	if (changeProbability <= 0.0) return INFINITY;
+	if (changeProbability >= 1.0) return 1.0;
+
+	// Geometric distribution on 1, 2, ... from a uniform number in (0, 1]:
+	double uniform = 1.0 - lattice.rng.uniform();
+	return 1.0 + std::floor(log(uniform) / log1p(-changeProbability));
+}
+
+template <typename Kind>
+void NFoldWay<Kind>::event()
+{
+	const AcceptanceTable<Kind>& acceptance = lattice.acceptance;
+
+	// Rounding of the tree is bounded by rebuilding it once per lattice worth of events:
+	if (++eventsSinceRebuild >= sites) rebuildTree();
+
+	// Descent through the tree to the class holding the target rate:
+	double target = lattice.rng.uniform() * totalRate();
+	size_t node = 0;
+	for (size_t step = treeStep; step != 0; step /= 2)
+	{
+		if (node + step <= classes && tree[node + step] <= target)
+		{
+			node   += step;
+			target -= tree[node];
+		}
+	}
+
+	// A target past the last class, or in an empty one, is left by rounding only:
+	size_t cls = node;
+	if (cls >= classes || members[cls].empty() || classRate[cls] == 0.0)
+	{
+		rebuildTree();
+		return event();
+	}
+
+	uint32_t id = members[cls][lattice.rng.below(members[cls].size())];
+
+	int move = 0;
+	double moveTarget = lattice.rng.uniform() * classRate[cls];
+	while (move + 1 < MOVES && (moveRates[cls * MOVES + move] == 0.0 || moveTarget >= moveRates[cls * MOVES + move]))
+	{
+		moveTarget -= moveRates[cls * MOVES + move];
+		++move;
+	}
+
+	int code     = cls / STATES;
+	int curState = cls % STATES;
+	int newState = acceptance.newState[curState][move];
+
+	int x, y, z;
+	siteCoords(id, x, y, z);
+	lattice.set(x, y, z, newState);
+
+	lattice.totals.magnetization += acceptance.deltaMagnetization[curState][move];
+	lattice.totals.energy        += acceptance.deltaEnergy[acceptance.entry(code, curState, move)];
+
+	// The site changes its state, its neighbours their codes:
+	moveSite(id, classOf[id] - curState + newState);
+
+	uint32_t neighbours[NEIGHBOURS];
+	neighbourSites(id, neighbours);
+
+	int codeChange = acceptance.codeOf[newState] - acceptance.codeOf[curState];
+	for (uint32_t neighbour : neighbours)
+	{
+		moveSite(neighbour, classOf[neighbour] + codeChange * STATES);
+	}
+}
+
+template <typename Kind>
+void NFoldWay<Kind>::advance(uint64_t attempts)
+{
+	prepare();
+
+	double budget = double(attempts);
+	uint64_t events = 0;
+	while (pendingAttempts <= budget)
+	{
+		budget -= pendingAttempts;
+
+		event();
+		++events;
+
+		pendingAttempts = drawAttempts();
+	}
+	pendingAttempts -= budget;
+
+	lattice.moves.attempted += attempts;
+	lattice.moves.accepted  += events;
+}
+
+template <typename Kind>
+template <typename Archive>
+void NFoldWay<Kind>::serialize(Archive& archive)
+{
+	archive.value(pendingAttempts);
+	archive.value(eventsSinceRebuild);
+	archive.bytes(classOf.data(), sites * sizeof(uint32_t));
+	archive.bytes(slotOf .data(), sites * sizeof(uint32_t));
+	archive.bytes(tree   .data(), tree.size() * sizeof(double));
+
+	// Neither the waiting time nor the random stream is redrawn:
+	if (archive.mode == CheckpointArchive::RESTORE)
+	{
+		for (std::vector<uint32_t>& list : members) list.clear();
+		for (uint32_t id = 0; id < sites; ++id)
+		{
+			std::vector<uint32_t>& list = members[classOf[id]];
+			if (list.size() <= slotOf[id]) list.resize(slotOf[id] + 1);
+			list[slotOf[id]] = id;
+		}
+
+		std::vector<double> restoredTree = tree;
+		size_t restoredEvents = eventsSinceRebuild;
+
+		built = {NAN, Vector(NAN, NAN, NAN), NAN};
+		rebuildRates();
+
+		tree               = restoredTree;
+		eventsSinceRebuild = restoredEvents;
+	}
+}
+
+#endif  // POTTS_MODEL_N_FOLD_WAY_HPP_INCLUDED
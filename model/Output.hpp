@@ -0,0 +1,277 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_OUTPUT_HPP_INCLUDED
+#define POTTS_MODEL_OUTPUT_HPP_INCLUDED
+
+// Destinations of the samples taken by collect_samples:
+//   SampleBuffer - (magnetization, energy) pairs in a caller-owned array, used by
+//                  batch mode and the computing grid, which save many short points at once;
+//   NpyStream    - a growing .npy file with a configurable set of observable columns.
+//                  Rows are appended in chunks and the shape in the header is patched
+//                  after every chunk, so the file is a valid partial result at any time
+//                  and memory does not grow with the number of samples.
+
+#include "Checkpoint.hpp"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// One measurement: magnetization per site times magnetic_moment, energy of the whole lattice:
+struct Observation
+{
+	uint64_t sample;
+	double magnetization;
+	double energy;
+	size_t sites;
+};
+
+struct SampleSink
+{
+	virtual ~SampleSink() {}
+
+	// Called once before the first sample, after a checkpoint was restored:
+	virtual void start() {}
+	virtual void write(const Observation& observation) = 0;
+	virtual void flush() {}
+
+	// Lets the sampling loop stop before saved_data_samples samples were taken:
+	virtual bool done() { return false; }
+
+	// Part of the checkpoint of the run, see Checkpoint.hpp:
+	virtual void serialize(CheckpointArchive& archive) = 0;
+
+	// Buffer of one byte per site for the lattice states after the sample, or nullptr for none.
+	// A returned buffer is filled in and handed back by snapshotTaken(), see Correlation.hpp:
+	virtual uint8_t* snapshotBuffer(uint64_t sample) { return nullptr; }
+	virtual void snapshotTaken() {}
+};
+
+// ========================================================================
+// Observable Columns
+// ========================================================================
+
+struct ObservableColumn
+{
+	const char* name;
+	double (*value)(const Observation& observation);
+};
+
+const ObservableColumn OBSERVABLE_COLUMNS[] =
+{
+	{"sample",            [](const Observation& o) { return double(o.sample);          }},
+	{"magnetization",     [](const Observation& o) { return o.magnetization;           }},
+	{"abs_magnetization", [](const Observation& o) { return std::abs(o.magnetization); }},
+	{"energy",            [](const Observation& o) { return o.energy;                  }},
+	{"energy_per_site",   [](const Observation& o) { return o.energy / o.sites;        }}
+};
+
+// Columns of a comma-separated list of names:
+std::vector<const ObservableColumn*> parse_observables(const char* list)
+{
+	std::vector<const ObservableColumn*> columns;
+
+	for (const char* name = list; *name != '\0';)
+	{
+		size_t length = strcspn(name, ",");
+
+		const ObservableColumn* column = NULL;
+		for (const ObservableColumn& candidate : OBSERVABLE_COLUMNS)
+		{
+			if (strlen(candidate.name) == length && strncmp(candidate.name, name, length) == 0) column = &candidate;
+		}
+
+		if (column == NULL)
+		{
+			fprintf(stderr, "[ISING-MODEL] Unknown observable \"%.*s\"\n", int(length), name);
+			exit(EXIT_FAILURE);
+		}
+
+		columns.push_back(column);
+
+		name += length;
+		if (*name == ',') ++name;
+	}
+
+	if (columns.empty())
+	{
+		fprintf(stderr, "[ISING-MODEL] No observables to save\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return columns;
+}
+
+// ========================================================================
+// Sample Buffer
+// ========================================================================
+
+struct SampleBuffer : SampleSink
+{
+	double* data;
+	size_t capacity; // Samples
+
+	SampleBuffer(double* samples, size_t sampleCount);
+
+	void write(const Observation& observation) override;
+	void serialize(CheckpointArchive& archive) override;
+};
+
+SampleBuffer::SampleBuffer(double* samples, size_t sampleCount) :
+	data     (samples),
+	capacity (sampleCount)
+{}
+
+void SampleBuffer::write(const Observation& observation)
+{
+	data[2 * observation.sample + 0] = observation.magnetization;
+	data[2 * observation.sample + 1] = observation.energy;
+}
+
+void SampleBuffer::serialize(CheckpointArchive& archive)
+{
+	archive.bytes(data, 2 * capacity * sizeof(double));
+}
+
+// ========================================================================
+// Streaming .npy Writer
+// ========================================================================
+
+// Version 1.0 .npy file of little-endian doubles with shape (rows, columns).
+// The header has a fixed size, so patching the shape never moves the data:
+struct NpyStream : SampleSink
+{
+	static const size_t HEADER_SIZE = 128;
+
+	const char* filename;
+	int fd;
+	std::vector<const ObservableColumn*> columns;
+	std::vector<double> chunk;
+	size_t chunkRows;
+	size_t bufferedRows;
+	uint64_t rows; // Rows on disk
+
+	NpyStream(const char* outputFile, const char* observableList, size_t chunkSamples);
+	~NpyStream();
+
+	NpyStream(const NpyStream&) = delete;
+	NpyStream& operator=(const NpyStream&) = delete;
+
+	void start() override;
+	void write(const Observation& observation) override;
+	void flush() override;
+	void serialize(CheckpointArchive& archive) override;
+
+	void writeHeader();
+	inline size_t rowBytes() const;
+};
+
+NpyStream::NpyStream(const char* outputFile, const char* observableList, size_t chunkSamples) :
+	filename     (outputFile),
+	fd           (-1),
+	columns      (parse_observables(observableList)),
+	chunk        (),
+	chunkRows    ((chunkSamples == 0)? 1 : chunkSamples),
+	bufferedRows (0),
+	rows         (0)
+{
+	chunk.resize(chunkRows * columns.size());
+
+	// Not truncated yet: a resumed run keeps the rows its checkpoint covers, see start():
+	fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to open output file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+NpyStream::~NpyStream()
+{
+	flush();
+	close(fd);
+}
+
+inline size_t NpyStream::rowBytes() const
+{
+	return columns.size() * sizeof(double);
+}
+
+void NpyStream::start()
+{
+	if (ftruncate(fd, HEADER_SIZE + rows * rowBytes()) == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to resize output file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	writeHeader();
+}
+
+void NpyStream::write(const Observation& observation)
+{
+	double* row = &chunk[bufferedRows * columns.size()];
+	for (size_t column = 0; column < columns.size(); ++column)
+	{
+		row[column] = columns[column]->value(observation);
+	}
+
+	if (++bufferedRows == chunkRows) flush();
+}
+
+// Data first, shape second, so a reader never sees rows that are not there:
+void NpyStream::flush()
+{
+	if (bufferedRows == 0) return;
+
+	size_t bytes = bufferedRows * rowBytes();
+	if (pwrite(fd, chunk.data(), bytes, HEADER_SIZE + rows * rowBytes()) != ssize_t(bytes))
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to write output file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	rows += bufferedRows;
+	bufferedRows = 0;
+
+	writeHeader();
+}
+
+// Rows counted by a checkpoint have to be on disk before the checkpoint is:
+void NpyStream::serialize(CheckpointArchive& archive)
+{
+	if (archive.mode == CheckpointArchive::STORE) fdatasync(fd);
+
+	archive.value(rows);
+}
+
+void NpyStream::writeHeader()
+{
+	char header[HEADER_SIZE];
+	memset(header, ' ', HEADER_SIZE);
+
+	memcpy(header, "\x93NUMPY\x01\x00", 8);
+	header[8] = char((HEADER_SIZE - 10) & 0xFF);
+	header[9] = char((HEADER_SIZE - 10) >> 8);
+
+	int length = snprintf(header + 10, HEADER_SIZE - 10,
+	                      "{'descr': '<f8', 'fortran_order': False, 'shape': (%" PRIu64 ", %zu), }",
+	                      rows, columns.size());
+
+	header[10 + length]     = ' ';
+	header[HEADER_SIZE - 1] = '\n';
+
+	if (pwrite(fd, header, HEADER_SIZE, 0) != ssize_t(HEADER_SIZE))
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to write output file %s\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+#endif  // POTTS_MODEL_OUTPUT_HPP_INCLUDED
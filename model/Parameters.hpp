@@ -0,0 +1,32 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_PARAMETERS_HPP_INCLUDED
+#define POTTS_MODEL_PARAMETERS_HPP_INCLUDED
+
+#include "Vector.hpp"
+
+// Physical parameters of one simulated lattice, already converted to Joules:
+struct ModelParameters
+{
+	double temperature; // kT
+	Vector externalField;
+	double interactivity;
+
+	inline bool operator==(const ModelParameters& other) const;
+	inline bool operator!=(const ModelParameters& other) const;
+};
+
+inline bool ModelParameters::operator==(const ModelParameters& other) const
+{
+	return temperature     == other.temperature     &&
+	       interactivity   == other.interactivity   &&
+	       externalField.x == other.externalField.x &&
+	       externalField.y == other.externalField.y &&
+	       externalField.z == other.externalField.z;
+}
+
+inline bool ModelParameters::operator!=(const ModelParameters& other) const
+{
+	return !(*this == other);
+}
+
+#endif  // POTTS_MODEL_PARAMETERS_HPP_INCLUDED
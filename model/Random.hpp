@@ -0,0 +1,217 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_RANDOM_HPP_INCLUDED
+#define POTTS_MODEL_RANDOM_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+#include <random>
+
+// ========================================================================
+// Stateless Generators
+// ========================================================================
+
+inline uint64_t splitMix64(uint64_t& state)
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// Counter-based random number: the same (key, counter) pair always yields the same value.
+inline uint64_t counterHash(uint64_t key, uint64_t counter)
+{
+	uint64_t state = key ^ (counter * 0xD1B54A32D192ED03ull);
+	splitMix64(state);
+	return splitMix64(state);
+}
+
+// Seed value 0 asks for a non-reproducible seed taken from the system:
+inline uint64_t resolveSeed(uint64_t seed)
+{
+	if (seed != 0) return seed;
+
+	std::random_device rd;
+	return (uint64_t(rd()) << 32) ^ rd();
+}
+
+// ========================================================================
+// Xoshiro256** Generator
+// ========================================================================
+
+inline uint64_t rotl64(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+struct Xoshiro256
+{
+	uint64_t s[4];
+
+	Xoshiro256(uint64_t seed);
+
+	inline uint64_t next();
+
+	// Advances the generator by 2^128 steps, giving non-overlapping subsequences:
+	void jump();
+};
+
+Xoshiro256::Xoshiro256(uint64_t seed) :
+	s ()
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		s[i] = splitMix64(seed);
+	}
+}
+
+inline uint64_t Xoshiro256::next()
+{
+	uint64_t result = rotl64(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl64(s[3], 45);
+
+	return result;
+}
+
+void Xoshiro256::jump()
+{
+	static const uint64_t JUMP[] = {0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull,
+	                                0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull};
+
+	uint64_t jumped[4] = {0, 0, 0, 0};
+	for (uint64_t word : JUMP)
+	{
+		for (int bit = 0; bit < 64; ++bit)
+		{
+			if (word & (1ull << bit))
+			{
+				for (int i = 0; i < 4; ++i) jumped[i] ^= s[i];
+			}
+
+			next();
+		}
+	}
+
+	for (int i = 0; i < 4; ++i) s[i] = jumped[i];
+}
+
+// ========================================================================
+// Buffered Random Stream
+// ========================================================================
+
+// Each thread owns one stream. The stream keeps several xoshiro256** generators
+// in structure-of-arrays form and advances them in lock-step to refill a batch,
+// so that the refill loop compiles to SIMD code.
+// Stream number k of a seed never overlaps with any other stream of that seed.
+struct RandomStream
+{
+	static const size_t LANES = 4;
+	static const size_t BATCH = 256;
+
+	alignas(32) uint64_t state[4][LANES];
+	alignas(32) uint64_t buffer[BATCH];
+	size_t position;
+
+	RandomStream(uint64_t seed, uint64_t streamIndex);
+
+	inline uint64_t next();
+
+	// Uniform double in [0, 1):
+	inline double uniform();
+
+	// Uniform integer in [0, bound):
+	inline uint32_t below(uint32_t bound);
+
+	void refill();
+
+	// Checkpoints, see Checkpoint.hpp:
+	template <typename Archive>
+	void serialize(Archive& archive);
+};
+
+RandomStream::RandomStream(uint64_t seed, uint64_t streamIndex) :
+	state    (),
+	buffer   (),
+	position (BATCH)
+{
+	Xoshiro256 generator(seed);
+	for (uint64_t skipped = 0; skipped < streamIndex * LANES; ++skipped)
+	{
+		generator.jump();
+	}
+
+	for (size_t lane = 0; lane < LANES; ++lane)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			state[i][lane] = generator.s[i];
+		}
+
+		generator.jump();
+	}
+}
+
+inline uint64_t RandomStream::next()
+{
+	if (position == BATCH) refill();
+
+	return buffer[position++];
+}
+
+inline double RandomStream::uniform()
+{
+	return (next() >> 11) * 0x1.0p-53;
+}
+
+inline uint32_t RandomStream::below(uint32_t bound)
+{
+	return ((next() >> 32) * bound) >> 32;
+}
+
+void RandomStream::refill()
+{
+	for (size_t i = 0; i < BATCH; i += LANES)
+	{
+		for (size_t lane = 0; lane < LANES; ++lane)
+		{
+			uint64_t s0 = state[0][lane];
+			uint64_t s1 = state[1][lane];
+			uint64_t s2 = state[2][lane];
+			uint64_t s3 = state[3][lane];
+
+			buffer[i + lane] = rotl64(s1 * 5, 7) * 9;
+
+			uint64_t t = s1 << 17;
+			s2 ^= s0;
+			s3 ^= s1;
+			s1 ^= s2;
+			s0 ^= s3;
+			s2 ^= t;
+			s3 = rotl64(s3, 45);
+
+			state[0][lane] = s0;
+			state[1][lane] = s1;
+			state[2][lane] = s2;
+			state[3][lane] = s3;
+		}
+	}
+
+	position = 0;
+}
+
+template <typename Archive>
+void RandomStream::serialize(Archive& archive)
+{
+	archive.bytes(state,  sizeof(state));
+	archive.bytes(buffer, sizeof(buffer));
+	archive.value(position);
+}
+
+#endif  // POTTS_MODEL_RANDOM_HPP_INCLUDED
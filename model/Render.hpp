@@ -0,0 +1,424 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_RENDER_HPP_INCLUDED
+#define POTTS_MODEL_RENDER_HPP_INCLUDED
+
+// Drawing of the RENDERING build, off the simulation thread.
+// The simulation copies one z-plane of the lattice into the back FrameSnapshot
+// of a FrameExchange and swaps it with the front one. A Renderer thread draws the
+// front snapshot while holding the exchange lock; publish() only tries that lock,
+// so a slow display drops frames instead of stalling the Metropolis loop.
+// Every site is a tile of TILE_PIXELS x TILE_PIXELS pixels, and only tiles whose
+// state differs from the last drawn frame are repainted. Targets:
+//   FramebufferTarget - /dev/fb0 mapped into memory;
+//   StreamTarget      - binary PPM (P6) or raw RGB24 frames appended to a file or pipe,
+//                       e.g. for ffmpeg -f image2pipe or -f rawvideo -pix_fmt rgb24.
+
+#include "Model.hpp"
+
+#include <atomic>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fb.h>
+
+const int TILE_PIXELS = 8;
+
+struct Rgb
+{
+	uint8_t red, green, blue;
+};
+
+// Colors of the states: spin x, z and y components as red, green and blue:
+template <typename Kind>
+std::vector<Rgb> state_palette(const typename Kind::StateGraph& stateGraph)
+{
+	std::vector<Rgb> palette(Kind::STATES);
+	for (int state = 0; state < Kind::STATES; ++state)
+	{
+		Vector spin = stateGraph.spins[state];
+		palette[state] = {uint8_t((1.0 + spin.x) * 127), uint8_t((1.0 + spin.z) * 127), uint8_t((1.0 + spin.y) * 127)};
+	}
+
+	return palette;
+}
+
+// ========================================================================
+// Snapshots
+// ========================================================================
+
+struct FrameSnapshot
+{
+	std::vector<uint8_t> states; // width * height state indices, row by row
+	uint64_t frame;
+	double temperature;          // Kelvins
+	double field;                // Percents of magnetic_moment
+	double magnetization;
+};
+
+// States of the plane z, (0, 0) .. (width-1, height-1):
+template <typename Kind>
+void capture_frame(const Lattice<Kind>& lattice, int z, int width, int height, FrameSnapshot& snapshot)
+{
+	snapshot.states.resize(size_t(width) * height);
+
+	for (int y = 0; y < height; ++y) {
+	for (int x = 0; x < width;  ++x) {
+		snapshot.states[size_t(y) * width + x] = lattice.get(x, y, z);
+	}}
+
+	snapshot.magnetization = lattice.magnetization();
+}
+
+struct FrameExchange
+{
+	FrameSnapshot back;  // Owned by the simulation thread
+	FrameSnapshot front; // Read by the renderer under the lock
+
+	std::mutex mutex;
+	std::condition_variable published;
+	bool fresh;
+	bool stopping;
+
+	FrameExchange();
+
+	// Swaps the back snapshot in, unless the renderer is drawing. Never blocks:
+	bool publish();
+	void stop();
+};
+
+FrameExchange::FrameExchange() :
+	back      (),
+	front     (),
+	mutex     (),
+	published (),
+	fresh     (false),
+	stopping  (false)
+{}
+
+bool FrameExchange::publish()
+{
+	std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+	if (!lock.owns_lock()) return false;
+
+	std::swap(back, front);
+	fresh = true;
+
+	lock.unlock();
+	published.notify_one();
+
+	return true;
+}
+
+void FrameExchange::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	published.notify_all();
+}
+
+// ========================================================================
+// Render Targets
+// ========================================================================
+
+struct RenderTarget
+{
+	virtual ~RenderTarget() {}
+
+	// Paints the tile of the site (x, y) with the color of state:
+	virtual void drawTile(int x, int y, int state) = 0;
+
+	// Called after the dirty tiles of a frame were drawn:
+	virtual void present() {}
+};
+
+struct FramebufferTarget : RenderTarget
+{
+	int fd;
+	char* frameBuffer;
+	size_t fbSize;
+	size_t bytesPerPixel;
+	size_t bytesPerLine;
+	struct fb_var_screeninfo vinf;
+	struct fb_fix_screeninfo finf;
+
+	// One tile row of every state in the pixel format of the screen:
+	std::vector<char> tileRows;
+
+	FramebufferTarget(const char* device);
+	~FramebufferTarget();
+
+	FramebufferTarget(const FramebufferTarget&) = delete;
+	FramebufferTarget& operator=(const FramebufferTarget&) = delete;
+
+	// Sites that fit on the screen:
+	int tilesX() const { return vinf.xres / TILE_PIXELS; }
+	int tilesY() const { return vinf.yres / TILE_PIXELS; }
+
+	void setPalette(const std::vector<Rgb>& palette);
+	void drawTile(int x, int y, int state) override;
+};
+
+FramebufferTarget::FramebufferTarget(const char* device) :
+	fd            (-1),
+	frameBuffer   (nullptr),
+	fbSize        (0),
+	bytesPerPixel (0),
+	bytesPerLine  (0),
+	vinf          (),
+	finf          (),
+	tileRows      ()
+{
+	fd = open(device, O_RDWR);
+	if (fd == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to open %s\n", device);
+		exit(EXIT_FAILURE);
+	}
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &vinf) == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable get variable screen info\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (ioctl(fd, FBIOGET_FSCREENINFO, &finf) == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to get fixed screen info\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fbSize        = size_t(finf.line_length) * vinf.yres;
+	bytesPerPixel = vinf.bits_per_pixel / 8;
+	bytesPerLine  = finf.line_length;
+
+	frameBuffer = (char*) mmap(NULL, fbSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (frameBuffer == MAP_FAILED)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to map frame buffer into address space\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+FramebufferTarget::~FramebufferTarget()
+{
+	if (munmap(frameBuffer, fbSize) == -1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unable to unmap frame buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+}
+
+// Bytes of the pixel other than the color channels keep their value of the screen format (zero):
+void FramebufferTarget::setPalette(const std::vector<Rgb>& palette)
+{
+	size_t rowBytes = TILE_PIXELS * bytesPerPixel;
+	tileRows.assign(palette.size() * rowBytes, 0);
+
+	for (size_t state = 0; state < palette.size(); ++state)
+	{
+		for (int pixel = 0; pixel < TILE_PIXELS; ++pixel)
+		{
+			char* bytes = &tileRows[state * rowBytes + pixel * bytesPerPixel];
+			bytes[vinf.red.offset   / 8] = palette[state].red;
+			bytes[vinf.green.offset / 8] = palette[state].green;
+			bytes[vinf.blue.offset  / 8] = palette[state].blue;
+		}
+	}
+}
+
+void FramebufferTarget::drawTile(int x, int y, int state)
+{
+	size_t rowBytes = TILE_PIXELS * bytesPerPixel;
+	const char* row = &tileRows[state * rowBytes];
+
+	char* pixels = frameBuffer + size_t(TILE_PIXELS * y) * bytesPerLine + size_t(TILE_PIXELS * x) * bytesPerPixel;
+	for (int dy = 0; dy < TILE_PIXELS; ++dy)
+	{
+		memcpy(pixels + dy * bytesPerLine, row, rowBytes);
+	}
+}
+
+struct StreamTarget : RenderTarget
+{
+	FILE* file;
+	bool ownsFile;
+	bool ppm;
+	int widthPixels, heightPixels;
+	std::vector<Rgb> palette;
+	std::vector<Rgb> image;
+
+	// "-" streams to stdout:
+	StreamTarget(const char* outputFile, const char* format, int tilesX, int tilesY,
+	             const std::vector<Rgb>& statePalette);
+	~StreamTarget();
+
+	StreamTarget(const StreamTarget&) = delete;
+	StreamTarget& operator=(const StreamTarget&) = delete;
+
+	void drawTile(int x, int y, int state) override;
+	void present() override;
+};
+
+StreamTarget::StreamTarget(const char* outputFile, const char* format, int tilesX, int tilesY,
+                           const std::vector<Rgb>& statePalette) :
+	file         (stdout),
+	ownsFile     (false),
+	ppm          (strcmp(format, "ppm") == 0),
+	widthPixels  (TILE_PIXELS * tilesX),
+	heightPixels (TILE_PIXELS * tilesY),
+	palette      (statePalette),
+	image        (size_t(widthPixels) * heightPixels)
+{
+	if (!ppm && strcmp(format, "raw") != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unknown frame format \"%s\"\n", format);
+		exit(EXIT_FAILURE);
+	}
+
+	if (strcmp(outputFile, "-") != 0)
+	{
+		file = fopen(outputFile, "wb");
+		if (file == NULL)
+		{
+			fprintf(stderr, "[ISING-MODEL] Unable to open output file %s\n", outputFile);
+			exit(EXIT_FAILURE);
+		}
+
+		ownsFile = true;
+	}
+}
+
+StreamTarget::~StreamTarget()
+{
+	if (ownsFile) fclose(file);
+	else          fflush(file);
+}
+
+void StreamTarget::drawTile(int x, int y, int state)
+{
+	Rgb color = palette[state];
+
+	Rgb* pixels = &image[size_t(TILE_PIXELS * y) * widthPixels + TILE_PIXELS * x];
+	for (int dy = 0; dy < TILE_PIXELS; ++dy) {
+	for (int dx = 0; dx < TILE_PIXELS; ++dx) {
+		pixels[dy * widthPixels + dx] = color;
+	}}
+}
+
+// Every frame is written whole, the stream has no notion of tiles:
+void StreamTarget::present()
+{
+	if (ppm) fprintf(file, "P6\n%d %d\n255\n", widthPixels, heightPixels);
+
+	static_assert(sizeof(Rgb) == 3, "Pixels are written as they are stored");
+	if (fwrite(image.data(), sizeof(Rgb), image.size(), file) != image.size() || fflush(file) != 0)
+	{
+		fprintf(stderr, "\n[ISING-MODEL] Unable to write frames\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// ========================================================================
+// Renderer Thread
+// ========================================================================
+
+struct Renderer
+{
+	FrameExchange& exchange;
+	RenderTarget& target;
+	int width, height; // Tiles
+	uint64_t maxFrames; // Zero for no limit
+	FILE* status;
+
+	std::vector<uint8_t> shown; // States on the target
+	bool painted;
+	uint64_t frames;
+	std::atomic<bool> finished;
+	std::thread thread;
+
+	Renderer(FrameExchange& frameExchange, RenderTarget& renderTarget, int tilesX, int tilesY,
+	         uint64_t frameLimit, FILE* statusStream);
+	~Renderer();
+
+	Renderer(const Renderer&) = delete;
+	Renderer& operator=(const Renderer&) = delete;
+
+	void renderLoop();
+	void draw(const FrameSnapshot& snapshot);
+};
+
+Renderer::Renderer(FrameExchange& frameExchange, RenderTarget& renderTarget, int tilesX, int tilesY,
+                   uint64_t frameLimit, FILE* statusStream) :
+	exchange  (frameExchange),
+	target    (renderTarget),
+	width     (tilesX),
+	height    (tilesY),
+	maxFrames (frameLimit),
+	status    (statusStream),
+	shown     (size_t(tilesX) * tilesY),
+	painted   (false),
+	frames    (0),
+	finished  (false),
+	thread    ()
+{
+	thread = std::thread(&Renderer::renderLoop, this);
+}
+
+Renderer::~Renderer()
+{
+	exchange.stop();
+	thread.join();
+}
+
+void Renderer::renderLoop()
+{
+	std::unique_lock<std::mutex> lock(exchange.mutex);
+	while (maxFrames == 0 || frames < maxFrames)
+	{
+		exchange.published.wait(lock, [this]() { return exchange.fresh || exchange.stopping; });
+		if (exchange.stopping) break;
+
+		exchange.fresh = false;
+		draw(exchange.front);
+	}
+
+	finished.store(true, std::memory_order_release);
+}
+
+void Renderer::draw(const FrameSnapshot& snapshot)
+{
+	for (int y = 0; y < height; ++y) {
+	for (int x = 0; x < width;  ++x) {
+		size_t tile = size_t(y) * width + x;
+		if (painted && shown[tile] == snapshot.states[tile]) continue;
+
+		target.drawTile(x, y, snapshot.states[tile]);
+		shown[tile] = snapshot.states[tile];
+	}}
+
+	painted = true;
+	target.present();
+	++frames;
+
+	fprintf(status, "T = %0.03lf, H = %0.03lf, M = %0.03lf, frame %" PRIu64 "\r",
+	        snapshot.temperature, snapshot.field, snapshot.magnetization, snapshot.frame);
+	fflush(status);
+}
+
+#endif  // POTTS_MODEL_RENDER_HPP_INCLUDED
@@ -0,0 +1,449 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_REPLICAS_HPP_INCLUDED
+#define POTTS_MODEL_REPLICAS_HPP_INCLUDED
+
+// Many-replica engine: independent copies of one two-state lattice advanced in lock-step.
+// Every site is a run of words whose bit r is the state of replica r, so one checkerboard
+// update of a site advances 64 replicas per word, with the bit-sliced Metropolis test of
+// MultiSpin.hpp. As there, half of the proposals are null moves, so one sweep corresponds
+// to one checkerboard sweep of Lattice for every replica.
+// Replica r starts from the initial state of its own seed. The replicas of a lattice
+// share the plane streams, each lane consuming its own bit of every random word, so they
+// are statistically independent, but the trajectory of a replica depends on its group.
+// Observables of every replica are counted from the lanes at measurement time.
+
+#include "Config.hpp"
+#include "InitialState.hpp"
+#include "ModelKind.hpp"
+#include "MultiSpin.hpp"
+#include "Output.hpp"
+#include "Parameters.hpp"
+#include "Random.hpp"
+#include "ThreadPool.hpp"
+#include "Metrics.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Column sums of a stream of 64-bit words: counts[i] is the number of words added with bit i set.
+// Bit 8b+k of a word is added to byte b of partial[k], bytes are spilled before they overflow:
+struct LaneCounter
+{
+	uint64_t partial[8];
+	unsigned pending;
+	uint64_t counts[64];
+
+	LaneCounter();
+
+	inline void add(uint64_t word);
+	void spill();
+};
+
+LaneCounter::LaneCounter() :
+	partial (),
+	pending (0),
+	counts  ()
+{}
+
+inline void LaneCounter::add(uint64_t word)
+{
+	for (int k = 0; k < 8; ++k)
+	{
+		partial[k] += (word >> k) & 0x0101010101010101ull;
+	}
+
+	if (++pending == 255) spill();
+}
+
+void LaneCounter::spill()
+{
+	for (int k = 0; k < 8; ++k)
+	{
+		for (int b = 0; b < 8; ++b)
+		{
+			counts[8 * b + k] += (partial[k] >> (8 * b)) & 0xFF;
+		}
+
+		partial[k] = 0;
+	}
+
+	pending = 0;
+}
+
+// ========================================================================
+// Replica Lattice
+// ========================================================================
+
+template <typename Kind>
+struct ReplicaLattice
+{
+	static_assert(Kind::STATES == 2, "Replica lanes require a two-state graph");
+
+	static constexpr int NEIGHBOURS = Kind::NEIGHBOURS;
+
+	int sizeX, sizeY, sizeZ;
+	size_t sites;
+	size_t replicas;
+	int laneWords;         // Words per site
+	uint64_t lastLaneMask; // Lanes of the last word that hold replicas
+	ModelParameters parameters;
+	typename Kind::StateGraph stateGraph;
+	uint64_t* words;
+	ThreadPool& pool;
+	std::vector<RandomStream> planeStreams;
+	std::vector<MoveCounters> planeMoves;
+	MoveCounters moves; // Of all replicas, not part of the state, see Metrics.hpp
+	BitSlicedMetropolis<Kind> acceptance;
+
+	// One replica per seed of replicaSeeds, random words are drawn from streams of streamSeed:
+	ReplicaLattice(int latticeSizeX, int latticeSizeY, int latticeSizeZ,
+	               int (*getStateX) (int, int, int, uint64_t),
+	               int (*getStateY) (int, int, int, uint64_t),
+	               const std::vector<uint64_t>& replicaSeeds, uint64_t streamSeed,
+	               const ModelParameters& modelParameters, ThreadPool& threadPool);
+
+	~ReplicaLattice();
+
+	ReplicaLattice(const ReplicaLattice&) = delete;
+	ReplicaLattice& operator=(const ReplicaLattice&) = delete;
+
+	inline uint64_t* lanes(int x, int y, int z);
+	inline int getState(int x, int y, int z, size_t replica);
+
+	void sweep();
+	void halfSweep(int parity);
+	void updateSite(int x, int y, int z, RandomStream& stream, MoveCounters& moveCount);
+
+	// Magnetization per site and energy of every replica:
+	void measure(std::vector<double>& magnetization, std::vector<double>& energy);
+};
+
+template <typename Kind>
+ReplicaLattice<Kind>::ReplicaLattice(int latticeSizeX, int latticeSizeY, int latticeSizeZ,
+                                     int (*getStateX) (int, int, int, uint64_t),
+                                     int (*getStateY) (int, int, int, uint64_t),
+                                     const std::vector<uint64_t>& replicaSeeds, uint64_t streamSeed,
+                                     const ModelParameters& modelParameters, ThreadPool& threadPool) :
+	sizeX        (latticeSizeX),
+	sizeY        (latticeSizeY),
+	sizeZ        (latticeSizeZ),
+	sites        (size_t(latticeSizeX) * latticeSizeY * latticeSizeZ),
+	replicas     (replicaSeeds.size()),
+	laneWords    (int((replicaSeeds.size() + 63) / 64)),
+	lastLaneMask ((replicaSeeds.size() % 64 == 0)? ~0ull : (1ull << (replicaSeeds.size() % 64)) - 1),
+	parameters   (modelParameters),
+	stateGraph   (),
+	words        (nullptr),
+	pool         (threadPool),
+	planeStreams (),
+	planeMoves   (latticeSizeX),
+	moves        ({0, 0}),
+	acceptance   ()
+{
+	// A two-dimensional lattice has a single z-layer and no z-bonds:
+	bool oddZ = Kind::DIMENSION == 3 && sizeZ % 2 != 0;
+	if (sizeX % 2 != 0 || sizeY % 2 != 0 || oddZ)
+	{
+		fprintf(stderr, "[ISING-MODEL] Checkerboard sweep requires even lattice sizes\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (Kind::DIMENSION == 2 && sizeZ != 1)
+	{
+		fprintf(stderr, "[ISING-MODEL] Two-dimensional lattice must have sizeZ = 1\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (replicas == 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Replica lattice needs at least one replica\n");
+		exit(EXIT_FAILURE);
+	}
+
+	words = new uint64_t[sites * laneWords]();
+
+	for (size_t replica = 0; replica < replicas; ++replica)
+	{
+		uint64_t replicaSeed = replicaSeeds[replica];
+
+		for (int x = 0; x < sizeX; ++x) {
+		for (int y = 0; y < sizeY; ++y) {
+		for (int z = 0; z < sizeZ; ++z) {
+			uint64_t state = getStateX(x, y, z, replicaSeed) * Kind::STATES_Y + getStateY(x, y, z, replicaSeed);
+			lanes(x, y, z)[replica / 64] |= state << (replica % 64);
+		}}}
+	}
+
+	// Same stream numbering as CheckerboardSweep:
+	planeStreams.reserve(sizeX);
+	for (int x = 0; x < sizeX; ++x)
+	{
+		planeStreams.emplace_back(streamSeed, 1 + x);
+	}
+}
+
+template <typename Kind>
+ReplicaLattice<Kind>::~ReplicaLattice()
+{
+	delete[] words;
+}
+
+template <typename Kind>
+inline uint64_t* ReplicaLattice<Kind>::lanes(int x, int y, int z)
+{
+	return words + ((size_t(x) * sizeY + y) * sizeZ + z) * laneWords;
+}
+
+template <typename Kind>
+inline int ReplicaLattice<Kind>::getState(int x, int y, int z, size_t replica)
+{
+	return (lanes(x, y, z)[replica / 64] >> (replica % 64)) & 1;
+}
+
+template <typename Kind>
+void ReplicaLattice<Kind>::sweep()
+{
+	acceptance.computeThresholds(stateGraph, parameters);
+
+	halfSweep(0);
+	halfSweep(1);
+}
+
+template <typename Kind>
+void ReplicaLattice<Kind>::halfSweep(int parity)
+{
+	pool.run(sizeX, [this, parity](size_t task, size_t /* worker */)
+	{
+		int x = task;
+		planeMoves[task] = {0, 0};
+
+		for (int y = 0; y < sizeY; ++y)
+		{
+			for (int z = (x + y + parity) % 2; z < sizeZ; z += 2)
+			{
+				updateSite(x, y, z, planeStreams[task], planeMoves[task]);
+			}
+		}
+	});
+
+	for (const MoveCounters& planeCount : planeMoves)
+	{
+		moves.attempted += planeCount.attempted;
+		moves.accepted  += planeCount.accepted;
+	}
+}
+
+template <typename Kind>
+void ReplicaLattice<Kind>::updateSite(int x, int y, int z, RandomStream& stream, MoveCounters& moveCount)
+{
+	uint64_t* cur = lanes(x, y, z);
+
+	const uint64_t* neighbours[NEIGHBOURS];
+	neighbours[0] = lanes((x == 0)? (sizeX - 1) : (x - 1), y, z);
+	neighbours[1] = lanes((x + 1) % sizeX, y, z);
+	neighbours[2] = lanes(x, (y == 0)? (sizeY - 1) : (y - 1), z);
+	neighbours[3] = lanes(x, (y + 1) % sizeY, z);
+	if constexpr (Kind::DIMENSION == 3)
+	{
+		neighbours[4] = lanes(x, y, (z == 0)? (sizeZ - 1) : (z - 1));
+		neighbours[5] = lanes(x, y, (z + 1) % sizeZ);
+	}
+
+	for (int w = 0; w < laneWords; ++w)
+	{
+		uint64_t spins = cur[w];
+
+		// Bit-sliced count of neighbours in the same state as the site, at most six:
+		uint64_t bit0 = 0, bit1 = 0, bit2 = 0;
+		for (int n = 0; n < NEIGHBOURS; ++n)
+		{
+			uint64_t aligned = ~(spins ^ neighbours[n][w]);
+
+			uint64_t carry0 = bit0 & aligned;
+			bit0 ^= aligned;
+			uint64_t carry1 = bit1 & carry0;
+			bit1 ^= carry0;
+			bit2 |= carry1;
+		}
+
+		uint64_t valid    = (w == laneWords - 1)? lastLaneMask : ~0ull;
+		uint64_t proposed = valid & stream.next();
+
+		uint64_t accepted = acceptance.accept(spins, bit0, bit1, bit2, proposed, stream);
+
+		cur[w] = spins ^ accepted;
+
+		// Every replica is one attempt, null moves included, as in Lattice:
+		moveCount.attempted += __builtin_popcountll(valid);
+		moveCount.accepted  += __builtin_popcountll(accepted);
+	}
+}
+
+// Counts bonds of every kind along the R, D and B directions, as MultiSpinLattice::calculateEnergy does:
+template <typename Kind>
+void ReplicaLattice<Kind>::measure(std::vector<double>& magnetization, std::vector<double>& energy)
+{
+	std::vector<LaneCounter> ones(laneWords), bonds11(laneWords), bonds01(laneWords);
+
+	for (int x = 0; x < sizeX; ++x) {
+	for (int y = 0; y < sizeY; ++y) {
+	for (int z = 0; z < sizeZ; ++z) {
+		const uint64_t* cur = lanes(x, y, z);
+
+		const uint64_t* neighbours[Kind::DIMENSION];
+		neighbours[0] = lanes((x + 1) % sizeX, y, z);
+		neighbours[1] = lanes(x, (y + 1) % sizeY, z);
+		if constexpr (Kind::DIMENSION == 3)
+		{
+			neighbours[2] = lanes(x, y, (z + 1) % sizeZ);
+		}
+
+		for (int w = 0; w < laneWords; ++w)
+		{
+			ones[w].add(cur[w]);
+
+			for (const uint64_t* neighbour : neighbours)
+			{
+				bonds11[w].add(cur[w] & neighbour[w]);
+				bonds01[w].add(cur[w] ^ neighbour[w]);
+			}
+		}
+	}}}
+
+	Vector spin0 = stateGraph.spins[0];
+	Vector spin1 = stateGraph.spins[1];
+	size_t bonds = sites * Kind::DIMENSION;
+
+	magnetization.resize(replicas);
+	energy.resize(replicas);
+
+	for (int w = 0; w < laneWords; ++w)
+	{
+		ones   [w].spill();
+		bonds11[w].spill();
+		bonds01[w].spill();
+	}
+
+	for (size_t replica = 0; replica < replicas; ++replica)
+	{
+		int w = replica / 64, lane = replica % 64;
+
+		size_t n1  = ones   [w].counts[lane];
+		size_t b11 = bonds11[w].counts[lane];
+		size_t b01 = bonds01[w].counts[lane];
+		size_t b00 = bonds - b11 - b01;
+
+		magnetization[replica] = ((sites - n1) * spin0.z + n1 * spin1.z) / sites;
+
+		energy[replica]  = -parameters.interactivity * (b00 * spin0.scalar(spin0) +
+		                                                b11 * spin1.scalar(spin1) +
+		                                                b01 * spin0.scalar(spin1));
+		energy[replica] -= (sites - n1) * spin0.scalar(parameters.externalField) +
+		                            n1  * spin1.scalar(parameters.externalField);
+	}
+}
+
+// ========================================================================
+// Sampling
+// ========================================================================
+
+// Same schedule as collect_samples, with one sink per replica. A replica whose sink
+// is done is no longer written, the lattice runs until all of them are.
+// There are no running totals to resynchronize and no checkpoints:
+template <typename Kind>
+void collect_replica_samples(ReplicaLattice<Kind>& replicaModel, std::vector<SampleSink*>& sinks)
+{
+	std::vector<double> magnetization, energy;
+	std::vector<bool> finished(sinks.size(), false);
+	size_t running = sinks.size();
+
+	for (SampleSink* sink : sinks) sink->start();
+
+	WorkerMetrics& metrics = worker_metrics();
+	metrics.beginPoint(replicaModel.parameters.temperature / 1.38e-23);
+	MoveCounters published = replicaModel.moves;
+
+	uint64_t cur_saved_data = 0;
+	for (uint64_t iteration = 0; iteration < burn_in_samples + saved_data_samples && running != 0; ++iteration)
+	{
+		uint64_t phaseStart = metrics_clock();
+
+		for (size_t sweep = 0; sweep < sweeps_per_sample; ++sweep)
+			replicaModel.sweep();
+
+		uint64_t phaseEnd = metrics_clock();
+		metrics.addPhase(PHASE_MC, phaseEnd - phaseStart);
+		metrics.addMoves({replicaModel.moves.attempted - published.attempted,
+		                  replicaModel.moves.accepted  - published.accepted});
+		published = replicaModel.moves;
+
+		if (burn_in_samples <= iteration && cur_saved_data < saved_data_samples)
+		{
+			phaseStart = phaseEnd;
+
+			replicaModel.measure(magnetization, energy);
+
+			for (size_t replica = 0; replica < sinks.size(); ++replica)
+			{
+				if (finished[replica]) continue;
+
+				sinks[replica]->write({cur_saved_data, magnetic_moment * magnetization[replica], energy[replica],
+				                       replicaModel.sites});
+				metrics.addSample();
+
+				// The statistics stage may find the replica converged early:
+				if (sinks[replica]->done())
+				{
+					finished[replica] = true;
+					--running;
+				}
+			}
+
+			++cur_saved_data;
+
+			metrics.addPhase(PHASE_MEASURE, metrics_clock() - phaseStart);
+		}
+	}
+
+	uint64_t flushStart = metrics_clock();
+	for (SampleSink* sink : sinks) sink->flush();
+	metrics.addPhase(PHASE_IO, metrics_clock() - flushStart);
+
+	metrics.endPoint();
+}
+
+// Runs one replica per sink, replica r starting from the initial state of replicaSeeds[r]:
+template <typename Kind>
+void simulate_replicas_kind(const ModelParameters& parameters, const std::vector<uint64_t>& replicaSeeds,
+                            uint64_t streamSeed, size_t poolThreads, std::vector<SampleSink*>& sinks)
+{
+	if constexpr (Kind::STATES == 2)
+	{
+		int sizeZ = (Kind::DIMENSION == 3)? lattice_size_z : 1;
+
+		ThreadPool pool(poolThreads);
+		ReplicaLattice<Kind> replicaModel(lattice_size_x, lattice_size_y, sizeZ, getStateX<Kind>, getStateY<Kind>,
+		                                  replicaSeeds, streamSeed, parameters, pool);
+
+		collect_replica_samples(replicaModel, sinks);
+	}
+	else
+	{
+		fprintf(stderr, "[ISING-MODEL] Replica lanes require a two-state graph\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void simulate_replicas(const ModelParameters& parameters, const std::vector<uint64_t>& replicaSeeds,
+                       uint64_t streamSeed, size_t poolThreads, std::vector<SampleSink*>& sinks)
+{
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		simulate_replicas_kind<decltype(kind)>(parameters, replicaSeeds, streamSeed, poolThreads, sinks);
+	});
+}
+
+#endif  // POTTS_MODEL_REPLICAS_HPP_INCLUDED
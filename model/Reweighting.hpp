@@ -0,0 +1,362 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_REWEIGHTING_HPP_INCLUDED
+#define POTTS_MODEL_REWEIGHTING_HPP_INCLUDED
+
+// Joint histograms of the sampled states and multi-histogram reweighting.
+// A HistogramSink bins every sample by its interaction energy and magnetization per site
+// (e_int in units of interactivity, m in units of the spin length, both with a bin width
+// of histogram_resolution). Samples the statistics stage discarded as not equilibrated
+// are left out of the histogram of the point. The field term is left out of the energy, so a histogram
+// can be reweighted in the field as well as in the temperature.
+// Histograms of the points with equal (temperature, field) are pooled, each point
+// weighted by its statistical inefficiency g = 2 tau_int(e). The Ferrenberg-Swendsen
+// equations for the free energies of the pooled ensembles are then solved by iteration,
+// and the combined density of states gives, at any (T, H) within the sampled range:
+//   m, |m|, e, var m, var e,
+//   susceptibility - sites * (J / kT)   * (<m^2> - <|m|>^2),
+//   specific heat  - sites * (J / kT)^2 * var e, per site in units of k_B,
+// with e = e_int - (H / J) m per site in units of interactivity J, as in Statistics.hpp.
+
+#include "Config.hpp"
+#include "Output.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <utility>
+#include <vector>
+
+struct JointHistogram
+{
+	double resolution;
+	uint64_t samples;
+	std::map<std::pair<int64_t, int64_t>, uint64_t> counts; // (e_int, m) bin -> samples
+
+	JointHistogram(double binWidth = 1.0);
+
+	inline std::pair<int64_t, int64_t> binOf(double energy, double magnetization) const;
+	inline void add(const std::pair<int64_t, int64_t>& bin);
+	inline double center(int64_t bin) const { return bin * resolution; }
+};
+
+JointHistogram::JointHistogram(double binWidth) :
+	resolution (binWidth),
+	samples    (0),
+	counts     ()
+{}
+
+inline std::pair<int64_t, int64_t> JointHistogram::binOf(double energy, double magnetization) const
+{
+	return {int64_t(std::llround(energy / resolution)), int64_t(std::llround(magnetization / resolution))};
+}
+
+inline void JointHistogram::add(const std::pair<int64_t, int64_t>& bin)
+{
+	++counts[bin];
+	++samples;
+}
+
+// ========================================================================
+// Histogram Stage Of The Sampling Loop
+// ========================================================================
+
+// Forwards samples to another sink and bins them on the way.
+// Bins are kept per sample until the number of discarded samples is known.
+// The histogram is not part of checkpoints, its size is not known in advance:
+struct HistogramSink : SampleSink
+{
+	SampleSink& output;
+	JointHistogram binning; // Stays empty, only fixes the bins
+	double fieldPerSpin; // Field energy of a unit spin z-component, in units of interactivity
+	std::vector<std::pair<int64_t, int64_t>> sampleBins; // In sample order
+
+	HistogramSink(SampleSink& outputSink, const ModelParameters& parameters);
+
+	// Histogram of the samples after the first discarded ones:
+	JointHistogram histogram(uint64_t discarded) const;
+
+	void start() override { output.start(); }
+	void write(const Observation& observation) override;
+	void flush() override { output.flush(); }
+	bool done() override { return output.done(); }
+	void serialize(CheckpointArchive& archive) override { output.serialize(archive); }
+};
+
+HistogramSink::HistogramSink(SampleSink& outputSink, const ModelParameters& parameters) :
+	output       (outputSink),
+	binning      (histogram_resolution),
+	fieldPerSpin (parameters.externalField.z / parameters.interactivity),
+	sampleBins   ()
+{}
+
+void HistogramSink::write(const Observation& observation)
+{
+	output.write(observation);
+
+	double m = observation.magnetization / magnetic_moment;
+	double e = observation.energy / (observation.sites * interactivity);
+
+	sampleBins.push_back(binning.binOf(e + fieldPerSpin * m, m));
+}
+
+JointHistogram HistogramSink::histogram(uint64_t discarded) const
+{
+	JointHistogram result = binning;
+	for (size_t sample = discarded; sample < sampleBins.size(); ++sample)
+	{
+		result.add(sampleBins[sample]);
+	}
+
+	return result;
+}
+
+// ========================================================================
+// Ferrenberg-Swendsen Reweighting
+// ========================================================================
+
+const size_t REWEIGHTED_COLUMNS = 9;
+
+struct ReweightedPoint
+{
+	double temperature; // Kelvins
+	double field;       // Config units
+	double magnetization, absMagnetization, energy;
+	double magnetizationVariance, energyVariance;
+	double susceptibility, specificHeat;
+};
+
+void reweighted_to_row(const ReweightedPoint& point, double* row)
+{
+	double values[REWEIGHTED_COLUMNS] =
+	{
+		point.temperature, point.field,
+		point.magnetization, point.absMagnetization, point.energy,
+		point.magnetizationVariance, point.energyVariance,
+		point.susceptibility, point.specificHeat
+	};
+
+	memcpy(row, values, sizeof(values));
+}
+
+// log(sum exp(values)) without overflow:
+inline double log_sum_exp(const std::vector<double>& values)
+{
+	double top = *std::max_element(values.begin(), values.end());
+	if (std::isinf(top)) return top;
+
+	double sum = 0.0;
+	for (double value : values) sum += exp(value - top);
+
+	return top + log(sum);
+}
+
+struct MultiHistogram
+{
+	static const size_t MAX_ITERATIONS = 100000;
+	static constexpr double TOLERANCE  = 1e-10;
+
+	size_t sites;
+
+	// Simulated ensembles, points of equal parameters pooled:
+	std::map<std::pair<double, double>, size_t> ensembleIndex; // (Kelvins, config field) -> ensemble
+	std::vector<double> betas;        // J / kT
+	std::vector<double> fields;       // H / J
+	std::vector<double> samples;      // Effective sample counts
+	std::vector<double> logSamples;
+	std::vector<double> logPartition; // log Z, up to a common constant
+
+	// Union of the bins of all ensembles:
+	std::map<std::pair<int64_t, int64_t>, size_t> binIndex;
+	std::vector<double> counts;       // Effective samples
+	std::vector<double> energies;     // e_int per site
+	std::vector<double> magnetizations;
+	std::vector<double> logCounts;
+	std::vector<double> logDenominators; // log sum_k N_k exp(-beta_k E(x)) / Z_k
+
+	MultiHistogram(size_t latticeSites);
+
+	// Histogram of a point simulated at the given temperature (Kelvins) and field (config units):
+	void addPoint(double temperature, double field, const JointHistogram& histogram, double inefficiency);
+
+	// Solves for logPartition, returns the number of iterations:
+	size_t solve();
+
+	ReweightedPoint reweight(double temperature, double field) const;
+
+	inline double exponent(double beta, double field, size_t bin) const;
+	void computeDenominators();
+};
+
+MultiHistogram::MultiHistogram(size_t latticeSites) :
+	sites           (latticeSites),
+	ensembleIndex   (),
+	betas           (),
+	fields          (),
+	samples         (),
+	logSamples      (),
+	logPartition    (),
+	binIndex        (),
+	counts          (),
+	energies        (),
+	magnetizations  (),
+	logCounts       (),
+	logDenominators ()
+{}
+
+void MultiHistogram::addPoint(double temperature, double field, const JointHistogram& histogram, double inefficiency)
+{
+	if (histogram.samples == 0) return;
+
+	ModelParameters parameters = make_parameters(temperature, field);
+
+	auto found = ensembleIndex.find({temperature, field});
+	size_t ensemble;
+	if (found == ensembleIndex.end())
+	{
+		ensemble = betas.size();
+		ensembleIndex[{temperature, field}] = ensemble;
+
+		betas  .push_back(parameters.interactivity / parameters.temperature);
+		fields .push_back(parameters.externalField.z / parameters.interactivity);
+		samples.push_back(0.0);
+	}
+	else ensemble = found->second;
+
+	double g = std::max(1.0, inefficiency);
+	samples[ensemble] += histogram.samples / g;
+
+	for (const auto& bin : histogram.counts)
+	{
+		auto slot = binIndex.find(bin.first);
+		if (slot == binIndex.end())
+		{
+			slot = binIndex.emplace(bin.first, counts.size()).first;
+			counts.push_back(0.0);
+			energies      .push_back(histogram.center(bin.first.first));
+			magnetizations.push_back(histogram.center(bin.first.second));
+		}
+
+		counts[slot->second] += bin.second / g;
+	}
+}
+
+// Logarithm of the Boltzmann weight of the bin in the ensemble, -beta * sites * (e_int - h m):
+inline double MultiHistogram::exponent(double beta, double field, size_t bin) const
+{
+	return -beta * double(sites) * (energies[bin] - field * magnetizations[bin]);
+}
+
+void MultiHistogram::computeDenominators()
+{
+	std::vector<double> terms(betas.size());
+	for (size_t bin = 0; bin < counts.size(); ++bin)
+	{
+		for (size_t k = 0; k < betas.size(); ++k)
+		{
+			terms[k] = logSamples[k] + exponent(betas[k], fields[k], bin) - logPartition[k];
+		}
+
+		logDenominators[bin] = log_sum_exp(terms);
+	}
+}
+
+size_t MultiHistogram::solve()
+{
+	if (betas.empty())
+	{
+		fprintf(stderr, "[ISING-MODEL] No histograms to reweight\n");
+		exit(EXIT_FAILURE);
+	}
+
+	logSamples.resize(betas.size());
+	for (size_t k = 0; k < betas.size(); ++k) logSamples[k] = log(samples[k]);
+
+	logCounts.resize(counts.size());
+	for (size_t bin = 0; bin < counts.size(); ++bin) logCounts[bin] = log(counts[bin]);
+
+	logPartition.assign(betas.size(), 0.0);
+	logDenominators.resize(counts.size());
+
+	std::vector<double> terms(counts.size());
+	for (size_t iteration = 1; iteration <= MAX_ITERATIONS; ++iteration)
+	{
+		computeDenominators();
+
+		double change = 0.0;
+		std::vector<double> next(betas.size());
+		for (size_t k = 0; k < betas.size(); ++k)
+		{
+			for (size_t bin = 0; bin < counts.size(); ++bin)
+			{
+				terms[bin] = logCounts[bin] - logDenominators[bin] + exponent(betas[k], fields[k], bin);
+			}
+
+			next[k] = log_sum_exp(terms);
+		}
+
+		// Partition functions are known up to a common factor, the first one is fixed:
+		for (size_t k = 0; k < betas.size(); ++k)
+		{
+			next[k] -= next[0];
+			change = std::max(change, std::abs(next[k] - logPartition[k]));
+		}
+
+		logPartition = next;
+		if (change < TOLERANCE)
+		{
+			computeDenominators();
+			return iteration;
+		}
+	}
+
+	fprintf(stderr, "[ISING-MODEL] Reweighting did not converge in %zu iterations\n", MAX_ITERATIONS);
+	computeDenominators();
+	return MAX_ITERATIONS;
+}
+
+ReweightedPoint MultiHistogram::reweight(double temperature, double field) const
+{
+	ModelParameters parameters = make_parameters(temperature, field);
+	double beta = parameters.interactivity / parameters.temperature;
+	double h    = parameters.externalField.z / parameters.interactivity;
+
+	std::vector<double> logWeights(counts.size());
+	for (size_t bin = 0; bin < counts.size(); ++bin)
+	{
+		logWeights[bin] = logCounts[bin] - logDenominators[bin] + exponent(beta, h, bin);
+	}
+
+	double logNorm = log_sum_exp(logWeights);
+
+	double m = 0.0, m2 = 0.0, absM = 0.0, e = 0.0, e2 = 0.0;
+	for (size_t bin = 0; bin < counts.size(); ++bin)
+	{
+		double weight = exp(logWeights[bin] - logNorm);
+		double binM = magnetizations[bin];
+		double binE = energies[bin] - h * binM;
+
+		m    += weight * binM;
+		m2   += weight * binM * binM;
+		absM += weight * std::abs(binM);
+		e    += weight * binE;
+		e2   += weight * binE * binE;
+	}
+
+	ReweightedPoint point;
+	point.temperature           = temperature;
+	point.field                 = field;
+	point.magnetization         = m;
+	point.absMagnetization      = absM;
+	point.energy                = e;
+	point.magnetizationVariance = m2 - m * m;
+	point.energyVariance        = e2 - e * e;
+	point.susceptibility        = sites * beta * (m2 - absM * absM);
+	point.specificHeat          = sites * beta * beta * point.energyVariance;
+
+	return point;
+}
+
+#endif  // POTTS_MODEL_REWEIGHTING_HPP_INCLUDED
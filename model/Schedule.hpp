@@ -0,0 +1,226 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_SCHEDULE_HPP_INCLUDED
+#define POTTS_MODEL_SCHEDULE_HPP_INCLUDED
+
+// Schedule mode: one lattice is carried along a path of (temperature, field) points,
+// so every step starts from the configuration the previous step left behind.
+// The path is schedule_path, a comma-separated list of "<Kelvins>:<field>" waypoints
+// (by default from (temperature_start, field_start) to (temperature_end, field_end)).
+// Every segment of the path is split into schedule_steps steps. The first step pays
+// burn_in_samples of equilibration, later steps schedule_burn_in_samples, then
+// every step records saved_data_samples samples. Parameters change:
+//   stepwise   - at the start of every step, which is at one of the segment points
+//                (including the last waypoint);
+//   continuous - every sample, linearly from the point of the step to the next one.
+// Results go to a single .npz file:
+//   schedule   - (steps, 2) starting (temperature, field) of every step in config units;
+//   data       - (steps, saved_data_samples, 4) (temperature, field, magnetization, energy)
+//                samples, NaN past the last sample of a step that reached its target errors;
+//   statistics - (steps, STATISTICS_COLUMNS) summaries of the steps, see Statistics.hpp,
+//                NaN for continuous ramps, whose samples are not from one distribution.
+
+#include "Simulation.hpp"
+#include "Batch.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "vendor/cnpy/cnpy.h"
+
+// Temperature in Kelvins, field in config units:
+struct SchedulePoint
+{
+	double temperature;
+	double field;
+};
+
+std::vector<SchedulePoint> parse_schedule_path(const char* path)
+{
+	std::vector<SchedulePoint> waypoints;
+
+	if (strcmp(path, "none") == 0)
+	{
+		waypoints.push_back({temperature_start, field_start});
+		waypoints.push_back({temperature_end,   field_end  });
+		return waypoints;
+	}
+
+	for (const char* cur = path; *cur != '\0';)
+	{
+		char* end;
+		SchedulePoint waypoint;
+
+		waypoint.temperature = strtod(cur, &end);
+		if (end == cur || *end != ':')
+		{
+			fprintf(stderr, "[ISING-MODEL] Unable to parse schedule_path \"%s\"\n", path);
+			exit(EXIT_FAILURE);
+		}
+
+		cur = end + 1;
+		waypoint.field = strtod(cur, &end);
+		if (end == cur || (*end != ',' && *end != '\0'))
+		{
+			fprintf(stderr, "[ISING-MODEL] Unable to parse schedule_path \"%s\"\n", path);
+			exit(EXIT_FAILURE);
+		}
+
+		waypoints.push_back(waypoint);
+
+		cur = end;
+		if (*cur == ',') ++cur;
+	}
+
+	if (waypoints.empty())
+	{
+		fprintf(stderr, "[ISING-MODEL] Schedule path has no waypoints\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return waypoints;
+}
+
+// Points of every segment, schedule_steps per segment, followed by the last waypoint:
+std::vector<SchedulePoint> schedule_points(const std::vector<SchedulePoint>& waypoints)
+{
+	size_t steps = (schedule_steps == 0)? 1 : schedule_steps;
+
+	std::vector<SchedulePoint> points;
+	for (size_t segment = 0; segment + 1 < waypoints.size(); ++segment)
+	{
+		const SchedulePoint& from = waypoints[segment];
+		const SchedulePoint& to   = waypoints[segment + 1];
+
+		for (size_t step = 0; step < steps; ++step)
+		{
+			double fraction = double(step) / steps;
+			points.push_back({from.temperature + (to.temperature - from.temperature) * fraction,
+			                  from.field       + (to.field       - from.field      ) * fraction});
+		}
+	}
+	points.push_back(waypoints.back());
+
+	return points;
+}
+
+// Rows of (temperature, field, magnetization, energy) with the parameters the sample was taken at:
+struct ScheduleBuffer : SampleSink
+{
+	double* data;
+	const ModelParameters& parameters;
+
+	ScheduleBuffer(double* samples, const ModelParameters& modelParameters);
+
+	void write(const Observation& observation) override;
+	void serialize(CheckpointArchive& archive) override {}
+};
+
+ScheduleBuffer::ScheduleBuffer(double* samples, const ModelParameters& modelParameters) :
+	data       (samples),
+	parameters (modelParameters)
+{}
+
+void ScheduleBuffer::write(const Observation& observation)
+{
+	double* row = &data[4 * observation.sample];
+	row[0] = parameters.temperature / 1.38e-23;
+	row[1] = parameters.externalField.z / (0.01 * magnetic_moment);
+	row[2] = observation.magnetization;
+	row[3] = observation.energy;
+}
+
+// ========================================================================
+// Schedule Run
+// ========================================================================
+
+template <typename Kind>
+void run_schedule_kind(const char* output_file)
+{
+	bool continuous = strcmp(schedule_ramp, "continuous") == 0;
+	if (!continuous && strcmp(schedule_ramp, "stepwise") != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unknown schedule ramp \"%s\"\n", schedule_ramp);
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<SchedulePoint> points = schedule_points(parse_schedule_path(schedule_path));
+
+	// A continuous ramp ends at the last waypoint, no step starts there:
+	size_t steps = (continuous && points.size() > 1)? points.size() - 1 : points.size();
+
+	printf("Computing %zu %s schedule steps from T=%lf H=%lf to T=%lf H=%lf (%s observable kernels)\n",
+	       steps, schedule_ramp, points.front().temperature, points.front().field,
+	       points.back().temperature, points.back().field, observableKernels().isa);
+
+	std::vector<double> schedule(2 * steps);
+	std::vector<double> data(4 * saved_data_samples * steps, NAN);
+	std::vector<double> summaries(STATISTICS_COLUMNS * steps, NAN);
+
+	const SchedulePoint& start = points.front();
+	with_engine<Kind>(make_parameters(start.temperature, start.field), seed, threads,
+	                  [&](auto& isingModel, auto advance, auto /* serialize */)
+	{
+		for (size_t step = 0; step < steps; ++step)
+		{
+			const SchedulePoint& from = points[step];
+			const SchedulePoint& to   = points[(step + 1 < points.size())? step + 1 : step];
+
+			schedule[2 * step + 0] = from.temperature;
+			schedule[2 * step + 1] = from.field;
+
+			// The lattice carried over from the previous step needs a shorter equilibration:
+			size_t burnIn = (step == 0)? burn_in_samples : schedule_burn_in_samples;
+			size_t stepSamples = burnIn + saved_data_samples;
+			size_t sample = 0;
+
+			// Engines pick up new parameters at their next update:
+			isingModel.parameters = make_parameters(from.temperature, from.field);
+
+			auto rampedAdvance = [&]()
+			{
+				if (continuous)
+				{
+					double fraction = double(sample++) / stepSamples;
+					isingModel.parameters = make_parameters(from.temperature + (to.temperature - from.temperature) * fraction,
+					                                        from.field       + (to.field       - from.field      ) * fraction);
+				}
+
+				advance();
+			};
+
+			ScheduleBuffer buffer(&data[4 * saved_data_samples * step], isingModel.parameters);
+			if (continuous)
+			{
+				collect_samples(isingModel, buffer, false, nullptr, rampedAdvance, [](CheckpointArchive&) {}, burnIn);
+			}
+			else
+			{
+				StatisticsSink statistics(buffer);
+				collect_samples(isingModel, statistics, false, nullptr, rampedAdvance, [](CheckpointArchive&) {}, burnIn);
+
+				summary_to_row(statistics.statistics.summary(), &summaries[STATISTICS_COLUMNS * step]);
+			}
+
+			printf("\rComputation in progress: %02.0f%%", 100.0 * (step + 1) / steps);
+			fflush(stdout);
+		}
+	});
+
+	printf("\nComputation completed!\n");
+
+	cnpy::npz_save(output_file, "schedule",   schedule.data(),  {steps, 2},                     "w");
+	cnpy::npz_save(output_file, "data",       data.data(),      {steps, saved_data_samples, 4}, "a");
+	cnpy::npz_save(output_file, "statistics", summaries.data(), {steps, STATISTICS_COLUMNS},    "a");
+}
+
+void run_schedule(const char* output_file)
+{
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		run_schedule_kind<decltype(kind)>(output_file);
+	});
+}
+
+#endif  // POTTS_MODEL_SCHEDULE_HPP_INCLUDED
@@ -0,0 +1,294 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_SIMULATION_HPP_INCLUDED
+#define POTTS_MODEL_SIMULATION_HPP_INCLUDED
+
+// Runs one (temperature, field) point with the update engine chosen in the config.
+// Reads the configuration globals of Config.hpp.
+
+#include "Config.hpp"
+#include "InitialState.hpp"
+#include "Checkpoint.hpp"
+#include "Output.hpp"
+#include "Statistics.hpp"
+#include "Metrics.hpp"
+#include "Model.hpp"
+#include "Checkerboard.hpp"
+#include "Cluster.hpp"
+#include "MultiSpin.hpp"
+#include "NFoldWay.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <memory>
+#include <type_traits>
+
+// Lattices that can hand their states to snapshot measurements, see Output.hpp:
+template <typename Model, typename = void>
+struct CopiesStates : std::false_type {};
+
+template <typename Model>
+struct CopiesStates<Model, std::void_t<decltype(std::declval<Model&>().copyStates(nullptr))>> : std::true_type {};
+
+// Advances the model by one sample between measurements and passes them to the sink.
+// Observables come from running totals, so measuring does not rescan the lattice.
+// With a checkpoint file the run resumes from it and stores its state there
+// every checkpoint_interval samples; serialize walks the state of the engine.
+// The first burnInSamples samples only equilibrate the model.
+// Moves and phase times are published to the metrics of the calling thread once per sample:
+template <typename Model, typename Advance, typename Serialize>
+void collect_samples(Model& isingModel, SampleSink& sink, bool verbose, const char* checkpointFile,
+                     Advance advance, Serialize serialize, size_t burnInSamples = burn_in_samples)
+{
+	uint64_t iteration = 0, cur_saved_data = 0;
+
+	auto serializeRun = [&](CheckpointArchive& archive)
+	{
+		sink.serialize(archive);
+		serialize(archive);
+	};
+
+	std::unique_ptr<Checkpoint> checkpoint;
+	if (checkpointFile != nullptr)
+	{
+		checkpoint.reset(new Checkpoint(checkpointFile,
+			make_checkpoint_header(isingModel.sizeX, isingModel.sizeY, isingModel.sizeZ, isingModel.parameters,
+			                       checkpoint_payload_size(serializeRun))));
+
+		if (checkpoint->restore(&iteration, &cur_saved_data, serializeRun))
+		{
+			printf("Resuming from checkpoint %s at sample %" PRIu64 "\n", checkpointFile, iteration);
+		}
+	}
+
+	size_t sites = size_t(isingModel.sizeX) * isingModel.sizeY * isingModel.sizeZ;
+	sink.start();
+
+	WorkerMetrics& metrics = worker_metrics();
+	metrics.beginPoint(isingModel.parameters.temperature / 1.38e-23);
+	MoveCounters published = isingModel.moves;
+
+	for (; iteration < burnInSamples + saved_data_samples; ++iteration)
+	{
+		if (verbose)
+		{
+			printf("\rComputation in progress: %02.0f%%", 100.0 * cur_saved_data/saved_data_samples);
+			fflush(stdout);
+		}
+
+		uint64_t phaseStart = metrics_clock();
+
+		advance();
+
+		uint64_t phaseEnd = metrics_clock();
+		metrics.addPhase(PHASE_MC, phaseEnd - phaseStart);
+		metrics.addMoves({isingModel.moves.attempted - published.attempted,
+		                  isingModel.moves.accepted  - published.accepted});
+		published = isingModel.moves;
+
+		if (burnInSamples <= iteration && cur_saved_data < saved_data_samples)
+		{
+			phaseStart = phaseEnd;
+
+			sink.write({cur_saved_data, magnetic_moment * isingModel.magnetization(), isingModel.energy(), sites});
+
+			// Snapshots are copied here and measured elsewhere:
+			if constexpr (CopiesStates<Model>::value)
+			{
+				if (uint8_t* snapshot = sink.snapshotBuffer(cur_saved_data))
+				{
+					isingModel.copyStates(snapshot);
+					sink.snapshotTaken();
+				}
+			}
+
+			++cur_saved_data;
+
+			phaseEnd = metrics_clock();
+			metrics.addPhase(PHASE_MEASURE, phaseEnd - phaseStart);
+			metrics.addSample();
+
+			// The statistics stage may find the point converged early:
+			if (sink.done()) break;
+		}
+
+		// Guard running totals against accumulated rounding:
+		if (drift_check_interval != 0 && (iteration + 1) % drift_check_interval == 0)
+		{
+			double drift = isingModel.resyncTotals();
+			if (drift > 1e-9)
+			{
+				fprintf(stderr, "\n[ISING-MODEL] Running totals drifted by %e, resynchronized\n", drift);
+			}
+		}
+
+		if (checkpoint && checkpoint_interval != 0 && (iteration + 1) % checkpoint_interval == 0)
+		{
+			phaseStart = metrics_clock();
+
+			sink.flush();
+			checkpoint->store(iteration + 1, cur_saved_data, serializeRun);
+
+			metrics.addPhase(PHASE_IO, metrics_clock() - phaseStart);
+		}
+	}
+
+	uint64_t flushStart = metrics_clock();
+	sink.flush();
+	metrics.addPhase(PHASE_IO, metrics_clock() - flushStart);
+
+	metrics.endPoint();
+}
+
+// Builds the lattice and the update engine of the config and calls run(isingModel, advance, serialize),
+// where advance() moves the model by one sample and serialize walks the state of the engine.
+// Sweep engines spread every sweep over poolThreads threads:
+template <typename Kind, typename Run>
+void with_engine(const ModelParameters& parameters, uint64_t pointSeed, size_t poolThreads, Run run)
+{
+	// A two-dimensional lattice ignores lattice_size_z:
+	int sizeX = lattice_size_x;
+	int sizeY = lattice_size_y;
+	int sizeZ = (Kind::DIMENSION == 3)? lattice_size_z : 1;
+
+	// Single-site updates at random sites or their rejection-free n-fold way equivalent,
+	// full checkerboard sweeps over a thread pool,
+	// for two-state graphs multi-spin coded checkerboard sweeps or cluster updates:
+	constexpr bool twoStates = Kind::STATES == 2;
+	constexpr bool bitPacked = twoStates && Kind::DIMENSION == 3;
+
+	bool metropolis    = strcmp(update_engine, "metropolis") == 0;
+	bool checkerboard  = strcmp(update_engine, "checkerboard") == 0 && !bitPacked;
+	bool multispin     = strcmp(update_engine, "multispin") == 0 ||
+	                    (strcmp(update_engine, "checkerboard") == 0 &&  bitPacked);
+	bool wolff         = strcmp(update_engine, "wolff") == 0;
+	bool swendsenWang  = strcmp(update_engine, "swendsen_wang") == 0;
+	bool nFoldWay      = strcmp(update_engine, "n_fold_way") == 0;
+	if (!metropolis && !checkerboard && !multispin && !wolff && !swendsenWang && !nFoldWay)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unknown update engine \"%s\"\n", update_engine);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((multispin && !bitPacked) || ((wolff || swendsenWang) && !twoStates))
+	{
+		fprintf(stderr, "[ISING-MODEL] Update engine \"%s\" is not available for this model\n", update_engine);
+		exit(EXIT_FAILURE);
+	}
+
+	ThreadPool pool((metropolis || wolff || nFoldWay)? 1 : poolThreads);
+
+	if constexpr (bitPacked)
+	{
+		if (multispin)
+		{
+			MultiSpinLattice<Kind> isingModel(sizeX, sizeY, sizeZ, getStateX<Kind>, getStateY<Kind>,
+			                                  pointSeed, parameters, pool);
+
+			run(isingModel, [&]()
+			{
+				for (size_t sweep = 0; sweep < sweeps_per_sample; ++sweep)
+					isingModel.sweep();
+			},
+			[&](CheckpointArchive& archive)
+			{
+				isingModel.serialize(archive);
+			});
+			return;
+		}
+	}
+
+	Lattice<Kind> isingModel(sizeX, sizeY, sizeZ, getStateX<Kind>, getStateY<Kind>, pointSeed, parameters,
+	                         layout_from_name(lattice_layout));
+
+	if constexpr (twoStates)
+	{
+		if (wolff || swendsenWang)
+		{
+			ClusterUpdater<Kind> updater(isingModel, pool);
+
+			// A Wolff sweep flips clusters until as many sites as the lattice has were flipped:
+			run(isingModel, [&]()
+			{
+				for (size_t sweep = 0; sweep < sweeps_per_sample; ++sweep)
+				{
+					if (wolff) updater.wolffSweep();
+					else       updater.swendsenWangSweep();
+				}
+			},
+			[&](CheckpointArchive& archive)
+			{
+				isingModel.serialize(archive);
+				updater.serialize(archive);
+			});
+			return;
+		}
+	}
+
+	if (nFoldWay)
+	{
+		NFoldWay<Kind> engine(isingModel);
+
+		// As many attempts per sample as the metropolis engine makes:
+		run(isingModel, [&]()
+		{
+			engine.advance(mc_iters_per_sample);
+		},
+		[&](CheckpointArchive& archive)
+		{
+			isingModel.serialize(archive);
+			engine.serialize(archive);
+		});
+	}
+	else if (checkerboard)
+	{
+		CheckerboardSweep<Kind> sweeper(isingModel, pool);
+
+		run(isingModel, [&]()
+		{
+			for (size_t sweep = 0; sweep < sweeps_per_sample; ++sweep)
+				sweeper.sweep();
+		},
+		[&](CheckpointArchive& archive)
+		{
+			isingModel.serialize(archive);
+			sweeper.serialize(archive);
+		});
+	}
+	else
+	{
+		run(isingModel, [&]()
+		{
+			for (size_t iter = 0; iter < mc_iters_per_sample; ++iter)
+				isingModel.metropolisStep();
+		},
+		[&](CheckpointArchive& archive)
+		{
+			isingModel.serialize(archive);
+		});
+	}
+}
+
+// Passes saved_data_samples samples to the sink:
+template <typename Kind>
+void simulate_kind(const ModelParameters& parameters, uint64_t pointSeed, size_t poolThreads,
+                   SampleSink& sink, bool verbose, const char* checkpointFile = nullptr)
+{
+	with_engine<Kind>(parameters, pointSeed, poolThreads, [&](auto& isingModel, auto advance, auto serialize)
+	{
+		collect_samples(isingModel, sink, verbose, checkpointFile, advance, serialize);
+	});
+}
+
+// Runs the precompiled model selected by the config:
+void simulate_point(const ModelParameters& parameters, uint64_t pointSeed, size_t poolThreads,
+                    SampleSink& sink, bool verbose, const char* checkpointFile = nullptr)
+{
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		simulate_kind<decltype(kind)>(parameters, pointSeed, poolThreads, sink, verbose, checkpointFile);
+	});
+}
+
+#endif  // POTTS_MODEL_SIMULATION_HPP_INCLUDED
@@ -3,46 +3,114 @@
 #define POTTS_MODEL_STATE_GRAPH_HPP_INCLUDED
 
 #include "Vector.hpp"
+#include <array>
 #include <cmath>
 #include <cstdio>
 #include <assert.h>
 
-#define STATE_GRAPH_SIZE_X 1
-#define STATE_GRAPH_SIZE_Y 2
+// ========================================================================
+// Compile-Time Math
+// ========================================================================
 
+constexpr double CONSTEXPR_PI = 3.14159265358979323846;
+
+// Taylor series after reduction to [-pi, pi]:
+constexpr double constexprSin(double angle)
+{
+	while (angle >  CONSTEXPR_PI) angle -= 2.0 * CONSTEXPR_PI;
+	while (angle < -CONSTEXPR_PI) angle += 2.0 * CONSTEXPR_PI;
+
+	double term = angle, sum = angle;
+	for (int n = 1; n < 30; ++n)
+	{
+		term *= -angle * angle / ((2 * n) * (2 * n + 1));
+		sum  += term;
+	}
+
+	return sum;
+}
+
+constexpr double constexprCos(double angle)
+{
+	return constexprSin(angle + CONSTEXPR_PI / 2);
+}
+
+// Newton iterations:
+constexpr double constexprSqrt(double value)
+{
+	if (value <= 0.0) return 0.0;
+
+	double root = (value < 1.0)? 1.0 : value;
+	for (int i = 0; i < 100; ++i)
+	{
+		root = 0.5 * (root + value / root);
+	}
+
+	return root;
+}
+
+// ========================================================================
+// State Graph
+// ========================================================================
+
+// Spins spread over the sphere: x selects the longtitude, y the height.
+// With latitude = acos(2y/(SIZE_Y - 1) - 1) - pi/2 the components reduce to
+// z = sin(latitude) = 1 - 2y/(SIZE_Y - 1) and cos(latitude) = sqrt(1 - z^2),
+// so the whole table is computed at compile time.
+template <int SIZE_X, int SIZE_Y>
+constexpr std::array<double, SIZE_X * SIZE_Y> fibonacciSpinComponent(int component)
+{
+	std::array<double, SIZE_X * SIZE_Y> values {};
+
+	for (int x = 0; x < SIZE_X; ++x)
+	{
+		for (int y = 0; y < SIZE_Y; ++y)
+		{
+			double longtitude = 2.0 * CONSTEXPR_PI * x/SIZE_X;
+			double height     = 1.0 - 2.0 * y/(SIZE_Y - 1);
+			double radius     = constexprSqrt(1.0 - height * height);
+
+			values[x * SIZE_Y + y] = (component == 0)? radius * constexprCos(longtitude) :
+			                         (component == 1)? radius * constexprSin(longtitude) : height;
+		}
+	}
+
+	return values;
+}
+
+template <int GRAPH_SIZE_X, int GRAPH_SIZE_Y>
 struct FibonacciSpinStateGraph
 {
-	Vector spins[STATE_GRAPH_SIZE_X * STATE_GRAPH_SIZE_Y];
+	static constexpr int SIZE_X = GRAPH_SIZE_X;
+	static constexpr int SIZE_Y = GRAPH_SIZE_Y;
+	static constexpr int STATES = GRAPH_SIZE_X * GRAPH_SIZE_Y;
+
+	static_assert(SIZE_X >= 1 && SIZE_Y >= 2, "State graph needs at least two heights");
+
+	static constexpr std::array<double, STATES> SPIN_X = fibonacciSpinComponent<SIZE_X, SIZE_Y>(0);
+	static constexpr std::array<double, STATES> SPIN_Y = fibonacciSpinComponent<SIZE_X, SIZE_Y>(1);
+	static constexpr std::array<double, STATES> SPIN_Z = fibonacciSpinComponent<SIZE_X, SIZE_Y>(2);
+
+	Vector spins[STATES];
 
 	FibonacciSpinStateGraph();
 	inline Vector get(int x, int y) const;
 };
 
-FibonacciSpinStateGraph::FibonacciSpinStateGraph() : 
-	spins ({})
+template <int GRAPH_SIZE_X, int GRAPH_SIZE_Y>
+FibonacciSpinStateGraph<GRAPH_SIZE_X, GRAPH_SIZE_Y>::FibonacciSpinStateGraph() :
+	spins {}
 {
-	for (size_t x = 0; x < STATE_GRAPH_SIZE_X; ++x)
+	for (int state = 0; state < STATES; ++state)
 	{
-		for (size_t y = 0; y < STATE_GRAPH_SIZE_Y; ++y)
-		{
-			double longtitude = 2.0 * M_PI * x/(STATE_GRAPH_SIZE_X);
-			double latitude = acos(2.0 * y/(STATE_GRAPH_SIZE_Y-1) - 1) - M_PI/2;
-
-			spins[x * STATE_GRAPH_SIZE_Y + y].x = cos(latitude) * cos(longtitude);
-			spins[x * STATE_GRAPH_SIZE_Y + y].y = cos(latitude) * sin(longtitude);
-			spins[x * STATE_GRAPH_SIZE_Y + y].z = sin(latitude);
-
-			// printf("[%ld, %ld] {%f, %f, %f}\n", x, y, 
-			//         spins[x * STATE_GRAPH_SIZE_Y + y].x,
-			//         spins[x * STATE_GRAPH_SIZE_Y + y].y,
-			//         spins[x * STATE_GRAPH_SIZE_Y + y].z);
-		}
+		spins[state] = Vector(SPIN_X[state], SPIN_Y[state], SPIN_Z[state]);
 	}
 }
 
-inline Vector FibonacciSpinStateGraph::get(int x, int y) const
-{	
-	return spins[x * STATE_GRAPH_SIZE_Y + y];
+template <int GRAPH_SIZE_X, int GRAPH_SIZE_Y>
+inline Vector FibonacciSpinStateGraph<GRAPH_SIZE_X, GRAPH_SIZE_Y>::get(int x, int y) const
+{
+	return spins[x * SIZE_Y + y];
 }
 
-#endif  // POTTS_MODEL_STATE_GRAPH_HPP_INCLUDED
\ No newline at end of file
+#endif  // POTTS_MODEL_STATE_GRAPH_HPP_INCLUDED
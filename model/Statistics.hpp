@@ -0,0 +1,401 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_STATISTICS_HPP_INCLUDED
+#define POTTS_MODEL_STATISTICS_HPP_INCLUDED
+
+// Online analysis of the sample series of one point.
+// Samples are reduced to per-site values (m in units of the spin length,
+// e in units of interactivity) and accumulated into at most MAX_BINS bins.
+// When the bins run out, neighbouring bins are merged and the bin size doubles,
+// so memory is constant and the bins always cover the whole retained series.
+//   errors      - from the scatter of block means, blocks being 1, 2, 4... bins long
+//                 while there are at least MIN_BLOCKS of them; the largest error
+//                 is taken, as it is the one closest to the plateau (binning analysis);
+//   tau_int     - error^2 * samples / (2 var(samples)), in samples;
+//   variances   - <x^2> - <x>^2 with jackknife errors over the bins;
+//   equilibrium - whenever the bin count reaches a power of two, the first and
+//                 the second half of the bins are compared for e and |m|.
+//                 A difference over EQUILIBRATION_SIGMAS errors means the series
+//                 still drifts, and the oldest quarter of the bins is discarded.
+// Errors are only meaningful once the longest block is much longer than tau_int.
+
+#include "Config.hpp"
+#include "Output.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+struct StatisticsBin
+{
+	double count;
+	double sumM, sumM2, sumAbsM;
+	double sumE, sumE2;
+
+	inline void add(const StatisticsBin& other);
+};
+
+inline void StatisticsBin::add(const StatisticsBin& other)
+{
+	count   += other.count;
+	sumM    += other.sumM;
+	sumM2   += other.sumM2;
+	sumAbsM += other.sumAbsM;
+	sumE    += other.sumE;
+	sumE2   += other.sumE2;
+}
+
+struct StatisticsSummary
+{
+	uint64_t samples;   // Retained after equilibration
+	uint64_t discarded;
+	uint64_t blockLength; // Samples in the longest block of the error estimates
+	bool equilibrated;
+
+	double magnetization,    magnetizationError,    magnetizationTau;
+	double absMagnetization, absMagnetizationError;
+	double energy,           energyError,           energyTau;
+
+	double magnetizationVariance, magnetizationVarianceError;
+	double energyVariance,        energyVarianceError;
+};
+
+// Columns of the statistics arrays of batch mode and the computing grid:
+const size_t STATISTICS_COLUMNS = 14;
+
+void summary_to_row(const StatisticsSummary& summary, double* row)
+{
+	double values[STATISTICS_COLUMNS] =
+	{
+		double(summary.samples), double(summary.discarded),
+		summary.magnetization,    summary.magnetizationError, summary.magnetizationTau,
+		summary.absMagnetization, summary.absMagnetizationError,
+		summary.energy,           summary.energyError,        summary.energyTau,
+		summary.magnetizationVariance, summary.magnetizationVarianceError,
+		summary.energyVariance,        summary.energyVarianceError
+	};
+
+	memcpy(row, values, sizeof(values));
+}
+
+// ========================================================================
+// Binned Series
+// ========================================================================
+
+struct SampleStatistics
+{
+	static const size_t MAX_BINS               = 128;
+	static const size_t MIN_EQUILIBRATION_BINS = 16;
+	static const size_t MIN_BLOCKS             = 8;
+	static constexpr double EQUILIBRATION_SIGMAS = 4.0;
+
+	StatisticsBin bins[MAX_BINS];
+	size_t binCount;
+	uint64_t binSize;
+	StatisticsBin current;
+	uint64_t discarded;
+	bool equilibrated;
+
+	SampleStatistics();
+
+	void add(double m, double e);
+	void pushBin();
+	void checkEquilibration();
+	void discardBins(size_t count);
+
+	void meanAndError(double StatisticsBin::* sum, size_t first, size_t last, double* mean, double* error) const;
+	void varianceJackknife(double StatisticsBin::* sum, double StatisticsBin::* sumSquares,
+	                       double* variance, double* error) const;
+
+	StatisticsSummary summary() const;
+};
+
+SampleStatistics::SampleStatistics() :
+	bins         (),
+	binCount     (0),
+	binSize      (1),
+	current      (),
+	discarded    (0),
+	equilibrated (false)
+{}
+
+void SampleStatistics::add(double m, double e)
+{
+	current.add({1.0, m, m * m, std::abs(m), e, e * e});
+
+	if (current.count == binSize) pushBin();
+}
+
+void SampleStatistics::pushBin()
+{
+	bins[binCount++] = current;
+	current = StatisticsBin();
+
+	if (binCount == MAX_BINS)
+	{
+		for (size_t i = 0; i < MAX_BINS / 2; ++i)
+		{
+			bins[i] = bins[2 * i];
+			bins[i].add(bins[2 * i + 1]);
+		}
+
+		binCount = MAX_BINS / 2;
+		binSize *= 2;
+	}
+
+	// Powers of two only, so the test runs a logarithmic number of times:
+	if (binCount >= MIN_EQUILIBRATION_BINS && (binCount & (binCount - 1)) == 0) checkEquilibration();
+}
+
+void SampleStatistics::checkEquilibration()
+{
+	size_t half = binCount / 2;
+
+	equilibrated = true;
+	for (double StatisticsBin::* sum : {&StatisticsBin::sumE, &StatisticsBin::sumAbsM})
+	{
+		double meanFirst, errorFirst, meanSecond, errorSecond;
+		meanAndError(sum, 0,    half,     &meanFirst,  &errorFirst);
+		meanAndError(sum, half, binCount, &meanSecond, &errorSecond);
+
+		double sigma = sqrt(errorFirst * errorFirst + errorSecond * errorSecond);
+		if (std::abs(meanFirst - meanSecond) > EQUILIBRATION_SIGMAS * sigma) equilibrated = false;
+	}
+
+	if (!equilibrated) discardBins(binCount / 4);
+}
+
+void SampleStatistics::discardBins(size_t count)
+{
+	for (size_t i = count; i < binCount; ++i)
+	{
+		bins[i - count] = bins[i];
+	}
+
+	binCount  -= count;
+	discarded += count * binSize;
+}
+
+// Bins of the range have equal sizes, bins past the last whole block only enter the mean:
+void SampleStatistics::meanAndError(double StatisticsBin::* sum, size_t first, size_t last,
+                                    double* mean, double* error) const
+{
+	size_t count = last - first;
+
+	double total = 0.0;
+	for (size_t i = first; i < last; ++i) total += bins[i].*sum / bins[i].count;
+	*mean = total / count;
+
+	*error = (count < 2)? NAN : 0.0;
+
+	for (size_t block = 1; count >= 2 && (block == 1 || count / block >= MIN_BLOCKS); block *= 2)
+	{
+		size_t blocks = count / block;
+
+		double blockMeans[MAX_BINS];
+		double blockTotal = 0.0;
+		for (size_t b = 0; b < blocks; ++b)
+		{
+			blockMeans[b] = 0.0;
+			for (size_t i = first + b * block; i < first + (b + 1) * block; ++i)
+			{
+				blockMeans[b] += bins[i].*sum / bins[i].count / block;
+			}
+
+			blockTotal += blockMeans[b];
+		}
+
+		double scatter = 0.0;
+		for (size_t b = 0; b < blocks; ++b)
+		{
+			double deviation = blockMeans[b] - blockTotal / blocks;
+			scatter += deviation * deviation;
+		}
+
+		*error = std::max(*error, sqrt(scatter / (blocks - 1) / blocks));
+	}
+}
+
+void SampleStatistics::varianceJackknife(double StatisticsBin::* sum, double StatisticsBin::* sumSquares,
+                                         double* variance, double* error) const
+{
+	StatisticsBin total = StatisticsBin();
+	for (size_t i = 0; i < binCount; ++i) total.add(bins[i]);
+
+	auto variance_of = [&](double count, double sumValue, double sumSquareValues)
+	{
+		double mean = sumValue / count;
+		return sumSquareValues / count - mean * mean;
+	};
+
+	*variance = variance_of(total.count, total.*sum, total.*sumSquares);
+
+	// Leave-one-bin-out estimates:
+	double estimates[MAX_BINS];
+	double estimateMean = 0.0;
+	for (size_t i = 0; i < binCount; ++i)
+	{
+		estimates[i] = variance_of(total.count - bins[i].count, total.*sum - bins[i].*sum,
+		                           total.*sumSquares - bins[i].*sumSquares);
+		estimateMean += estimates[i] / binCount;
+	}
+
+	double scatter = 0.0;
+	for (size_t i = 0; i < binCount; ++i)
+	{
+		scatter += (estimates[i] - estimateMean) * (estimates[i] - estimateMean);
+	}
+
+	*error = (binCount < 2)? NAN : sqrt(scatter * (binCount - 1) / binCount);
+}
+
+StatisticsSummary SampleStatistics::summary() const
+{
+	StatisticsSummary result = StatisticsSummary();
+	result.samples      = binCount * binSize;
+	result.discarded    = discarded;
+	result.equilibrated = equilibrated;
+
+	if (binCount == 0)
+	{
+		result.magnetization = result.absMagnetization = result.energy = NAN;
+		result.magnetizationError = result.absMagnetizationError = result.energyError = NAN;
+		result.magnetizationTau = result.energyTau = NAN;
+		result.magnetizationVariance = result.energyVariance = NAN;
+		result.magnetizationVarianceError = result.energyVarianceError = NAN;
+		return result;
+	}
+
+	meanAndError(&StatisticsBin::sumM,    0, binCount, &result.magnetization,    &result.magnetizationError);
+	meanAndError(&StatisticsBin::sumAbsM, 0, binCount, &result.absMagnetization, &result.absMagnetizationError);
+	meanAndError(&StatisticsBin::sumE,    0, binCount, &result.energy,           &result.energyError);
+
+	size_t blockBins = 1;
+	while (binCount / (2 * blockBins) >= MIN_BLOCKS) blockBins *= 2;
+	result.blockLength = blockBins * binSize;
+
+	varianceJackknife(&StatisticsBin::sumM, &StatisticsBin::sumM2,
+	                  &result.magnetizationVariance, &result.magnetizationVarianceError);
+	varianceJackknife(&StatisticsBin::sumE, &StatisticsBin::sumE2,
+	                  &result.energyVariance, &result.energyVarianceError);
+
+	// A series without fluctuations is uncorrelated by convention:
+	auto tau = [&](double error, double variance)
+	{
+		return (variance > 0.0)? 0.5 * error * error * result.samples / variance : 0.5;
+	};
+
+	result.magnetizationTau = tau(result.magnetizationError, result.magnetizationVariance);
+	result.energyTau        = tau(result.energyError,        result.energyVariance);
+
+	return result;
+}
+
+// ========================================================================
+// Statistics Stage Of The Sampling Loop
+// ========================================================================
+
+// Forwards samples to another sink and analyses them on the way.
+// With target_error_magnetization or target_error_energy set, reports the run
+// done once the series is equilibrated, has at least MIN_BINS bins, its longest
+// blocks span PLATEAU_TAUS autocorrelation times and the errors of <m> and <e>
+// are within the targets:
+struct StatisticsSink : SampleSink
+{
+	static const size_t MIN_BINS     = 32;
+	static const size_t PLATEAU_TAUS = 8;
+
+	SampleSink& output;
+	SampleStatistics statistics;
+	bool converged;
+
+	StatisticsSink(SampleSink& outputSink);
+
+	void start() override;
+	void write(const Observation& observation) override;
+	void flush() override;
+	bool done() override;
+	void serialize(CheckpointArchive& archive) override;
+};
+
+StatisticsSink::StatisticsSink(SampleSink& outputSink) :
+	output     (outputSink),
+	statistics (),
+	converged  (false)
+{}
+
+void StatisticsSink::start()
+{
+	output.start();
+}
+
+void StatisticsSink::write(const Observation& observation)
+{
+	output.write(observation);
+
+	size_t bins = statistics.binCount;
+	statistics.add(observation.magnetization / magnetic_moment,
+	               observation.energy        / (observation.sites * interactivity));
+
+	// Targets are checked once per completed bin:
+	bool adaptive = target_error_magnetization > 0.0 || target_error_energy > 0.0;
+	if (adaptive && statistics.binCount != bins && statistics.binCount >= MIN_BINS && statistics.equilibrated)
+	{
+		StatisticsSummary summary = statistics.summary();
+
+		// Blocks much shorter than tau make the errors too small to stop on:
+		converged = (target_error_magnetization <= 0.0 ||
+		             (summary.magnetizationError <= target_error_magnetization &&
+		              PLATEAU_TAUS * summary.magnetizationTau <= summary.blockLength)) &&
+		            (target_error_energy <= 0.0 ||
+		             (summary.energyError <= target_error_energy &&
+		              PLATEAU_TAUS * summary.energyTau <= summary.blockLength));
+	}
+}
+
+void StatisticsSink::flush()
+{
+	output.flush();
+}
+
+bool StatisticsSink::done()
+{
+	return converged;
+}
+
+void StatisticsSink::serialize(CheckpointArchive& archive)
+{
+	output.serialize(archive);
+
+	archive.value(statistics);
+	archive.value(converged);
+}
+
+// Summary of finished samples, the same StatisticsSink computes on the fly:
+StatisticsSummary summarize_samples(const double* samples, size_t count, size_t sites)
+{
+	SampleStatistics statistics;
+	for (size_t i = 0; i < count && !std::isnan(samples[2 * i]); ++i)
+	{
+		statistics.add(samples[2 * i + 0] / magnetic_moment,
+		               samples[2 * i + 1] / (sites * interactivity));
+	}
+
+	return statistics.summary();
+}
+
+void print_summary(const StatisticsSummary& summary)
+{
+	printf("Statistics over %" PRIu64 " samples (%" PRIu64 " discarded as not equilibrated%s):\n",
+	       summary.samples, summary.discarded, summary.equilibrated? "" : ", STILL DRIFTING");
+	printf("  <m>   = % .6e +- %.2e  (tau_int = %.1f samples)\n",
+	       summary.magnetization, summary.magnetizationError, summary.magnetizationTau);
+	printf("  <|m|> = % .6e +- %.2e\n", summary.absMagnetization, summary.absMagnetizationError);
+	printf("  <e>   = % .6e +- %.2e  (tau_int = %.1f samples)\n",
+	       summary.energy, summary.energyError, summary.energyTau);
+	printf("  var m = % .6e +- %.2e\n", summary.magnetizationVariance, summary.magnetizationVarianceError);
+	printf("  var e = % .6e +- %.2e\n", summary.energyVariance, summary.energyVarianceError);
+	printf("  longest error block = %" PRIu64 " samples\n", summary.blockLength);
+}
+
+#endif  // POTTS_MODEL_STATISTICS_HPP_INCLUDED
@@ -0,0 +1,180 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_TEMPERING_HPP_INCLUDED
+#define POTTS_MODEL_TEMPERING_HPP_INCLUDED
+
+// Parallel tempering (replica exchange) mode.
+// One lattice per temperature of the ladder temperature_start..temperature_end
+// is advanced on its own thread by the metropolis or checkerboard engine.
+// Every exchange_interval samples, neighbouring temperatures attempt to swap
+// configurations with probability min(1, exp((1/T_i - 1/T_j) * (E_i - E_j))),
+// alternating even and odd pairs.
+// Results go to a single .npz file:
+//   temperatures    - (temperature_steps) ladder in Kelvins;
+//   data            - (temperature_steps, saved_data_samples, 2) samples per temperature;
+//   swap_acceptance - (temperature_steps - 1) acceptance ratio of every neighbour pair.
+
+#include "Model.hpp"
+#include "Checkerboard.hpp"
+#include "ThreadPool.hpp"
+#include "Batch.hpp"
+
+#include <memory>
+#include <vector>
+
+#include "vendor/cnpy/cnpy.h"
+
+template <typename Kind>
+void run_tempering_kind(const char* output_file)
+{
+	int sizeX = lattice_size_x;
+	int sizeY = lattice_size_y;
+	int sizeZ = (Kind::DIMENSION == 3)? lattice_size_z : 1;
+
+	size_t rungs = temperature_steps;
+	if (rungs < 2)
+	{
+		fprintf(stderr, "[ISING-MODEL] Parallel tempering requires temperature_steps >= 2\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bool metropolis = strcmp(update_engine, "metropolis") == 0;
+	if (!metropolis && strcmp(update_engine, "checkerboard") != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Update engine \"%s\" is not supported in tempering mode\n", update_engine);
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<double> ladder(rungs);
+	std::vector<std::unique_ptr<Lattice<Kind>>>           replicas;
+	std::vector<std::unique_ptr<ThreadPool>>              replicaPools;
+	std::vector<std::unique_ptr<CheckerboardSweep<Kind>>> sweepers;
+
+	for (size_t rung = 0; rung < rungs; ++rung)
+	{
+		ladder[rung] = linspace_at(temperature_start, temperature_end, rungs, rung);
+
+		replicas.emplace_back(new Lattice<Kind>(sizeX, sizeY, sizeZ, getStateX<Kind>, getStateY<Kind>,
+		                                        counterHash(seed, rung), make_parameters(ladder[rung], field_start),
+		                                        layout_from_name(lattice_layout)));
+
+		// Replicas already run concurrently, so each sweep is single-threaded:
+		if (!metropolis)
+		{
+			replicaPools.emplace_back(new ThreadPool(1));
+			sweepers.emplace_back(new CheckerboardSweep<Kind>(*replicas[rung], *replicaPools[rung]));
+		}
+	}
+
+	printf("Computing %zu temperatures from T=%lf to T=%lf at H=%lf\n",
+	       rungs, ladder.front(), ladder.back(), field_start);
+
+	std::vector<double> data(2 * saved_data_samples * rungs);
+	std::vector<size_t> swapsAttempted(rungs - 1), swapsAccepted(rungs - 1);
+	std::vector<MoveCounters> published(rungs, MoveCounters{0, 0});
+	RandomStream exchangeStream(seed, rungs + 1);
+
+	WorkerMetrics& mainMetrics = worker_metrics();
+
+	ThreadPool pool(threads);
+
+	for (size_t iteration = 0, cur_saved_data = 0; iteration < burn_in_samples + saved_data_samples; ++iteration)
+	{
+		printf("\rComputation in progress: %02.0f%%", 100.0 * cur_saved_data/saved_data_samples);
+		fflush(stdout);
+
+		pool.run(rungs, [&](size_t rung, size_t /* worker */)
+		{
+			Lattice<Kind>& replica = *replicas[rung];
+
+			// Replicas move between pool threads, so their moves go straight to the temperature totals:
+			WorkerMetrics& metrics = worker_metrics();
+			uint64_t phaseStart = metrics_clock();
+
+			if (metropolis)
+			{
+				for (size_t iter = 0; iter < mc_iters_per_sample; ++iter)
+					replica.metropolisStep();
+			}
+			else
+			{
+				for (size_t sweep = 0; sweep < sweeps_per_sample; ++sweep)
+					sweepers[rung]->sweep();
+			}
+
+			MoveCounters moves = {replica.moves.attempted - published[rung].attempted,
+			                      replica.moves.accepted  - published[rung].accepted};
+			published[rung] = replica.moves;
+
+			metrics.addPhase(PHASE_MC, metrics_clock() - phaseStart);
+			metrics.addMoves(moves);
+			metrics_registry.addTemperatureMoves(ladder[rung], moves);
+
+			if (drift_check_interval != 0 && (iteration + 1) % drift_check_interval == 0)
+			{
+				replica.resyncTotals();
+			}
+		});
+
+		if (burn_in_samples <= iteration && cur_saved_data < saved_data_samples)
+		{
+			uint64_t phaseStart = metrics_clock();
+
+			for (size_t rung = 0; rung < rungs; ++rung)
+			{
+				double* sample = &data[2 * (rung * saved_data_samples + cur_saved_data)];
+				sample[0] = magnetic_moment * replicas[rung]->magnetization();
+				sample[1] = replicas[rung]->energy();
+			}
+
+			++cur_saved_data;
+
+			mainMetrics.addPhase(PHASE_MEASURE, metrics_clock() - phaseStart);
+			mainMetrics.addSample();
+		}
+
+		// Replica exchange between neighbouring temperatures:
+		if (exchange_interval != 0 && (iteration + 1) % exchange_interval == 0)
+		{
+			size_t exchange = (iteration + 1) / exchange_interval;
+			for (size_t rung = exchange % 2; rung + 1 < rungs; rung += 2)
+			{
+				Lattice<Kind>& cold = *replicas[rung];
+				Lattice<Kind>& hot  = *replicas[rung + 1];
+
+				double logRatio = (1.0 / cold.parameters.temperature - 1.0 / hot.parameters.temperature) *
+				                  (cold.energy() - hot.energy());
+
+				++swapsAttempted[rung];
+				if (logRatio >= 0.0 || exchangeStream.uniform() < exp(logRatio))
+				{
+					cold.swapConfiguration(hot);
+					++swapsAccepted[rung];
+				}
+			}
+		}
+	}
+
+	printf("\rComputation in progress: %02.0f%%", 100.0);
+	printf("\nComputation completed!\n");
+
+	std::vector<double> swapAcceptance(rungs - 1);
+	for (size_t rung = 0; rung + 1 < rungs; ++rung)
+	{
+		swapAcceptance[rung] = (swapsAttempted[rung] == 0)? 0.0 : double(swapsAccepted[rung]) / swapsAttempted[rung];
+		printf("Swap acceptance T=%lf <-> T=%lf: %0.03lf\n", ladder[rung], ladder[rung + 1], swapAcceptance[rung]);
+	}
+
+	cnpy::npz_save(output_file, "temperatures",    ladder.data(),         {rungs},                        "w");
+	cnpy::npz_save(output_file, "data",            data.data(),           {rungs, saved_data_samples, 2}, "a");
+	cnpy::npz_save(output_file, "swap_acceptance", swapAcceptance.data(), {rungs - 1},                    "a");
+}
+
+void run_tempering(const char* output_file)
+{
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		run_tempering_kind<decltype(kind)>(output_file);
+	});
+}
+
+#endif  // POTTS_MODEL_TEMPERING_HPP_INCLUDED
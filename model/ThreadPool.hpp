@@ -0,0 +1,132 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_THREAD_POOL_HPP_INCLUDED
+#define POTTS_MODEL_THREAD_POOL_HPP_INCLUDED
+
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+
+// Fixed set of worker threads executing data-parallel jobs.
+// The calling thread takes part in every job as worker 0,
+// so a pool of one thread spawns nothing and runs jobs inline.
+struct ThreadPool
+{
+	typedef std::function<void(size_t /* task */, size_t /* worker */)> Job;
+
+	size_t numThreads;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+
+	const Job* job;
+	size_t numTasks;
+	std::atomic<size_t> nextTask;
+	size_t busyWorkers;
+	size_t generation;
+	bool shuttingDown;
+
+	ThreadPool(size_t threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void run(size_t tasks, const Job& func);
+
+	void workerLoop(size_t workerIndex);
+	void executeTasks(size_t workerIndex);
+};
+
+ThreadPool::ThreadPool(size_t threads) :
+	numThreads   ((threads == 0)? std::max(1u, std::thread::hardware_concurrency()) : threads),
+	workers      (),
+	mutex        (),
+	jobReady     (),
+	jobDone      (),
+	job          (nullptr),
+	numTasks     (0),
+	nextTask     (0),
+	busyWorkers  (0),
+	generation   (0),
+	shuttingDown (false)
+{
+	for (size_t worker = 1; worker < numThreads; ++worker)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, worker);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shuttingDown = true;
+	}
+	jobReady.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::run(size_t tasks, const Job& func)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		job         = &func;
+		numTasks    = tasks;
+		busyWorkers = numThreads - 1;
+		nextTask.store(0, std::memory_order_relaxed);
+		++generation;
+	}
+	jobReady.notify_all();
+
+	executeTasks(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	jobDone.wait(lock, [this]{ return busyWorkers == 0; });
+
+	job = nullptr;
+}
+
+void ThreadPool::workerLoop(size_t workerIndex)
+{
+	size_t seenGeneration = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobReady.wait(lock, [&]{ return shuttingDown || generation != seenGeneration; });
+
+			if (shuttingDown) return;
+
+			seenGeneration = generation;
+		}
+
+		executeTasks(workerIndex);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0) jobDone.notify_all();
+	}
+}
+
+void ThreadPool::executeTasks(size_t workerIndex)
+{
+	for (size_t task = nextTask.fetch_add(1, std::memory_order_relaxed);
+	     task < numTasks;
+	     task = nextTask.fetch_add(1, std::memory_order_relaxed))
+	{
+		(*job)(task, workerIndex);
+	}
+}
+
+#endif  // POTTS_MODEL_THREAD_POOL_HPP_INCLUDED
@@ -4,21 +4,17 @@
 
 #include <cmath>
 #include <limits>
-#include <immintrin.h>
 
-// 3D-vector with basic arithmetic
-union Vector
+// 3D-vector with basic arithmetic.
+// Three plain doubles: bulk spin arithmetic goes through the kernels in Kernels.hpp,
+// so a single vector does not need a SIMD register of its own.
+struct Vector
 {
-	struct
-	{
-		double x, y, z;
-	};
-	__m256d reg256;
-	int64_t conds[4];
+	double x, y, z;
 
 	Vector() = default;
 
-	Vector(double newX, double newY, double newZ);
+	constexpr Vector(double newX, double newY, double newZ);
 
 	inline Vector& operator+=(const Vector& vec);
 	inline Vector& operator-=(const Vector& vec);
@@ -32,87 +28,76 @@ union Vector
 	inline Vector operator*(double k) const;
 	inline Vector operator/(double k) const;
 
-	double lenSqr() const;
-	double length() const;
+	inline double lenSqr() const;
+	inline double length() const;
 	
 	inline void setLength(double newLen);
 
 	inline double scalar(const Vector& v) const;
 };
 
-Vector::Vector(double newX, double newY, double newZ) : 
+constexpr Vector::Vector(double newX, double newY, double newZ) : 
 	x (newX), y (newY), z (newZ)
 {}
 
 inline Vector& Vector::operator+=(const Vector& vec)
 {
-	reg256 = _mm256_add_pd(reg256, vec.reg256);
+	x += vec.x;
+	y += vec.y;
+	z += vec.z;
 
 	return *this;
 }
 
 inline Vector Vector::operator+(const Vector& vec) const
 {
-	Vector toReturn;
-	toReturn.reg256 = _mm256_add_pd(reg256, vec.reg256);
-	
-	return toReturn;
+	return Vector(x + vec.x, y + vec.y, z + vec.z);
 }
 
 inline Vector& Vector::operator-=(const Vector& vec)
 {
-	reg256 = _mm256_sub_pd(reg256, vec.reg256);
+	x -= vec.x;
+	y -= vec.y;
+	z -= vec.z;
 
 	return *this;
 }
 
 inline Vector Vector::operator-(const Vector& vec) const 
 {
-	Vector toReturn;
-	toReturn.reg256 = _mm256_sub_pd(reg256, vec.reg256);
-
-	return toReturn;
+	return Vector(x - vec.x, y - vec.y, z - vec.z);
 }
 
 inline Vector& Vector::operator*=(double k)
 {
-	reg256 = _mm256_mul_pd(reg256, _mm256_set1_pd(k));
+	x *= k;
+	y *= k;
+	z *= k;
 
 	return *this;
 }
 
 inline Vector Vector::operator*(double k) const
 {
-	Vector toReturn;
-	toReturn.reg256 = _mm256_mul_pd(reg256, _mm256_set1_pd(k));
-
-	return toReturn;
+	return Vector(x * k, y * k, z * k);
 }
 
 inline Vector& Vector::operator/=(double k)
 {
-	reg256 = _mm256_mul_pd(reg256, _mm256_set1_pd(1/k));
-
-	return *this;
+	return operator*=(1/k);
 }
 
 inline Vector Vector::operator/(double k) const
 {
-	Vector toReturn;
-	toReturn.reg256 = _mm256_mul_pd(reg256, _mm256_set1_pd(1/k));
-
-	return toReturn;
+	return operator*(1/k);
 }
 
-double Vector::lenSqr() const
+inline double Vector::lenSqr() const
 {
-	Vector len;
-	len.reg256 = _mm256_mul_pd(reg256, reg256);
-
-	return len.x + len.y + len.z;
+	return x*x + y*y + z*z;
 }
 
-double Vector::length() const
+inline double Vector::length() const
 {
 	return std::sqrt(lenSqr());
 }
@@ -0,0 +1,557 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef POTTS_MODEL_WANG_LANDAU_HPP_INCLUDED
+#define POTTS_MODEL_WANG_LANDAU_HPP_INCLUDED
+
+// Wang-Landau mode: the density of states g(E) of the lattice at field_start is estimated
+// once, canonical averages at every temperature then follow from it without new runs.
+// Energies are binned per site in units of interactivity, bins of wang_landau_bin_width
+// spanning the range the state graph allows. The range is split into wang_landau_windows
+// windows, each overlapping the next one by the fraction wang_landau_overlap, and every
+// window is walked by its own lattice on a pool thread:
+//   - a single-site move from E to E' is accepted with probability min(1, g(E) / g(E')),
+//     moves leaving the window are rejected, and ln g(E) of the current bin grows by ln f;
+//   - every wang_landau_sweeps sweeps a window whose visit histogram is flat (every bin
+//     ever visited holds at least wang_landau_flatness of the mean) halves ln f and clears
+//     the histogram. Once ln f falls below 1/t, t being the moves per visited bin so far,
+//     it follows 1/t instead, which keeps the error of ln g from saturating (Belardinelli
+//     and Pereyra). ln g stops changing once ln f is below wang_landau_final_ln_f;
+//   - at the same time neighbouring windows attempt to exchange configurations with
+//     probability min(1, g_i(E_i) g_j(E_j) / (g_i(E_j) g_j(E_i))), alternating even and odd pairs.
+// Windows are joined in the middle of their overlaps, shifted to agree on it on average,
+// and ln g is normalized to STATES^sites configurations in total.
+// Results go to a single .npz file:
+//   energies          - (bins) mean energy per site of the configurations visited in every bin;
+//   log_dos           - (bins) ln g of every bin;
+//   abs_magnetization - (bins) microcanonical <|m|> of every bin;
+//   thermodynamics    - (temperature_steps, THERMODYNAMICS_COLUMNS) canonical averages on the
+//                       ladder temperature_start..temperature_end, see thermodynamics_at;
+//   swap_acceptance   - (wang_landau_windows - 1) acceptance ratio of every neighbour pair.
+// Bins never visited are NaN.
+
+#include "Model.hpp"
+#include "ThreadPool.hpp"
+#include "Batch.hpp"
+#include "Reweighting.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "vendor/cnpy/cnpy.h"
+
+// Energy per site in units of interactivity to bin index:
+struct EnergyBins
+{
+	double minEnergy;
+	double width;
+	size_t count;
+
+	inline size_t of(double energy) const;
+	inline double center(size_t bin) const { return minEnergy + (bin + 0.5) * width; }
+};
+
+inline size_t EnergyBins::of(double energy) const
+{
+	double position = std::floor((energy - minEnergy) / width);
+	if (position < 0.0) return 0;
+
+	return std::min(count - 1, size_t(position));
+}
+
+// Every site owns DIMENSION bonds and one field term:
+template <typename Kind>
+EnergyBins energy_bins(const typename Kind::StateGraph& stateGraph, const ModelParameters& parameters)
+{
+	double minBond =  INFINITY, maxBond  = -INFINITY;
+	double minField = INFINITY, maxField = -INFINITY;
+
+	Vector field = parameters.externalField / parameters.interactivity;
+	for (int state = 0; state < Kind::STATES; ++state)
+	{
+		for (int other = 0; other < Kind::STATES; ++other)
+		{
+			double bond = -stateGraph.spins[state].scalar(stateGraph.spins[other]);
+			minBond = std::min(minBond, bond);
+			maxBond = std::max(maxBond, bond);
+		}
+
+		double fieldTerm = -stateGraph.spins[state].scalar(field);
+		minField = std::min(minField, fieldTerm);
+		maxField = std::max(maxField, fieldTerm);
+	}
+
+	double lowest  = Kind::DIMENSION * minBond + minField;
+	double highest = Kind::DIMENSION * maxBond + maxField;
+
+	// Bin edges are shifted by an irrational fraction of the width, so that no discrete
+	// energy level sits on an edge and flickers between two bins with rounding:
+	EnergyBins bins;
+	bins.width     = wang_landau_bin_width;
+	bins.minEnergy = lowest - 0.6180339887 * bins.width;
+	bins.count     = size_t(std::ceil((highest - bins.minEnergy) / bins.width)) + 1;
+
+	return bins;
+}
+
+// ========================================================================
+// Wang-Landau Walker Of One Energy Window
+// ========================================================================
+
+template <typename Kind>
+struct WangLandauWindow
+{
+	Lattice<Kind> lattice;
+	const EnergyBins& bins;
+	size_t firstBin, endBin; // Bins firstBin..endBin-1
+
+	// Per bin of the window:
+	std::vector<double>   logDos;    // ln g, up to a constant
+	std::vector<uint64_t> histogram; // Visits since ln f was last halved
+	std::vector<uint64_t> visits;
+	std::vector<double>   energySum;
+	std::vector<double>   absMagnetizationSum;
+
+	double logF;
+	uint64_t updates;  // Moves made inside the window
+	bool inverseTime;  // ln f follows 1/t
+	bool entered;      // The walker is inside the window
+	bool converged;    // ln f is below wang_landau_final_ln_f, ln g no longer changes
+
+	WangLandauWindow(int sizeX, int sizeY, int sizeZ, uint64_t windowSeed, const ModelParameters& parameters,
+	                 const EnergyBins& energyBins, size_t first, size_t end);
+
+	// Energy per site in units of interactivity:
+	inline double energy() const;
+	inline bool contains(size_t bin) const { return firstBin <= bin && bin < endBin; }
+	inline double logDosAt(size_t bin) const { return logDos[bin - firstBin]; }
+
+	// Distance from the energy to the window, per site in units of interactivity:
+	inline double distance(double energy) const;
+
+	void walk(size_t steps);
+
+	// Halves ln f once the histogram is flat, or follows 1/t:
+	void refine();
+};
+
+template <typename Kind>
+WangLandauWindow<Kind>::WangLandauWindow(int sizeX, int sizeY, int sizeZ, uint64_t windowSeed,
+                                         const ModelParameters& parameters,
+                                         const EnergyBins& energyBins, size_t first, size_t end) :
+	lattice             (sizeX, sizeY, sizeZ, getStateX<Kind>, getStateY<Kind>, windowSeed, parameters,
+	                     layout_from_name(lattice_layout)),
+	bins                (energyBins),
+	firstBin            (first),
+	endBin              (end),
+	logDos              (end - first, 0.0),
+	histogram           (end - first, 0),
+	visits              (end - first, 0),
+	energySum           (end - first, 0.0),
+	absMagnetizationSum (end - first, 0.0),
+	logF                (1.0),
+	updates             (0),
+	inverseTime         (false),
+	entered             (false),
+	converged           (false)
+{}
+
+template <typename Kind>
+inline double WangLandauWindow<Kind>::energy() const
+{
+	return lattice.totals.energy / (lattice.sites * lattice.parameters.interactivity);
+}
+
+template <typename Kind>
+inline double WangLandauWindow<Kind>::distance(double energy) const
+{
+	double low  = bins.minEnergy + firstBin * bins.width;
+	double high = bins.minEnergy + endBin   * bins.width;
+
+	return (energy < low)? low - energy : (energy >= high)? energy - high : 0.0;
+}
+
+template <typename Kind>
+void WangLandauWindow<Kind>::walk(size_t steps)
+{
+	Lattice<Kind>& walker = lattice;
+
+	double energyScale = walker.sites * walker.parameters.interactivity;
+	double curEnergy   = energy();
+	size_t curBin      = bins.of(curEnergy);
+
+	entered = contains(curBin);
+
+	for (size_t step = 0; step < steps; ++step)
+	{
+		// Same site and move choice as Lattice::metropolisStep:
+		uint64_t randomNum = walker.rng.next();
+
+		uint32_t site = ((randomNum >> 32) * uint32_t(walker.sites)) >> 32;
+
+		int alteredZ = site % walker.sizeZ;
+		site /= walker.sizeZ;
+		int alteredY = site % walker.sizeY;
+		site /= walker.sizeY;
+		int alteredX = site;
+
+		int curState = walker.get(alteredX, alteredY, alteredZ);
+		int newState = walker.acceptance.newState[curState][randomNum & 3];
+
+		double deltaEnergy = walker.moveEnergy(alteredX, alteredY, alteredZ, newState);
+		double nxtEnergy   = (walker.totals.energy + deltaEnergy) / energyScale;
+		size_t nxtBin      = bins.of(nxtEnergy);
+
+		bool accepted;
+		if (entered)
+		{
+			double logRatio = logDosAt(curBin) - ((contains(nxtBin))? logDosAt(nxtBin) : INFINITY);
+			accepted = logRatio >= 0.0 || walker.rng.uniform() < exp(logRatio);
+		}
+		else
+		{
+			// Metropolis walk at the temperature of one interactivity towards the window:
+			double rise = (distance(nxtEnergy) - distance(curEnergy)) * walker.sites;
+			accepted = rise <= 0.0 || walker.rng.uniform() < exp(-rise);
+		}
+
+		walker.moves.attempted += 1;
+		if (accepted)
+		{
+			walker.set(alteredX, alteredY, alteredZ, newState);
+			walker.totals.magnetization += walker.stateGraph.spins[newState].z - walker.stateGraph.spins[curState].z;
+			walker.totals.energy        += deltaEnergy;
+			walker.moves.accepted       += newState != curState;
+
+			curEnergy = nxtEnergy;
+			curBin    = nxtBin;
+			entered   = entered || contains(curBin);
+		}
+
+		if (!entered) continue;
+
+		size_t slot = curBin - firstBin;
+		if (!converged) logDos[slot] += logF;
+
+		updates                   += 1;
+		histogram[slot]           += 1;
+		visits[slot]              += 1;
+		energySum[slot]           += curEnergy;
+		absMagnetizationSum[slot] += std::abs(walker.totals.magnetization) / walker.sites;
+	}
+}
+
+template <typename Kind>
+void WangLandauWindow<Kind>::refine()
+{
+	if (converged || !entered) return;
+
+	// Only bins ever visited count, energies the state graph cannot reach stay empty:
+	uint64_t total = 0, least = UINT64_MAX;
+	size_t seen = 0;
+	for (size_t slot = 0; slot < histogram.size(); ++slot)
+	{
+		if (visits[slot] == 0) continue;
+
+		total += histogram[slot];
+		least  = std::min(least, histogram[slot]);
+		seen  += 1;
+	}
+
+	double inverseT = double(seen) / updates;
+	if (inverseTime)
+	{
+		logF = inverseT;
+	}
+	else if (least != 0 && least >= wang_landau_flatness * total / seen)
+	{
+		logF /= 2.0;
+		std::fill(histogram.begin(), histogram.end(), 0);
+
+		inverseTime = logF < inverseT;
+		if (inverseTime) logF = inverseT;
+	}
+
+	converged = logF < wang_landau_final_ln_f;
+}
+
+// ========================================================================
+// Canonical Averages From The Density Of States
+// ========================================================================
+
+const size_t THERMODYNAMICS_COLUMNS = 6;
+
+// Row of (temperature in Kelvins, e, specific heat, free energy, entropy, |m|), per site:
+// e and free energy in units of interactivity, specific heat and entropy in units of k_B.
+void thermodynamics_at(double temperature, size_t sites, const std::vector<double>& logDos,
+                       const std::vector<double>& energies, const std::vector<double>& absMagnetization,
+                       double* row)
+{
+	ModelParameters parameters = make_parameters(temperature, field_start);
+	double beta = parameters.interactivity / parameters.temperature;
+
+	std::vector<size_t> visited;
+	std::vector<double> logWeights;
+	for (size_t bin = 0; bin < logDos.size(); ++bin)
+	{
+		if (std::isnan(logDos[bin])) continue;
+
+		visited   .push_back(bin);
+		logWeights.push_back(logDos[bin] - beta * sites * energies[bin]);
+	}
+
+	double logPartition = log_sum_exp(logWeights);
+
+	double e = 0.0, e2 = 0.0, absM = 0.0;
+	for (size_t i = 0; i < visited.size(); ++i)
+	{
+		double weight = exp(logWeights[i] - logPartition);
+		double binE   = energies[visited[i]];
+
+		e    += weight * binE;
+		e2   += weight * binE * binE;
+		absM += weight * absMagnetization[visited[i]];
+	}
+
+	double freeEnergy = -logPartition / (beta * sites);
+
+	row[0] = temperature;
+	row[1] = e;
+	row[2] = sites * beta * beta * (e2 - e * e);
+	row[3] = freeEnergy;
+	row[4] = beta * (e - freeEnergy);
+	row[5] = absM;
+}
+
+// ========================================================================
+// Wang-Landau Run
+// ========================================================================
+
+template <typename Kind>
+void run_wang_landau_kind(const char* output_file)
+{
+	int sizeX = lattice_size_x;
+	int sizeY = lattice_size_y;
+	int sizeZ = (Kind::DIMENSION == 3)? lattice_size_z : 1;
+	size_t sites = size_t(sizeX) * sizeY * sizeZ;
+
+	if (wang_landau_bin_width <= 0.0 || wang_landau_windows == 0 ||
+	    wang_landau_overlap < 0.0 || wang_landau_overlap >= 1.0 ||
+	    wang_landau_flatness <= 0.0 || wang_landau_flatness >= 1.0 || wang_landau_final_ln_f <= 0.0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Wang-Landau requires a positive bin width, at least one window, "
+		                "overlap in [0, 1), flatness in (0, 1) and a positive final ln f\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// The density of states depends on the field only, the temperature is a placeholder:
+	ModelParameters parameters = make_parameters(temperature_start, field_start);
+
+	typename Kind::StateGraph stateGraph;
+	EnergyBins bins = energy_bins<Kind>(stateGraph, parameters);
+
+	// Windows of equal width, each shifted by the non-overlapping part of the width:
+	size_t numWindows = wang_landau_windows;
+	double span = bins.count / (1.0 + (numWindows - 1) * (1.0 - wang_landau_overlap));
+	if (span < 2.0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Wang-Landau windows of %lf bins are too narrow\n", span);
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<std::unique_ptr<WangLandauWindow<Kind>>> windows;
+	for (size_t window = 0; window < numWindows; ++window)
+	{
+		size_t first = size_t(window * span * (1.0 - wang_landau_overlap));
+		size_t end   = (window + 1 == numWindows)? bins.count : std::min(bins.count, size_t(std::ceil(first + span)));
+
+		windows.emplace_back(new WangLandauWindow<Kind>(sizeX, sizeY, sizeZ, counterHash(seed, window), parameters,
+		                                                bins, first, end));
+	}
+
+	printf("Estimating the density of states over %zu bins from e=%lf to e=%lf at H=%lf in %zu windows\n",
+	       bins.count, bins.center(0), bins.center(bins.count - 1), field_start, numWindows);
+
+	std::vector<size_t> swapsAttempted(numWindows - 1), swapsAccepted(numWindows - 1);
+	std::vector<MoveCounters> published(numWindows, MoveCounters{0, 0});
+	RandomStream exchangeStream(seed, numWindows + 1);
+
+	size_t stepsPerRound = std::max<size_t>(1, wang_landau_sweeps) * sites;
+
+	ThreadPool pool(threads);
+
+	double shownLogF = NAN;
+	size_t shownConverged = 0;
+	for (size_t round = 0;; ++round)
+	{
+		pool.run(numWindows, [&](size_t window, size_t /* worker */)
+		{
+			WangLandauWindow<Kind>& walker = *windows[window];
+
+			WorkerMetrics& metrics = worker_metrics();
+			uint64_t phaseStart = metrics_clock();
+
+			walker.walk(stepsPerRound);
+			walker.lattice.resyncTotals();
+			walker.refine();
+
+			MoveCounters moves = {walker.lattice.moves.attempted - published[window].attempted,
+			                      walker.lattice.moves.accepted  - published[window].accepted};
+			published[window] = walker.lattice.moves;
+
+			metrics.addPhase(PHASE_MC, metrics_clock() - phaseStart);
+			metrics.addMoves(moves);
+		});
+
+		// Replica exchange between neighbouring windows, both energies must lie in the overlap:
+		for (size_t window = round % 2; window + 1 < numWindows; window += 2)
+		{
+			WangLandauWindow<Kind>& lower = *windows[window];
+			WangLandauWindow<Kind>& upper = *windows[window + 1];
+
+			size_t lowerBin = bins.of(lower.energy());
+			size_t upperBin = bins.of(upper.energy());
+
+			if (!lower.entered || !upper.entered || !lower.contains(upperBin) || !upper.contains(lowerBin)) continue;
+
+			double logRatio = lower.logDosAt(lowerBin) - lower.logDosAt(upperBin) +
+			                  upper.logDosAt(upperBin) - upper.logDosAt(lowerBin);
+
+			++swapsAttempted[window];
+			if (logRatio >= 0.0 || exchangeStream.uniform() < exp(logRatio))
+			{
+				lower.lattice.swapConfiguration(upper.lattice);
+				++swapsAccepted[window];
+			}
+		}
+
+		double logF = 0.0;
+		size_t converged = 0;
+		for (const auto& walker : windows)
+		{
+			logF       = std::max(logF, walker->logF);
+			converged += walker->converged;
+		}
+
+		// ln f following 1/t changes every round, it is shown once per halving:
+		if (!(logF > shownLogF / 2.0) || converged != shownConverged)
+		{
+			printf("\rComputation in progress: ln f = %.3e, %zu of %zu windows converged", logF, converged, numWindows);
+			fflush(stdout);
+
+			shownLogF      = logF;
+			shownConverged = converged;
+		}
+
+		if (converged == numWindows) break;
+	}
+
+	printf("\nComputation completed!\n");
+
+	// Microcanonical sums of all windows:
+	std::vector<uint64_t> visits(bins.count, 0);
+	std::vector<double> energySum(bins.count, 0.0), absMagnetizationSum(bins.count, 0.0);
+	for (const auto& walker : windows)
+	{
+		for (size_t bin = walker->firstBin; bin < walker->endBin; ++bin)
+		{
+			visits[bin]              += walker->visits[bin - walker->firstBin];
+			energySum[bin]           += walker->energySum[bin - walker->firstBin];
+			absMagnetizationSum[bin] += walker->absMagnetizationSum[bin - walker->firstBin];
+		}
+	}
+
+	// Every window owns the bins up to the middle of its overlap with the next one:
+	std::vector<double> logDos(bins.count, NAN);
+	double shift = 0.0;
+	size_t from = 0;
+	for (size_t window = 0; window < numWindows; ++window)
+	{
+		const WangLandauWindow<Kind>& cur = *windows[window];
+
+		size_t to = cur.endBin;
+		double nextShift = 0.0;
+		if (window + 1 < numWindows)
+		{
+			const WangLandauWindow<Kind>& next = *windows[window + 1];
+
+			std::vector<size_t> common;
+			double offset = 0.0;
+			for (size_t bin = next.firstBin; bin < cur.endBin; ++bin)
+			{
+				if (cur.visits[bin - cur.firstBin] == 0 || next.visits[bin - next.firstBin] == 0) continue;
+
+				common.push_back(bin);
+				offset += cur.logDosAt(bin) - next.logDosAt(bin);
+			}
+
+			if (common.empty())
+			{
+				fprintf(stderr, "[ISING-MODEL] Wang-Landau windows %zu and %zu share no visited energies\n",
+				        window, window + 1);
+				exit(EXIT_FAILURE);
+			}
+
+			to        = common[common.size() / 2];
+			nextShift = shift + offset / common.size();
+		}
+
+		for (size_t bin = from; bin < to; ++bin)
+		{
+			if (cur.visits[bin - cur.firstBin] != 0) logDos[bin] = cur.logDosAt(bin) + shift;
+		}
+
+		from  = to;
+		shift = nextShift;
+	}
+
+	std::vector<double> visitedLogDos;
+	for (double value : logDos)
+	{
+		if (!std::isnan(value)) visitedLogDos.push_back(value);
+	}
+
+	double normalization = sites * log(double(Kind::STATES)) - log_sum_exp(visitedLogDos);
+
+	std::vector<double> energies(bins.count, NAN), absMagnetization(bins.count, NAN);
+	for (size_t bin = 0; bin < bins.count; ++bin)
+	{
+		if (std::isnan(logDos[bin])) continue;
+
+		logDos[bin]          += normalization;
+		energies[bin]         = energySum[bin]           / visits[bin];
+		absMagnetization[bin] = absMagnetizationSum[bin] / visits[bin];
+	}
+
+	size_t steps = (temperature_steps == 0)? 1 : temperature_steps;
+	std::vector<double> thermodynamics(THERMODYNAMICS_COLUMNS * steps);
+	for (size_t step = 0; step < steps; ++step)
+	{
+		thermodynamics_at(linspace_at(temperature_start, temperature_end, steps, step), sites,
+		                  logDos, energies, absMagnetization, &thermodynamics[THERMODYNAMICS_COLUMNS * step]);
+	}
+
+	std::vector<double> swapAcceptance(numWindows - 1);
+	for (size_t window = 0; window + 1 < numWindows; ++window)
+	{
+		swapAcceptance[window] = (swapsAttempted[window] == 0)? 0.0 : double(swapsAccepted[window]) / swapsAttempted[window];
+		printf("Swap acceptance window %zu <-> window %zu: %0.03lf\n", window, window + 1, swapAcceptance[window]);
+	}
+
+	cnpy::npz_save(output_file, "energies",          energies.data(),         {bins.count},                    "w");
+	cnpy::npz_save(output_file, "log_dos",           logDos.data(),           {bins.count},                    "a");
+	cnpy::npz_save(output_file, "abs_magnetization", absMagnetization.data(), {bins.count},                    "a");
+	cnpy::npz_save(output_file, "thermodynamics",    thermodynamics.data(),   {steps, THERMODYNAMICS_COLUMNS}, "a");
+	cnpy::npz_save(output_file, "swap_acceptance",   swapAcceptance.data(),   {numWindows - 1},                "a");
+}
+
+void run_wang_landau(const char* output_file)
+{
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		run_wang_landau_kind<decltype(kind)>(output_file);
+	});
+}
+
+#endif  // POTTS_MODEL_WANG_LANDAU_HPP_INCLUDED
@@ -6,79 +6,34 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cinttypes>
+#include <cmath>
 
 // ========================================================================
 // Configuration File Work                                                
 // ========================================================================
 
-#include "Vector.hpp"
-
-double temperature;
-Vector externalField;
-double interactivity;
-double magnetic_moment;
-size_t saved_data_samples;
-size_t burn_in_samples;
-size_t mc_iters_per_sample;
-size_t iters_per_render_frame;
-
-void read_config(const char* filename)
-{
-	FILE* conf_file = std::fopen(filename, "r");
-	if (conf_file == NULL)
-	{
-		fprintf(stderr, "[ISING_MODEL] Unable to open config file\n");
-		exit(EXIT_FAILURE);
-	}
-
-	if (fscanf(conf_file,            "temperature %lf\n",            &temperature) != 1)            temperature = 100.0;
-	if (fscanf(conf_file,                  "field %lf\n",        &externalField.z) != 1)        externalField.z = 0.0;
-	if (fscanf(conf_file,          "interactivity %lf\n",          &interactivity) != 1)          interactivity = 1.0;
-	if (fscanf(conf_file,        "magnetic_moment %lf\n",        &magnetic_moment) != 1)        magnetic_moment = 1.0;
-	if (fscanf(conf_file,     "saved_data_samples %zu\n",     &saved_data_samples) != 1)     saved_data_samples = 100;
-	if (fscanf(conf_file,        "burn_in_samples %zu\n",        &burn_in_samples) != 1)        burn_in_samples = 20;
-	if (fscanf(conf_file,    "mc_iters_per_sample %zu\n",    &mc_iters_per_sample) != 1)    mc_iters_per_sample = 100000;
-	if (fscanf(conf_file, "iters_per_render_frame %zu\n", &iters_per_render_frame) != 1) iters_per_render_frame = 50000;
-
-	interactivity *= 1.6e-19; // Joules
-	temperature *= 1.38e-23; // kT
-
-	externalField.z *= 0.01 * magnetic_moment;
-
-	externalField.x = 0.0;
-	externalField.y = 0.0;
-
-	fclose(conf_file);
-}
-
+#include "Config.hpp"
 #include "Model.hpp"
 
 // ========================================================================
 // Initial Spin States                                                     
 // ========================================================================
 
-int getStateX(int x, int y, int z)
-{
-	return rand() % STATE_GRAPH_SIZE_X;
-}
-
-int getStateY(int x, int y, int z)
-{
-	return rand() % STATE_GRAPH_SIZE_Y;
-}
+#include "InitialState.hpp"
 
 // ========================================================================
 #ifdef RENDERING
 // ========================================================================
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include <fcntl.h>
 #include <unistd.h>
 
-#include <sys/mman.h>
-#include <sys/ioctl.h>
-#include <linux/fb.h>
-#include <linux/kd.h>
-#include <time.h>
+#include "Render.hpp"
 
 int main(int argc, char** argv)
 {
@@ -99,54 +54,20 @@ int main(int argc, char** argv)
 	double oldFieldZ = 100.0 * externalField.z / magnetic_moment;
 	double oldT      = temperature / 1.38e-23;
 
-	//=================================
-	// Open frame buffer for rendering 
-	//=================================
-
-	int fb0_fd = open("/dev/fb0", O_RDWR);
-	if (fb0_fd == -1)
-	{
-		fprintf(stderr, "[ISING-MODEL] Unable to open /dev/fb0\n");
-		exit(EXIT_FAILURE);
-	}
-	
-	struct fb_var_screeninfo vinf;
-    if (ioctl(fb0_fd, FBIOGET_VSCREENINFO, &vinf) == -1)
-    {
-    	fprintf(stderr, "[ISING-MODEL] Unable get variable screen info\n");
-		exit(EXIT_FAILURE);
-    }
-	
-	struct fb_fix_screeninfo finf;
-	if (ioctl(fb0_fd, FBIOGET_FSCREENINFO, &finf) == -1)
-	{
-		fprintf(stderr, "[ISING-MODEL] Unable to get fixed screen info\n");
-		exit(EXIT_FAILURE);
-	}
+	//=====================================================
+	// Frames go to the frame buffer or to the output file 
+	//=====================================================
 
-	//=========================================
-	// Map frame buffer into our address space 
-	//=========================================
+	bool headless = strcmp(render_output, "framebuffer") != 0;
 
-	char* frame_buffer = (char*) mmap(NULL, finf.line_length * vinf.yres, PROT_READ | PROT_WRITE, MAP_SHARED, fb0_fd, 0);
-	if (frame_buffer == MAP_FAILED)
+	std::unique_ptr<FramebufferTarget> framebuffer;
+	if (!headless)
 	{
-		fprintf(stderr, "[ISING-MODEL] Unable to map frame buffer into address space\n");
-		exit(EXIT_FAILURE);
+		framebuffer.reset(new FramebufferTarget("/dev/fb0"));
 	}
-	
-	//===================================================
-	// Parse frame buffer info (used only for rendering) 
-	//===================================================
-
-	size_t        fb_size         = finf.line_length * vinf.yres;
-	size_t        bytes_per_pixel = vinf.bits_per_pixel/8;
-	size_t        bytes_per_line  = finf.line_length;
-	uint_fast16_t offset_red      = vinf.red.offset   / 8;
-	uint_fast16_t offset_green    = vinf.green.offset / 8;
-	uint_fast16_t offset_blue     = vinf.blue.offset  / 8;
-	size_t        sizeX           = vinf.xres;
-	size_t        sizeY           = vinf.yres;
+
+	// Frames streamed to stdout leave it to them:
+	FILE* statusStream = (headless && strcmp(argv[2], "-") == 0)? stderr : stdout;
 
 	//==========================
 	// Configure input settings 
@@ -162,89 +83,96 @@ int main(int argc, char** argv)
 	// Calculations 
 	//==============
 
-	size_t sizeZ = 5;
-	size_t curZ  = 0;
+	// The lattice is built for the precompiled model selected by the config:
+	dispatch_model_kind(state_graph_size_x, state_graph_size_y, lattice_dimension, [&](auto kind)
+	{
+		using Kind = decltype(kind);
+
+		// A site per tile of the screen, the bottom three rows of tiles are left to the console:
+		int sizeX  = headless? lattice_size_x : framebuffer->tilesX();
+		int sizeY  = headless? lattice_size_y : framebuffer->tilesY();
+		int sizeZ  = (Kind::DIMENSION == 3)? (headless? lattice_size_z : 5) : 1;
+		int shownY = headless? sizeY : sizeY - 3;
+		int curZ   = 0;
 
-	Lattice isingModel = Lattice(sizeX/8, sizeY/8, sizeZ, getStateX, getStateY);
+		Lattice<Kind> isingModel(sizeX, sizeY, sizeZ, getStateX<Kind>, getStateY<Kind>, seed,
+		                         {temperature, externalField, interactivity});
 
-	double saved_magnetization = 0.0;
-	for (size_t iter = 0; true; iter = (iter + 1) % 10)
-	{
-		// User Interaction:
-		char curCmd;
-		for (int bytes_read = read(STDIN_FILENO, &curCmd, 1);
-			bytes_read != 0 && curCmd != '\n';
-			bytes_read = read(STDIN_FILENO, &curCmd, 1))
+		std::vector<Rgb> palette = state_palette<Kind>(isingModel.stateGraph);
+
+		std::unique_ptr<StreamTarget> stream;
+		RenderTarget* target = framebuffer.get();
+		if (headless)
 		{
-			switch (curCmd)
-			{
-				case 'w':
-				{
-					oldT += 2.0;
-					temperature = 1.38e-23 * oldT;
-					break;
-				}
-				case 's':
-				{
-					oldT -= 2.0;
-					temperature = 1.38e-23 * oldT;
-					break;
-				}
-				case 'a':
-				{
-					oldFieldZ -= 0.1;
-					externalField.z = oldFieldZ * 0.01 * magnetic_moment;
-					break;
-				}
-				case 'd':
-				{
-					oldFieldZ += 0.1;
-					externalField.z = oldFieldZ * 0.01 * magnetic_moment;
-					break;
-				}
-			}
+			stream.reset(new StreamTarget(argv[2], render_output, sizeX, shownY, palette));
+			target = stream.get();
 		}
-
-		for (size_t i = 0; i < iters_per_render_frame; ++i)
+		else
 		{
-			isingModel.metropolisStep();
+			framebuffer->setPalette(palette);
 		}
 
-		for (uint_fast16_t x = 0; x < sizeX/8; ++x)
+		// Draws on its own thread, this one only simulates and publishes snapshots:
+		FrameExchange exchange;
+		Renderer renderer(exchange, *target, sizeX, shownY, render_frames, statusStream);
+
+		for (uint64_t frame = 0; !renderer.finished.load(std::memory_order_acquire); ++frame)
 		{
-			for (uint_fast16_t y = 0; y < sizeY/8-3; ++y)
+			// User Interaction:
+			char curCmd;
+			for (int bytes_read = read(STDIN_FILENO, &curCmd, 1);
+				bytes_read > 0 && curCmd != '\n';
+				bytes_read = read(STDIN_FILENO, &curCmd, 1))
 			{
-				LatticePoint curPoint = isingModel.get(x, y, curZ);
-				Vector spin = isingModel.stateGraph.get(curPoint.stateX, curPoint.stateY);
-
-				for (size_t dx = 0; dx < 8; ++dx) {
-				for (size_t dy = 0; dy < 8; ++dy) {
-					uint_fast16_t pix_offset = (8*x+dx) * bytes_per_pixel +
-					                           (8*y+dy) * bytes_per_line;
-					frame_buffer[pix_offset + offset_red  ] = (1.0 + spin.x) * 127;;
-					frame_buffer[pix_offset + offset_green] = (1.0 + spin.z) * 127;
-					frame_buffer[pix_offset + offset_blue ] = (1.0 + spin.y) * 127;;
-				}}
+				switch (curCmd)
+				{
+					case 'w':
+					{
+						oldT += 2.0;
+						temperature = 1.38e-23 * oldT;
+						break;
+					}
+					case 's':
+					{
+						oldT -= 2.0;
+						temperature = 1.38e-23 * oldT;
+						break;
+					}
+					case 'a':
+					{
+						oldFieldZ -= 0.1;
+						externalField.z = oldFieldZ * 0.01 * magnetic_moment;
+						break;
+					}
+					case 'd':
+					{
+						oldFieldZ += 0.1;
+						externalField.z = oldFieldZ * 0.01 * magnetic_moment;
+						break;
+					}
+				}
 			}
-		}
 
-		if (iter == 0) saved_magnetization = isingModel.calculateMagnetization();
+			// The lattice notices the change and rebuilds its acceptance table:
+			isingModel.parameters = {temperature, externalField, interactivity};
 
-		printf("T = %0.03lf, H = %0.03lf, M = %0.03lf\r", oldT, oldFieldZ, saved_magnetization);
-		fflush(stdout);
-	}
+			for (size_t i = 0; i < iters_per_render_frame; ++i)
+			{
+				isingModel.metropolisStep();
+			}
 
-	//======================
-	// Deallocate resources 
-	//======================
+			// Dropped if the renderer is still busy with the previous one:
+			FrameSnapshot& snapshot = exchange.back;
+			capture_frame(isingModel, curZ, sizeX, shownY, snapshot);
+			snapshot.frame       = frame;
+			snapshot.temperature = oldT;
+			snapshot.field       = oldFieldZ;
 
-	if (munmap(frame_buffer, fb_size) == -1)
-	{
-		fprintf(stderr, "[ISING-MODEL] Expected input: model <config file> <output file>\n");
-		exit(EXIT_FAILURE);
-	}
+			exchange.publish();
+		}
+	});
 
-	close(fb0_fd);
+	fprintf(statusStream, "\n");
 
 	return EXIT_SUCCESS;
 }
@@ -255,10 +183,19 @@ int main(int argc, char** argv)
 
 #include <thread>
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include "vendor/cnpy/cnpy.h"
 
+#include "Simulation.hpp"
+#include "Batch.hpp"
+#include "Tempering.hpp"
+#include "Domain.hpp"
+#include "Schedule.hpp"
+#include "WangLandau.hpp"
+#include "Correlation.hpp"
+
 int main(int argc, char** argv)
 {
 	if (argc != 3)
@@ -272,61 +209,97 @@ int main(int argc, char** argv)
 	//=========================
 
 	read_config(argv[1]);
+
+	//=====================================================
+	// One lattice over several processes, forks first 
+	//=====================================================
+
+	if (strcmp(run_mode, "domain") == 0)
+	{
+		run_domain(argv[2]);
+
+		return EXIT_SUCCESS;
+	}
+
+	//=================================================
+	// Live metrics, rewritten until the process ends 
+	//=================================================
+
+	std::unique_ptr<MetricsExporter> exporter;
+	if (strcmp(metrics_file, "none") != 0)
+	{
+		exporter.reset(new MetricsExporter(metrics_file, metrics_interval));
+	}
+
+	//=====================================================
+	// Whole parameter grid or ladder in a single process 
+	//=====================================================
+
+	if (strcmp(run_mode, "batch") == 0)
+	{
+		run_batch(argv[2]);
+
+		return EXIT_SUCCESS;
+	}
+	else if (strcmp(run_mode, "tempering") == 0)
+	{
+		run_tempering(argv[2]);
+
+		return EXIT_SUCCESS;
+	}
+	else if (strcmp(run_mode, "schedule") == 0)
+	{
+		run_schedule(argv[2]);
+
+		return EXIT_SUCCESS;
+	}
+	else if (strcmp(run_mode, "wang_landau") == 0)
+	{
+		run_wang_landau(argv[2]);
+
+		return EXIT_SUCCESS;
+	}
+	else if (strcmp(run_mode, "single") != 0)
+	{
+		fprintf(stderr, "[ISING-MODEL] Unknown run mode \"%s\"\n", run_mode);
+		exit(EXIT_FAILURE);
+	}
 	
 	// Fixing units:
 
 	double oldFieldZ = 100.0 * externalField.z / magnetic_moment;
 	double oldT      = temperature / 1.38e-23;
 
-	//===================================
-	// Allocate buffer for data triplets 
-	//===================================
+	//=========================================
+	// Samples are streamed to the output file 
+	//=========================================
+
+	NpyStream output(argv[2], observables, output_chunk_samples);
+	StatisticsSink statistics(output);
 
-	double* data_points = (double*) calloc(2 * saved_data_samples, sizeof(*data_points));
-	if (data_points == NULL)
-	{
-		fprintf(stderr, "[ISING-MODEL] Unable to allocate array for saved data!\n");
-		exit(EXIT_FAILURE);
-	}
+	// Correlations are measured from lattice snapshots on a thread of their own:
+	std::unique_ptr<CorrelationSink> correlation;
+	if (strcmp(correlation_file, "none") != 0) correlation = make_correlation_sink(statistics, correlation_file);
+
+	SampleSink& sink = (correlation)? static_cast<SampleSink&>(*correlation) : statistics;
 
 	//==============
 	// Calculations 
 	//==============
 
-	printf("Computing for T=%lf H=%lf\n", oldT, oldFieldZ);
-
-	int sizeX = 30;
-	int sizeY = 30;
-	int sizeZ = 30;
-	Lattice isingModel = Lattice(sizeX, sizeY, sizeZ, getStateX, getStateY);
+	printf("Computing for T=%lf H=%lf (%s observable kernels)\n", oldT, oldFieldZ, observableKernels().isa);
 
-	for (size_t iteration = 0, cur_saved_data = 0; iteration < burn_in_samples + saved_data_samples; ++iteration)
-	{
-		printf("\rComputation in progress: %02.0f%%", 100.0 * cur_saved_data/saved_data_samples);
-		fflush(stdout);
+	// Resumes from the checkpoint file if it holds a checkpoint of this configuration:
+	const char* checkpointFile = (strcmp(checkpoint_file, "none") == 0)? nullptr : checkpoint_file;
 
-		for (size_t iter = 0; iter < mc_iters_per_sample; ++iter)
-			isingModel.metropolisStep();
+	simulate_point({temperature, externalField, interactivity}, seed, threads, sink, true, checkpointFile);
 
-		if (burn_in_samples <= iteration && cur_saved_data < saved_data_samples)
-		{
-			data_points[2 * cur_saved_data + 0] = magnetic_moment * isingModel.calculateMagnetization();
-			data_points[2 * cur_saved_data + 1] = isingModel.calculateEnergy();
-
-			++cur_saved_data;
-		}
-	}
-	
 	printf("\rComputation in progress: %02.0f%%", 100.0);
 	printf("\nComputation completed!\n");
 
-	//============================
-	// Save data triplets to file 
-	//============================
+	if (correlation) correlation->finish();
 
-	cnpy::npy_save(argv[2], data_points, {saved_data_samples, 2}, "w");
-	
-	delete[] data_points;
+	print_summary(statistics.statistics.summary());
 
 	return EXIT_SUCCESS;
 }